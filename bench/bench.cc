@@ -0,0 +1,192 @@
+// Reproducible render benchmark.
+// Renders a fixed set of canonical scenes at fixed seeds, resolutions and sample counts, and reports for each one the
+// tracing rate, the time to the first finished tile, the peak resident memory and a checksum of the image. The
+// checksum only changes when the rendered image does, so a change that should not affect the output can be checked
+// with it, and the rates can be compared across commits on the same host.
+//
+// The human-readable table goes to stderr and the results go to stdout as JSON, one scene per line:
+//
+//     bin/bench > results.json            every scene, one render thread
+//     bin/bench --threads 8 book dielectric
+//
+// Rays are counted by the flattened BVH every scene is traced through, so the rate covers every bounce.
+
+#include "../src/camera.h"
+#include "../src/color.h"
+#include "../src/image_writer.h"
+#include "../src/linear_bvh.h"
+#include "../src/scenes.h"
+#include "../src/sphere_soup.h"
+#include "../src/utils.h"
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+struct bench_scene
+{
+    const char *                                           name;
+    std::function<void(hittable_list &, material_table &)> build;
+    int                                                    image_width;
+    int                                                    samples_per_pixel;
+    int                                                    max_depth;
+    bool                                                   book_camera; // the book's view, else a close-up
+};
+
+std::vector<bench_scene> canonical_scenes()
+{
+    return {
+        {"book", [](hittable_list & w, material_table & m) { book_scene(w, m); }, 400, 16, 8, true},
+        {"book_100k", [](hittable_list & w, material_table & m) { book_scene(w, m, 100000); }, 400, 4, 8, true},
+        {"dielectric", [](hittable_list & w, material_table & m) { dielectric_scene(w, m); }, 400, 8, 32, true},
+        {"single_sphere", [](hittable_list & w, material_table & m) { single_sphere_scene(w, m); }, 400, 64, 8,
+            false},
+    };
+}
+
+struct bench_result
+{
+    size_t   objects;
+    double   build_seconds;
+    double   render_seconds;
+    double   first_tile_seconds; // from the start of the scene setup to the first finished tile
+    uint64_t rays;
+    long     peak_rss_kb;
+    uint32_t checksum; // CRC-32 of the binary PPM
+};
+
+// Resets the peak resident set size so the next reading covers only what follows. Linux only; elsewhere the peak
+// stays the whole process's.
+void reset_peak_rss()
+{
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    clear_refs << "5";
+}
+
+long peak_rss_kb()
+{
+    std::ifstream status("/proc/self/status");
+    std::string   line;
+    while (std::getline(status, line))
+        if (line.compare(0, 6, "VmHWM:") == 0)
+            return std::atol(line.c_str() + 6);
+
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+bench_result run_scene(const bench_scene & scene, int threads, unsigned int seed)
+{
+    using clock = std::chrono::steady_clock;
+
+    reset_peak_rss();
+    utils::randomize(seed);
+    uint64_t rays_before = bvh_stats::total_rays;
+    auto     start       = clock::now();
+
+    material_table materials;
+    hittable_list  world;
+    scene.build(world, materials);
+    linear_bvh accelerated(world);
+    auto       built = clock::now();
+
+    camera cam;
+    cam.image_width       = scene.image_width;
+    cam.samples_per_pixel = scene.samples_per_pixel;
+    cam.max_depth         = scene.max_depth;
+    cam.thread_count      = threads;
+    cam.show_progress     = false;
+    if (scene.book_camera)
+        book_view(cam);
+    else
+    {
+        cam.vfov     = 40;
+        cam.lookfrom = point3(0, 0, 4);
+        cam.lookat   = point3(0, 0, 0);
+    }
+
+    std::atomic<int64_t> first_tile_ns{-1};
+    cam.on_tile_done = [&](int, int, int, int) {
+        int64_t none = -1;
+        first_tile_ns.compare_exchange_strong(
+            none, std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count());
+    };
+
+    auto                          image   = cam.render(accelerated);
+    std::chrono::duration<double> elapsed = clock::now() - built;
+
+    bench_result result;
+    result.objects            = world.objects.size();
+    result.build_seconds      = std::chrono::duration<double>(built - start).count();
+    result.render_seconds     = elapsed.count();
+    result.first_tile_seconds = first_tile_ns * 1e-9;
+    result.rays               = bvh_stats::total_rays - rays_before; // render threads fold their counts in on exit
+    result.peak_rss_kb        = peak_rss_kb();
+
+    auto ppm        = image_writer::encode_ppm(image);
+    result.checksum = image_writer::crc32(ppm.data(), ppm.size());
+    return result;
+}
+
+// The settings that change what is measured, so results from different builds are not compared by mistake.
+std::string build_config()
+{
+    std::string config = sizeof(real) == sizeof(float) ? "float" : "double";
+    config += VEC3_SIMD ? ", simd vec3" : ", packed vec3";
+    config += ", soup lanes " + std::to_string(sphere_soup::lanes);
+    config += ", compiler " __VERSION__;
+    return config;
+}
+
+int main(int argc, char * argv[])
+{
+    int                      threads = 1;
+    unsigned int             seed    = 1;
+    std::vector<std::string> only;
+    for (int a = 1; a < argc; ++a)
+    {
+        std::string arg = argv[a];
+        if (arg == "--threads" && a + 1 < argc)
+            threads = std::atoi(argv[++a]);
+        else if (arg == "--seed" && a + 1 < argc)
+            seed = static_cast<unsigned int>(std::atol(argv[++a]));
+        else
+            only.push_back(arg);
+    }
+
+    std::fprintf(stderr, "%-14s %9s %9s %9s %10s %10s %11s %10s\n", "scene", "objects", "build s", "render s",
+        "Mrays/s", "1st tile s", "peak RSS MB", "checksum");
+    std::printf("{\"build\": \"%s\", \"threads\": %d, \"seed\": %u, \"scenes\": [\n", build_config().c_str(),
+        threads, seed);
+
+    bool first = true;
+    for (const auto & scene : canonical_scenes())
+    {
+        if (!only.empty() && std::find(only.begin(), only.end(), scene.name) == only.end())
+            continue;
+
+        auto   r    = run_scene(scene, threads, seed);
+        double rate = r.rays / r.render_seconds / 1e6;
+        std::fprintf(stderr, "%-14s %9zu %9.3f %9.3f %10.3f %10.4f %11.1f   %08x\n", scene.name, r.objects,
+            r.build_seconds, r.render_seconds, rate, r.first_tile_seconds, r.peak_rss_kb / 1024.0, r.checksum);
+        std::printf("%s  {\"scene\": \"%s\", \"image_width\": %d, \"samples_per_pixel\": %d, \"max_depth\": %d, "
+                    "\"objects\": %zu, \"build_seconds\": %.6f, \"render_seconds\": %.6f, \"rays\": %llu, "
+                    "\"mrays_per_second\": %.4f, \"first_tile_seconds\": %.6f, \"peak_rss_kb\": %ld, "
+                    "\"checksum\": \"%08x\"}",
+            first ? "" : ",\n", scene.name, scene.image_width, scene.samples_per_pixel, scene.max_depth, r.objects,
+            r.build_seconds, r.render_seconds, static_cast<unsigned long long>(r.rays), rate, r.first_tile_seconds,
+            r.peak_rss_kb, r.checksum);
+        first = false;
+    }
+    std::printf("\n]}\n");
+}
@@ -0,0 +1,84 @@
+// Denoiser benchmark for denoise.h.
+// Renders a small image of the book scene at 4, 8, 16 and 32 samples per pixel with first-hit features, filters each
+// render, and compares the noisy and the filtered image to a 128 spp render, which is what the denoiser is meant to
+// stand in for. Errors are the RMSE of the linear pixel values against a ground truth rendered with many more samples
+// and another seed, so the 128 spp row shows how close a plain render at that count gets. Times are wall-clock, with
+// the filter's on its own.
+//
+//     bin/denoise_bench                      200 pixels wide, ground truth at 1024 spp
+//     bin/denoise_bench --width 400 --truth 4096 --threads 8 --iterations 4
+//     bin/denoise_bench --sigma-luminance 4 --sigma-normal 0.3 --sigma-depth 0.02
+
+#include "../src/camera.h"
+#include "../src/denoise.h"
+#include "../src/linear_bvh.h"
+#include "../src/scenes.h"
+#include "../src/utils.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+int main(int argc, char * argv[])
+{
+    int               width   = 200;
+    int               truth   = 1024;
+    int               threads = 0;
+    denoise::settings options;
+    for (int a = 1; a + 1 < argc; a += 2)
+    {
+        std::string arg   = argv[a];
+        double      value = std::atof(argv[a + 1]);
+        if (arg == "--width")
+            width = static_cast<int>(value);
+        else if (arg == "--truth")
+            truth = static_cast<int>(value);
+        else if (arg == "--threads")
+            threads = static_cast<int>(value);
+        else if (arg == "--iterations")
+            options.iterations = static_cast<int>(value);
+        else if (arg == "--sigma-luminance")
+            options.sigma_luminance = static_cast<float>(value);
+        else if (arg == "--sigma-normal")
+            options.sigma_normal = static_cast<float>(value);
+        else if (arg == "--sigma-depth")
+            options.sigma_depth = static_cast<float>(value);
+    }
+    options.thread_count = threads;
+
+    using clock = std::chrono::steady_clock;
+
+    utils::randomize(1);
+    material_table materials;
+    hittable_list  world;
+    book_scene(world, materials);
+    linear_bvh accelerated(world);
+
+    std::printf("Ground truth: %d pixels wide at %d spp (seed 2), %d lanes per SIMD instruction\n", width, truth,
+        DENOISE_LANES);
+    utils::randomize(2);
+    camera truth_cam   = book_camera(width, truth, threads);
+    truth_cam.features = true;
+    auto reference     = truth_cam.render(accelerated);
+
+    thread_pool pool(static_cast<unsigned>(threads));
+    std::printf("%5s %10s %10s %10s %10s %10s\n", "spp", "render s", "denoise s", "total s", "noisy", "denoised");
+    for (int spp : {4, 8, 16, 32, 128})
+    {
+        camera cam   = book_camera(width, spp, threads);
+        cam.features = true;
+        utils::randomize(3);
+        auto                          start  = clock::now();
+        auto                          image  = cam.render(accelerated);
+        std::chrono::duration<double> render = clock::now() - start;
+
+        start                                 = clock::now();
+        auto                          clean   = denoise::filter(image, options, pool);
+        std::chrono::duration<double> filter  = clock::now() - start;
+
+        std::printf("%5d %10.3f %10.4f %10.3f %10.5f %10.5f\n", spp, render.count(), filter.count(),
+            render.count() + filter.count(), rmse(image, reference), rmse(clean, reference));
+    }
+}
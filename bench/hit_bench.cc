@@ -0,0 +1,176 @@
+// Microbenchmark for the material handle carried by hit_record.
+// Traces random rays against a flat list of spheres that share a handful of materials, the way the book scene does,
+// once with records that own their material through a shared_ptr (the old hit_record) and once with the observer
+// pointer hit_record uses now. Every candidate hit stores the material and copies the record, so the owning version
+// pays two atomic refcount updates per candidate. The threaded column has every thread updating the same few
+// counters, which is where the shared cache lines start bouncing between cores.
+
+#include "../src/material.h"
+#include "../src/utils.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// The old hit_record layout.
+struct owning_record
+{
+    point3                    p;
+    vec3                      normal;
+    double                    t;
+    bool                      front_face;
+    std::shared_ptr<material> mat;
+};
+
+// The current hit_record layout.
+struct observer_record
+{
+    point3           p;
+    vec3             normal;
+    double           t;
+    bool             front_face;
+    const material * mat = nullptr;
+};
+
+struct bench_sphere
+{
+    point3                    center;
+    double                    radius;
+    std::shared_ptr<material> mat;
+};
+
+inline void set_material(owning_record & rec, const std::shared_ptr<material> & mat)
+{
+    rec.mat = mat;
+}
+
+inline void set_material(observer_record & rec, const std::shared_ptr<material> & mat)
+{
+    rec.mat = mat.get();
+}
+
+// Same arithmetic as sphere::hit.
+template <typename Record>
+bool hit_sphere(const bench_sphere & s, const ray & r, interval ray_t, Record & rec)
+{
+    vec3 oc     = r.origin() - s.center;
+    auto a      = r.direction().length_squared();
+    auto half_b = dot(oc, r.direction());
+    auto c      = oc.length_squared() - s.radius * s.radius;
+    auto D      = half_b * half_b - a * c;
+    if (D < 0)
+        return false;
+
+    auto sqrtd = std::sqrt(D);
+    auto root  = (-half_b - sqrtd) / a;
+    if (!ray_t.surrounds(root))
+    {
+        root = (-half_b + sqrtd) / a;
+        if (!ray_t.surrounds(root))
+            return false;
+    }
+
+    rec.t = root;
+    rec.p = r.at(rec.t);
+    set_material(rec, s.mat);
+
+    vec3 outward_normal = (rec.p - s.center) / s.radius;
+    rec.front_face      = dot(r.direction(), outward_normal) < 0;
+    rec.normal          = rec.front_face ? outward_normal : -outward_normal;
+    return true;
+}
+
+// Same loop as hittable_list::hit, including the copy of every closer candidate into the result.
+template <typename Record>
+bool hit_list(const std::vector<bench_sphere> & spheres, const ray & r, interval ray_t, Record & rec)
+{
+    Record temp_rec;
+    bool   hit_anything   = false;
+    auto   closest_so_far = ray_t.max;
+    for (const auto & s : spheres)
+    {
+        if (hit_sphere(s, r, interval(ray_t.min, closest_so_far), temp_rec))
+        {
+            hit_anything   = true;
+            closest_so_far = temp_rec.t;
+            rec            = temp_rec;
+        }
+    }
+    return hit_anything;
+}
+
+// Overlapping spheres in a slab in front of the ray origins, so most rays see several candidate hits.
+std::vector<bench_sphere> make_spheres(int count)
+{
+    std::vector<std::shared_ptr<material>> materials;
+    for (int m = 0; m < 4; ++m)
+        materials.push_back(std::make_shared<material>(material::lambertian(color(0.5, 0.5, 0.5))));
+
+    std::vector<bench_sphere> spheres;
+    for (int i = 0; i < count; ++i)
+    {
+        point3 center(utils::random_double_range(-1, 1), utils::random_double_range(-1, 1),
+            utils::random_double_range(-6, -2));
+        spheres.push_back({center, 0.4, materials[i % materials.size()]});
+    }
+    return spheres;
+}
+
+// Volatile sink so the optimizer cannot drop the work being timed.
+volatile double sink;
+
+template <typename Record>
+void trace(const std::vector<bench_sphere> & spheres, long rays, unsigned int stream)
+{
+    utils::reseed(stream);
+    double sum = 0;
+    for (long i = 0; i < rays; ++i)
+    {
+        double x = utils::random_double_range(-0.2, 0.2);
+        double y = utils::random_double_range(-0.2, 0.2);
+        Record rec{};
+        if (hit_list(spheres, ray(point3(0, 0, 0), vec3(x, y, -1)), interval(0.001, infinity), rec))
+            sum += rec.t + (rec.mat != nullptr);
+    }
+    sink = sum;
+}
+
+template <typename Record>
+double rays_per_second(const std::vector<bench_sphere> & spheres, long rays_per_thread, unsigned int threads)
+{
+    std::vector<std::thread> workers;
+    auto                     start = std::chrono::steady_clock::now();
+    for (unsigned int t = 0; t < threads; ++t)
+        workers.emplace_back([&spheres, rays_per_thread, t] { trace<Record>(spheres, rays_per_thread, t); });
+    for (auto & worker : workers)
+        worker.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return rays_per_thread * threads / elapsed.count();
+}
+
+template <typename Record>
+void report(const std::string & name, const std::vector<bench_sphere> & spheres, long rays, unsigned int threads)
+{
+    double single   = rays_per_second<Record>(spheres, rays, 1);
+    double threaded = rays_per_second<Record>(spheres, rays / threads, threads);
+    std::printf("%-22s %12.2f %20.2f\n", name.c_str(), single / 1e6, threaded / 1e6);
+}
+
+int main(int argc, char * argv[])
+{
+    long         rays    = argc > 1 ? std::atol(argv[1]) : 2000000;
+    unsigned int threads = argc > 2 ? std::atoi(argv[2]) : std::thread::hardware_concurrency();
+    threads              = threads == 0 ? 1 : threads;
+
+    auto spheres = make_spheres(64);
+
+    std::printf("%ld rays against %zu spheres, %u threads for the threaded column\n", rays, spheres.size(), threads);
+    std::printf("%-22s %12s %20s\n", "material handle", "Mrays/s", "Mrays/s threaded");
+
+    report<owning_record>("shared_ptr<material>", spheres, rays, threads);
+    report<observer_record>("const material *", spheres, rays, threads);
+}
@@ -0,0 +1,221 @@
+// Instancing benchmark for instance.h.
+// Lays out a square field of placed copies of three prototypes, each turned, scaled and nudged at random: a unit
+// sphere that takes one of a few materials per copy, a cluster of 32 small spheres in a linear_bvh, and a sphere_soup
+// of 64 spheres, both of which keep materials of their own. Reports the time to build the top-level BVH, the bytes it
+// keeps per instance, the peak resident size of the process, and the time to render a small image looking across
+// the field.
+//
+// For comparison it expands the first few instances into world-space spheres in one flat linear_bvh, the way the
+// scene would have to be stored without instancing, and scales that cost up to the full instance count.
+//
+//     bin/instance_bench                          10 million instances
+//     bin/instance_bench --instances 1000000 --flat 200000 --width 320 --samples 8 --threads 8
+
+#include "../src/camera.h"
+#include "../src/hittable_list.h"
+#include "../src/instance.h"
+#include "../src/linear_bvh.h"
+#include "../src/sphere.h"
+#include "../src/sphere_soup.h"
+#include "../src/transform.h"
+#include "../src/utils.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Peak resident size of the process in bytes, or 0 where /proc is not there to ask.
+size_t peak_resident_bytes()
+{
+#ifdef __linux__
+    std::ifstream status("/proc/self/status");
+    std::string   line;
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, 6, "VmHWM:") == 0)
+            return std::strtoull(line.c_str() + 6, nullptr, 10) * 1024;
+    }
+#endif
+    return 0;
+}
+
+double megabytes(size_t bytes)
+{
+    return bytes / (1024.0 * 1024.0);
+}
+
+// A random point of the unit ball.
+point3 random_in_ball()
+{
+    while (true)
+    {
+        point3 p(
+            utils::random_double_range(-1, 1), utils::random_double_range(-1, 1), utils::random_double_range(-1, 1));
+        if (p.length_squared() < 1)
+            return p;
+    }
+}
+
+// Spheres of a prototype, in the prototype's own space, kept so the flat comparison can expand them.
+struct prototype_spheres
+{
+    std::vector<point3>             centers;
+    std::vector<real>               radii;
+    std::vector<material_table::id> materials;
+};
+
+prototype_spheres random_cluster(int count, real radius, const std::vector<material_table::id> & palette)
+{
+    prototype_spheres cluster;
+    for (int i = 0; i < count; ++i)
+    {
+        cluster.centers.push_back((1 - radius) * random_in_ball());
+        cluster.radii.push_back(radius);
+        cluster.materials.push_back(palette[i % palette.size()]);
+    }
+    return cluster;
+}
+
+struct placement
+{
+    uint32_t           prototype;
+    transform          to_world;
+    material_table::id material;
+};
+
+// The i-th of `count` instances: a cell of a square grid with unit spacing, centered on the origin.
+placement place(size_t i, size_t count, const std::vector<material_table::id> & palette)
+{
+    size_t side = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(count))));
+    double x    = static_cast<double>(i % side) - side / 2.0 + utils::random_double_range(0.1, 0.4);
+    double z    = static_cast<double>(i / side) - side / 2.0 + utils::random_double_range(0.1, 0.4);
+    double s    = utils::random_double_range(0.2, 0.45);
+    vec3   axis = random_in_ball() + vec3(0, 0, 1e-3);
+    double turn = utils::random_double_range(0, 360);
+
+    placement p;
+    p.prototype = static_cast<uint32_t>(i % 3);
+    p.to_world  = transform::translation(point3(x, s, z)) * transform::rotation(axis, turn) * transform::scaling(s);
+    p.material  = p.prototype == 0 ? palette[i % palette.size()] : instance_bvh::keep_material;
+    return p;
+}
+
+int main(int argc, char * argv[])
+{
+    size_t count   = 10000000;
+    size_t flat    = 100000;
+    int    width   = 160;
+    int    samples = 4;
+    int    threads = 0;
+    for (int a = 1; a + 1 < argc; a += 2)
+    {
+        std::string arg   = argv[a];
+        double      value = std::atof(argv[a + 1]);
+        if (arg == "--instances")
+            count = static_cast<size_t>(value);
+        else if (arg == "--flat")
+            flat = static_cast<size_t>(value);
+        else if (arg == "--width")
+            width = static_cast<int>(value);
+        else if (arg == "--samples")
+            samples = static_cast<int>(value);
+        else if (arg == "--threads")
+            threads = static_cast<int>(value);
+    }
+    flat = std::min(flat, count);
+
+    material_table                  materials;
+    std::vector<material_table::id> palette;
+    for (int m = 0; m < 12; ++m)
+    {
+        color albedo = color::random(0.2, 0.9);
+        palette.push_back(materials.add(
+            m % 4 == 3 ? material::metal(albedo, utils::random_double_range(0, 0.3)) : material::lambertian(albedo)));
+    }
+
+    // The prototypes, in their own unit-sized space.
+    std::vector<prototype_spheres> shapes;
+    shapes.push_back({{point3(0, 0, 0)}, {1}, {palette[0]}});
+    shapes.push_back(random_cluster(32, 0.25, palette));
+    shapes.push_back(random_cluster(64, 0.2, palette));
+
+    hittable_list cluster;
+    for (size_t k = 0; k < shapes[1].centers.size(); ++k)
+        cluster.make<sphere>(shapes[1].centers[k], shapes[1].radii[k], materials, shapes[1].materials[k]);
+    auto soup = std::make_shared<sphere_soup>();
+    for (size_t k = 0; k < shapes[2].centers.size(); ++k)
+        soup->add(shapes[2].centers[k], shapes[2].radii[k], materials[shapes[2].materials[k]]);
+    soup->build();
+
+    auto          start = std::chrono::steady_clock::now();
+    instance_bvh  world(&materials);
+    world.add_prototype(std::make_shared<sphere>(point3(0, 0, 0), 1, materials, palette[0]));
+    world.add_prototype(std::make_shared<linear_bvh>(cluster));
+    world.add_prototype(soup);
+    world.reserve(count);
+    utils::reseed(1);
+    for (size_t i = 0; i < count; ++i)
+    {
+        placement p = place(i, count, palette);
+        world.add(p.prototype, p.to_world, p.material);
+    }
+    std::chrono::duration<double> fill_time = std::chrono::steady_clock::now() - start;
+    world.build();
+    std::chrono::duration<double> build_time = std::chrono::steady_clock::now() - start - fill_time;
+
+    size_t prototype_bytes = cluster.arena_bytes() + linear_bvh(cluster).memory_bytes() + soup->memory_bytes();
+    std::printf("%zu instances of %zu prototypes of 1, 32 and 64 spheres\n", world.size(), world.prototype_count());
+    std::printf("placing %.2f s, top-level build %.2f s, %zu nodes\n", fill_time.count(), build_time.count(),
+        world.node_count());
+    std::printf("instances and top level %.1f MB kept (%.1f bytes per instance), %.1f MB peak resident size of the "
+                "process through the build, prototypes %.1f KB\n",
+        megabytes(world.memory_bytes()), static_cast<double>(world.memory_bytes()) / world.size(),
+        megabytes(peak_resident_bytes()), prototype_bytes / 1024.0);
+
+    camera cam;
+    cam.image_width       = width;
+    cam.samples_per_pixel = samples;
+    cam.max_depth         = 8;
+    cam.thread_count      = threads;
+    cam.show_progress     = false;
+    cam.vfov              = 30;
+    double side           = std::sqrt(static_cast<double>(count));
+    cam.lookfrom          = point3(-0.5 * side, 0.05 * side + 2, -0.5 * side);
+    cam.lookat            = point3(0, 0, 0);
+    cam.defocus_angle     = 0;
+
+    start                                     = std::chrono::steady_clock::now();
+    auto                          image       = cam.render(world);
+    std::chrono::duration<double> render_time = std::chrono::steady_clock::now() - start;
+    double                        paths       = static_cast<double>(image.width) * image.height * samples;
+    std::printf("render %dx%d at %d spp: %.2f s, %.3f Mpaths/s\n", image.width, image.height, samples,
+        render_time.count(), paths / render_time.count() / 1e6);
+
+    // The same placements again, expanded into world-space spheres.
+    hittable_list expanded;
+    utils::reseed(1);
+    for (size_t i = 0; i < flat; ++i)
+    {
+        placement                 p     = place(i, count, palette);
+        const prototype_spheres & shape = shapes[p.prototype];
+        for (size_t k = 0; k < shape.centers.size(); ++k)
+        {
+            material_table::id mat = p.material == instance_bvh::keep_material ? shape.materials[k] : p.material;
+            expanded.make<sphere>(
+                p.to_world.to_world(shape.centers[k]), shape.radii[k] * p.to_world.scale(), materials, mat);
+        }
+    }
+    linear_bvh flat_bvh(expanded);
+    size_t     flat_bytes = expanded.arena_bytes() + expanded.objects.capacity() * sizeof(expanded.objects[0]) +
+                        flat_bvh.memory_bytes();
+    double per_instance = static_cast<double>(flat_bytes) / flat;
+    std::printf("flat: %zu instances expanded to %zu spheres take %.1f MB, %.0f bytes per instance, so %.1f MB for "
+                "%zu instances (%.0fx)\n",
+        flat, expanded.objects.size(), megabytes(flat_bytes), per_instance, megabytes(per_instance * count), count,
+        per_instance / (static_cast<double>(world.memory_bytes()) / world.size()));
+}
@@ -0,0 +1,243 @@
+// Microbenchmark for material dispatch.
+// Scatters a set of hits whose materials are mixed like the book scene (80% lambertian, 15% metal, 5% glass) three
+// ways: through the old virtual class hierarchy behind shared_ptr, through the tagged material's switch one hit at a
+// time, and with scatter_many over the hits grouped by kind. The first two draw the same random numbers in the same
+// order, so their checksums must match; that is the check that the tagged materials sample exactly like the old
+// classes. The batched run visits the hits in a different order and only its rate is comparable.
+
+#include "../src/material.h"
+#include "../src/utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+// The old material classes, kept here as the baseline.
+namespace virtual_materials
+{
+
+class material
+{
+public:
+    virtual ~material() = default;
+
+    virtual bool scatter(const ray & r_in, const hit_record & rec, color & attenuation, ray & scattered) const = 0;
+};
+
+class lambertian : public material
+{
+public:
+    lambertian(const color & a) : albedo(a) {}
+
+    bool scatter(const ray & r_in, const hit_record & rec, color & attenuation, ray & scattered) const override
+    {
+        auto scatter_direction = rec.normal + random_unit_vector();
+        if (scatter_direction.near_zero())
+            scatter_direction = rec.normal;
+        scattered   = ray(rec.p, scatter_direction);
+        attenuation = albedo;
+        return true;
+    }
+
+private:
+    color albedo;
+};
+
+class metal : public material
+{
+public:
+    metal(const color & a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
+
+    bool scatter(const ray & r_in, const hit_record & rec, color & attenuation, ray & scattered) const override
+    {
+        vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
+        scattered      = ray(rec.p, reflected + fuzz * random_unit_vector());
+        attenuation    = albedo;
+        return (dot(scattered.direction(), rec.normal) > 0);
+    }
+
+private:
+    color  albedo;
+    double fuzz;
+};
+
+class dielectric : public material
+{
+public:
+    dielectric(double index_of_refraction) : ir(index_of_refraction) {}
+
+    bool scatter(const ray & r_in, const hit_record & rec, color & attenuation, ray & scattered) const override
+    {
+        attenuation             = color(1.0, 1.0, 1.0);
+        double refraction_ratio = rec.front_face ? (1.0 / ir) : ir;
+        vec3   unit_direction   = unit_vector(r_in.direction());
+        double cos_theta        = fmin(dot(-unit_direction, rec.normal), 1.0);
+        double sin_theta        = sqrt(1.0 - cos_theta * cos_theta);
+        bool   cannot_refract   = refraction_ratio * sin_theta > 1.0;
+        vec3   direction;
+
+        if (cannot_refract || reflectance(cos_theta, refraction_ratio) > utils::random_double())
+            direction = reflect(unit_direction, rec.normal);
+        else
+            direction = refract(unit_direction, rec.normal, refraction_ratio);
+
+        scattered = ray(rec.p, direction);
+        return true;
+    }
+
+private:
+    double ir;
+
+    static double reflectance(double cosine, double ref_idx)
+    {
+        auto r0 = (1 - ref_idx) / (1 + ref_idx);
+        r0      = r0 * r0;
+        return r0 + (1 - r0) * pow((1 - cosine), 5);
+    }
+};
+
+} // namespace virtual_materials
+
+struct scene_hits
+{
+    std::vector<std::shared_ptr<virtual_materials::material>> virtual_table;
+    material_table                                            table;
+    std::vector<ray>                                          rays;
+    std::vector<hit_record>                                   recs;       // rec.mat points into `table`
+    std::vector<const virtual_materials::material *>          virtuals;   // the same material, old style
+};
+
+// Paths in one wavefront of the renderer: an 8x8 block at 16 samples per pixel.
+constexpr size_t wavefront_size = 1024;
+
+scene_hits make_hits(size_t count, int material_count)
+{
+    scene_hits scene;
+    for (int m = 0; m < material_count; ++m)
+    {
+        double choose = utils::random_double();
+        color  albedo = color::random(0.2, 1);
+        if (choose < 0.8)
+        {
+            scene.table.add(material::lambertian(albedo));
+            scene.virtual_table.push_back(std::make_shared<virtual_materials::lambertian>(albedo));
+        }
+        else if (choose < 0.95)
+        {
+            double fuzz = utils::random_double_range(0, 0.5);
+            scene.table.add(material::metal(albedo, fuzz));
+            scene.virtual_table.push_back(std::make_shared<virtual_materials::metal>(albedo, fuzz));
+        }
+        else
+        {
+            scene.table.add(material::dielectric(1.5));
+            scene.virtual_table.push_back(std::make_shared<virtual_materials::dielectric>(1.5));
+        }
+    }
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto       m = static_cast<material_table::id>(utils::random_double() * material_count);
+        ray        r(point3(0, 0, 0), random_unit_vector());
+        hit_record rec;
+        rec.t   = 1;
+        rec.p   = r.at(1);
+        rec.mat = &scene.table[m];
+        rec.set_face_normal(r, random_unit_vector());
+
+        scene.rays.push_back(r);
+        scene.recs.push_back(rec);
+        scene.virtuals.push_back(scene.virtual_table[m].get());
+    }
+    return scene;
+}
+
+double checksum(const ray & scattered, const color & attenuation, bool ok)
+{
+    vec3 d = scattered.direction();
+    return ok ? d.x() + 2 * d.y() + 3 * d.z() + attenuation.x() : 0;
+}
+
+template <typename F>
+double hits_per_second(size_t count, int repeats, double & sum, F && run)
+{
+    utils::reseed(7);
+    sum        = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeats; ++r)
+        sum += run();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return count * repeats / elapsed.count();
+}
+
+int main(int argc, char * argv[])
+{
+    size_t count   = argc > 1 ? std::atol(argv[1]) : 1000000;
+    int    repeats = argc > 2 ? std::atoi(argv[2]) : 10;
+    auto   scene   = make_hits(count, 64);
+
+    std::printf("%zu hits over 64 materials, %d repeats\n", count, repeats);
+    std::printf("%-28s %12s %24s\n", "dispatch", "Mhits/s", "checksum");
+
+    double sum;
+    double rate = hits_per_second(count, repeats, sum, [&] {
+        double s = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            ray   scattered;
+            color attenuation;
+            bool  ok = scene.virtuals[i]->scatter(scene.rays[i], scene.recs[i], attenuation, scattered);
+            s += checksum(scattered, attenuation, ok);
+        }
+        return s;
+    });
+    std::printf("%-28s %12.2f %24.10f\n", "virtual, shared_ptr", rate / 1e6, sum);
+
+    rate = hits_per_second(count, repeats, sum, [&] {
+        double s = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            ray   scattered;
+            color attenuation;
+            bool  ok = scene.recs[i].mat->scatter(scene.rays[i], scene.recs[i], attenuation, scattered);
+            s += checksum(scattered, attenuation, ok);
+        }
+        return s;
+    });
+    std::printf("%-28s %12.2f %24.10f\n", "tagged, switch per hit", rate / 1e6, sum);
+
+    // Grouped the way the wavefront renderer groups them: one block of hits at a time, split into index lists by
+    // kind. The grouping is part of what is timed.
+    std::vector<uint32_t> by_kind[material_kind_count];
+    std::vector<ray>      out;
+    std::vector<color>    attenuation;
+    std::vector<uint8_t>  ok;
+    rate = hits_per_second(count, repeats, sum, [&] {
+        double s = 0;
+        for (size_t first = 0; first < count; first += wavefront_size)
+        {
+            size_t last = std::min(count, first + wavefront_size);
+            for (auto & batch : by_kind)
+                batch.clear();
+            for (size_t i = first; i < last; ++i)
+                by_kind[static_cast<int>(scene.recs[i].mat->kind)].push_back(static_cast<uint32_t>(i));
+
+            for (int kind = 0; kind < material_kind_count; ++kind)
+            {
+                const auto & batch = by_kind[kind];
+                out.resize(batch.size());
+                attenuation.resize(batch.size());
+                ok.resize(batch.size());
+                scatter_many(static_cast<material_kind>(kind), batch.size(), batch.data(), scene.rays.data(),
+                    scene.recs.data(), attenuation.data(), out.data(), ok.data());
+                for (size_t b = 0; b < batch.size(); ++b)
+                    s += checksum(out[b], attenuation[b], ok[b]);
+            }
+        }
+        return s;
+    });
+    std::printf("%-28s %12.2f %24s\n", "tagged, scatter_many", rate / 1e6, "(different order)");
+}
@@ -0,0 +1,144 @@
+// Triangle mesh benchmark for obj_file.h and triangle_mesh.h.
+// Writes a rippled height field of quads as an OBJ file with normals (or takes the file given), loads it on one
+// thread and on every thread, builds the mesh's BVH, and traces random rays down onto it. The load is reported in
+// MB/s of file, the mesh in bytes per triangle, and the tracing in Mrays/s with TRIANGLE_MESH_LANES triangles per
+// kernel call; build with -DRT_NO_SIMD or -mavx2 to compare the kernel widths.
+//
+//     bin/mesh_bench                              a 1000x1000 quad height field, 2M triangles
+//     bin/mesh_bench --size 3000 --rays 4000000
+//     bin/mesh_bench --obj model.obj --threads 8
+
+#include "../src/linear_bvh.h"
+#include "../src/material.h"
+#include "../src/obj_file.h"
+#include "../src/thread_pool.h"
+#include "../src/triangle_mesh.h"
+#include "../src/utils.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// A size x size grid of quads over [-1, 1]^2 in x and z, rippled in y, with the analytic normals.
+bool write_height_field(const std::string & path, int size)
+{
+    FILE * file = std::fopen(path.c_str(), "w");
+    if (!file)
+        return false;
+    std::fprintf(file, "# %dx%d height field\n", size, size);
+    for (int j = 0; j <= size; ++j)
+    {
+        for (int i = 0; i <= size; ++i)
+        {
+            double x = 2.0 * i / size - 1, z = 2.0 * j / size - 1;
+            double y  = 0.05 * std::sin(12 * x) * std::cos(9 * z);
+            double dx = 0.6 * std::cos(12 * x) * std::cos(9 * z), dz = -0.45 * std::sin(12 * x) * std::sin(9 * z);
+            std::fprintf(file, "v %.6f %.6f %.6f\nvn %.5f 1 %.5f\n", x, y, z, -dx, -dz);
+        }
+    }
+    for (int j = 0; j < size; ++j)
+    {
+        for (int i = 0; i < size; ++i)
+        {
+            long a = long(j) * (size + 1) + i + 1, b = a + 1, c = b + size + 1, d = a + size + 1;
+            std::fprintf(file, "f %ld//%ld %ld//%ld %ld//%ld %ld//%ld\n", a, a, d, d, c, c, b, b);
+        }
+    }
+    return std::fclose(file) == 0;
+}
+
+// Volatile sink so the optimizer cannot drop the work being timed.
+volatile double sink;
+
+int main(int argc, char * argv[])
+{
+    int         size    = 1000;
+    long        rays    = 2000000;
+    unsigned    threads = 0;
+    std::string path;
+    for (int a = 1; a + 1 < argc; a += 2)
+    {
+        std::string arg = argv[a];
+        if (arg == "--size")
+            size = std::atoi(argv[a + 1]);
+        else if (arg == "--rays")
+            rays = std::atol(argv[a + 1]);
+        else if (arg == "--threads")
+            threads = static_cast<unsigned>(std::atoi(argv[a + 1]));
+        else if (arg == "--obj")
+            path = argv[a + 1];
+    }
+
+    bool generated = path.empty();
+    if (generated)
+    {
+        path       = "mesh_bench.obj";
+        auto start = std::chrono::steady_clock::now();
+        if (!write_height_field(path, size))
+        {
+            std::fprintf(stderr, "Could not write %s\n", path.c_str());
+            return 1;
+        }
+        std::printf("wrote %s in %.2f s\n", path.c_str(), seconds_since(start));
+    }
+
+    mapped_file file;
+    if (!file.open(path))
+        return 1;
+    double megabytes = file.size() / (1024.0 * 1024.0);
+
+    auto buffers = std::make_shared<mesh_buffers>();
+    for (unsigned t : {1u, thread_pool(threads).size()})
+    {
+        auto start = std::chrono::steady_clock::now();
+        if (!obj_file::load(path, *buffers, t))
+            return 1;
+        double elapsed = seconds_since(start);
+        std::printf("load on %u threads: %.2f s, %.0f MB/s\n", t, elapsed, megabytes / elapsed);
+    }
+    std::printf("%.1f MB file: %zu vertices, %zu normals, %zu triangles, buffers %.1f bytes per triangle\n", megabytes,
+        buffers->vertex_count(), buffers->nx.size(), buffers->triangle_count(),
+        static_cast<double>(buffers->memory_bytes()) / buffers->triangle_count());
+
+    material_table materials;
+    auto           gray  = materials.add(material::lambertian(color(0.5, 0.5, 0.5)));
+    auto           start = std::chrono::steady_clock::now();
+    triangle_mesh  mesh(buffers, materials, gray);
+    std::printf("BVH build %.2f s, %zu nodes, mesh %.1f bytes per triangle\n", seconds_since(start), mesh.node_count(),
+        static_cast<double>(mesh.memory_bytes()) / mesh.size());
+
+    // Rays from above the mesh's box down through it, at random angles.
+    aabb box = mesh.bounding_box();
+    utils::reseed(1);
+    long   hits = 0;
+    double sum  = 0;
+    start       = std::chrono::steady_clock::now();
+    for (long k = 0; k < rays; ++k)
+    {
+        point3     from(utils::random_double_range(box.x.min, box.x.max), box.y.max + 1,
+                utils::random_double_range(box.z.min, box.z.max));
+        vec3       dir(utils::random_double_range(-0.5, 0.5), -1, utils::random_double_range(-0.5, 0.5));
+        hit_record rec;
+        if (mesh.hit(ray(from, dir), interval(0.001, infinity), rec))
+        {
+            hits++;
+            sum += rec.t + rec.normal.y();
+        }
+    }
+    double elapsed = seconds_since(start);
+    sink           = sum;
+    std::printf("%ld rays, %.1f%% hits, %d triangles per kernel call: %.2f Mrays/s, %.1f nodes visited per ray\n",
+        rays, 100.0 * hits / rays, triangle_mesh::lanes, rays / elapsed / 1e6,
+        static_cast<double>(bvh_stats::local().nodes_visited) / bvh_stats::local().rays);
+
+    if (generated)
+        std::remove(path.c_str());
+}
@@ -0,0 +1,125 @@
+// Microbenchmark for the random number generators behind utils::random_double.
+// Compares the old global rand() path against the per-thread generators, both for raw draws and for the unit vectors
+// that materials draw on every bounce. The threaded run shows how rand()'s shared state behaves once several render
+// threads pull from it at the same time.
+
+#include "../src/utils.h"
+#include "../src/vec3.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct rand_generator
+{
+    // Same mapping as the old utils::random_double, so the result is bound by RAND_MAX.
+    double next_double()
+    {
+        return rand() / (RAND_MAX + 1.0);
+    }
+};
+
+template <typename Generator>
+struct engine_generator
+{
+    Generator gen;
+
+    engine_generator() : gen(1, 0) {}
+
+    double next_double()
+    {
+        return utils::to_unit_double(gen());
+    }
+};
+
+struct mt_generator
+{
+    std::mt19937_64 gen{1};
+
+    double next_double()
+    {
+        return utils::to_unit_double(static_cast<uint64_t>(gen()));
+    }
+};
+
+// Volatile sink so the optimizer cannot drop the work being timed.
+volatile double sink;
+
+template <typename Generator>
+double doubles_per_second(long count)
+{
+    Generator g;
+    double    sum   = 0;
+    auto      start = std::chrono::steady_clock::now();
+    for (long i = 0; i < count; ++i)
+        sum += g.next_double();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    sink                                  = sum;
+    return count / elapsed.count();
+}
+
+// Mirrors random_unit_vector: two draws mapped straight onto the sphere.
+template <typename Generator>
+double unit_vectors_per_second(long count)
+{
+    Generator g;
+    double    sum   = 0;
+    auto      start = std::chrono::steady_clock::now();
+    for (long i = 0; i < count; ++i)
+    {
+        double u = g.next_double();
+        double v = g.next_double();
+        vec3   p = sphere_direction(u, v);
+        sum += p.x() + p.y() + p.z();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    sink                                  = sum;
+    return count / elapsed.count();
+}
+
+template <typename Generator>
+double threaded_doubles_per_second(long count_per_thread, unsigned int threads)
+{
+    std::vector<std::thread> workers;
+    auto                     start = std::chrono::steady_clock::now();
+    for (unsigned int t = 0; t < threads; ++t)
+        workers.emplace_back([count_per_thread] {
+            Generator g;
+            double    sum = 0;
+            for (long i = 0; i < count_per_thread; ++i)
+                sum += g.next_double();
+            sink = sum;
+        });
+    for (auto & worker : workers)
+        worker.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return count_per_thread * threads / elapsed.count();
+}
+
+template <typename Generator>
+void report(const std::string & name, long count, unsigned int threads)
+{
+    double doubles  = doubles_per_second<Generator>(count);
+    double vectors  = unit_vectors_per_second<Generator>(count / 4);
+    double threaded = threaded_doubles_per_second<Generator>(count / threads, threads);
+    std::printf("%-14s %12.1f %16.1f %20.1f\n", name.c_str(), doubles / 1e6, vectors / 1e6, threaded / 1e6);
+}
+
+int main(int argc, char * argv[])
+{
+    long         count   = argc > 1 ? std::atol(argv[1]) : 50000000;
+    unsigned int threads = std::thread::hardware_concurrency();
+    threads              = threads == 0 ? 1 : threads;
+
+    std::printf("%ld draws per generator, %u threads for the threaded column\n", count, threads);
+    std::printf("%-14s %12s %16s %20s\n", "generator", "Mdoubles/s", "Munit_vectors/s", "Mdoubles/s threaded");
+
+    report<rand_generator>("rand()", count, threads);
+    report<mt_generator>("mt19937_64", count, threads);
+    report<engine_generator<utils::pcg32>>("pcg32", count, threads);
+    report<engine_generator<utils::xoshiro256pp>>("xoshiro256++", count, threads);
+}
@@ -0,0 +1,89 @@
+// Convergence benchmark for the samplers in sampler.h.
+// Renders a small image of the book scene once with many samples per pixel as the reference, then renders it with
+// each sampler at 1, 2, 4, ... samples per pixel and reports the RMSE of the linear pixel values against the
+// reference, along with the render time. The reference uses another seed than the renders it is compared to, so
+// their errors are independent.
+//
+// "equiv" is how many independent samples per pixel the same RMSE would take: independent sampling's error falls as
+// 1/sqrt(spp), so a sampler with error e at n samples matches independent sampling at n * (e_independent / e)^2.
+//
+//     bin/sampler_bench                      96 pixels wide, reference at 2048 spp, up to 64 spp
+//     bin/sampler_bench --width 200 --reference 4096 --max-spp 256 --threads 8
+
+#include "../src/camera.h"
+#include "../src/linear_bvh.h"
+#include "../src/sampler.h"
+#include "../src/scenes.h"
+#include "../src/utils.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+int main(int argc, char * argv[])
+{
+    int width     = 96;
+    int reference = 2048;
+    int max_spp   = 64;
+    int threads   = 0;
+    for (int a = 1; a + 1 < argc; a += 2)
+    {
+        std::string arg   = argv[a];
+        int         value = std::atoi(argv[a + 1]);
+        if (arg == "--width")
+            width = value;
+        else if (arg == "--reference")
+            reference = value;
+        else if (arg == "--max-spp")
+            max_spp = value;
+        else if (arg == "--threads")
+            threads = value;
+    }
+
+    using clock = std::chrono::steady_clock;
+
+    utils::randomize(1);
+    material_table materials;
+    hittable_list  world;
+    book_scene(world, materials);
+    linear_bvh accelerated(world);
+
+    std::printf("Reference: %d pixels wide at %d spp (sobol, seed 2)\n", width, reference);
+    utils::randomize(2);
+    camera truth_cam  = book_camera(width, reference, threads);
+    truth_cam.sampler = sampling::sampler_kind::sobol;
+    auto truth        = truth_cam.render(accelerated);
+
+    const sampling::sampler_kind samplers[] = {sampling::sampler_kind::independent, sampling::sampler_kind::stratified,
+        sampling::sampler_kind::sobol, sampling::sampler_kind::blue_noise};
+
+    std::printf("%5s", "spp");
+    for (auto sampler : samplers)
+        std::printf(" %12s %8s %7s", sampling::name(sampler), "seconds", "equiv");
+    std::printf("\n");
+
+    for (int spp = 1; spp <= max_spp; spp *= 2)
+    {
+        std::printf("%5d", spp);
+        double independent_error = 0;
+        for (auto sampler : samplers)
+        {
+            camera cam  = book_camera(width, spp, threads);
+            cam.sampler = sampler;
+            utils::randomize(3);
+            auto                          start   = clock::now();
+            auto                          image   = cam.render(accelerated);
+            std::chrono::duration<double> elapsed = clock::now() - start;
+
+            double error = rmse(image, truth);
+            if (sampler == sampling::sampler_kind::independent)
+                independent_error = error;
+            double equivalent = spp * (independent_error / error) * (independent_error / error);
+            std::printf(" %12.5f %8.3f %7.1f", error, elapsed.count(), equivalent);
+        }
+        std::printf("\n");
+    }
+}
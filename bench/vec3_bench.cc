@@ -0,0 +1,135 @@
+// Microbenchmark for the vec3 layout.
+// Times every vec3 operator over arrays of vectors that fit in L1, then the end-to-end rate of paths traced through
+// the book scene. Build it once per layout and compare the two outputs line by line; scripts/build_bench.sh builds
+// vec3_bench (packed, three reals) and vec3_bench_simd (-DRT_SIMD_VEC3, padded to four lanes), both for AVX2 so the
+// only difference is the layout. Add -DRT_FLOAT to compare the float layouts. The checksums must match between the
+// two builds, since both layouts compute bit-identical results.
+
+#include "../src/linear_bvh.h"
+#include "../src/material.h"
+#include "../src/scenes.h"
+#include "../src/utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+constexpr size_t vector_count = 1024;
+
+struct operands
+{
+    std::vector<vec3> u, v, out;
+    std::vector<real> t, scalars;
+};
+
+operands make_operands()
+{
+    operands o;
+    for (size_t i = 0; i < vector_count; ++i)
+    {
+        o.u.push_back(vec3::random(-1, 1));
+        o.v.push_back(vec3::random(-1, 1));
+        o.t.push_back(utils::random_double_range(0.5, 2));
+    }
+    o.out.resize(vector_count);
+    o.scalars.resize(vector_count);
+    return o;
+}
+
+double checksum(const operands & o)
+{
+    double sum = 0;
+    for (size_t i = 0; i < vector_count; ++i)
+        sum += o.out[i].x() + 2 * o.out[i].y() + 3 * o.out[i].z() + o.scalars[i];
+    return sum;
+}
+
+// Runs `op(i)` over every operand `repeats` times and prints the rate in millions of operations per second.
+template <typename F>
+void time_operator(const char * name, operands & o, int repeats, F && op)
+{
+    std::fill(o.out.begin(), o.out.end(), vec3());
+    std::fill(o.scalars.begin(), o.scalars.end(), 0);
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeats; ++r)
+        for (size_t i = 0; i < vector_count; ++i)
+            op(i);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::printf("%-16s %12.1f %24.10f\n", name, vector_count * repeats / elapsed.count() / 1e6, checksum(o));
+}
+
+// Traces `paths` camera rays through the book scene for up to `depth` bounces, the way camera::ray_color does, and
+// returns the number of rays cast per second. The radiance is added to `sum` so the work cannot be dropped.
+double scene_rays_per_second(const hittable & world, long paths, int depth, double & sum)
+{
+    utils::reseed(11);
+    point3 lookfrom(13, 2, 3);
+    vec3   w = unit_vector(lookfrom - point3(0, 0, 0));
+    vec3   u = unit_vector(cross(vec3(0, 1, 0), w));
+    vec3   v = cross(w, u);
+
+    long rays  = 0;
+    sum        = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (long p = 0; p < paths; ++p)
+    {
+        real  x = utils::random_double_range(-0.2, 0.2);
+        real  y = utils::random_double_range(-0.12, 0.12);
+        ray   current(lookfrom, x * u + y * v - w);
+        color throughput(1, 1, 1);
+        for (int bounce = 0; bounce < depth; ++bounce)
+        {
+            ++rays;
+            hit_record rec;
+            if (!world.hit(current, interval(ray_epsilon, infinity), rec))
+            {
+                sum += throughput.y();
+                break;
+            }
+            ray   scattered;
+            color attenuation;
+            if (!rec.mat->scatter(current, rec, attenuation, scattered))
+                break;
+            throughput = throughput * attenuation;
+            current    = scattered;
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return rays / elapsed.count();
+}
+
+int main(int argc, char * argv[])
+{
+    int  repeats = argc > 1 ? std::atoi(argv[1]) : 20000;
+    long paths   = argc > 2 ? std::atol(argv[2]) : 200000;
+
+    std::printf("vec3: %s layout, %s, sizeof %zu, alignof %zu\n", VEC3_SIMD ? "padded SIMD" : "packed",
+        sizeof(real) == sizeof(float) ? "float" : "double", sizeof(vec3), alignof(vec3));
+    std::printf("%-16s %12s %24s\n", "operator", "Mops/s", "checksum");
+
+    auto o = make_operands();
+    time_operator("u + v", o, repeats, [&](size_t i) { o.out[i] = o.u[i] + o.v[i]; });
+    time_operator("u - v", o, repeats, [&](size_t i) { o.out[i] = o.u[i] - o.v[i]; });
+    time_operator("u * v", o, repeats, [&](size_t i) { o.out[i] = o.u[i] * o.v[i]; });
+    time_operator("t * v", o, repeats, [&](size_t i) { o.out[i] = o.t[i] * o.v[i]; });
+    time_operator("v / t", o, repeats, [&](size_t i) { o.out[i] = o.v[i] / o.t[i]; });
+    time_operator("-v", o, repeats, [&](size_t i) { o.out[i] = -o.v[i]; });
+    time_operator("u += v", o, repeats, [&](size_t i) { o.out[i] += o.v[i]; });
+    time_operator("v *= t", o, repeats, [&](size_t i) { (o.out[i] = o.u[i]) *= o.t[i]; });
+    time_operator("dot", o, repeats, [&](size_t i) { o.scalars[i] += dot(o.u[i], o.v[i]); });
+    time_operator("cross", o, repeats, [&](size_t i) { o.out[i] = cross(o.u[i], o.v[i]); });
+    time_operator("length", o, repeats, [&](size_t i) { o.scalars[i] += o.u[i].length(); });
+    time_operator("unit_vector", o, repeats, [&](size_t i) { o.out[i] = unit_vector(o.u[i]); });
+    time_operator("reflect", o, repeats, [&](size_t i) { o.out[i] = reflect(o.u[i], o.v[i]); });
+
+    material_table materials;
+    hittable_list  world;
+    book_scene(world, materials);
+    linear_bvh scene(world);
+
+    double sum;
+    double rate = scene_rays_per_second(scene, paths, 8, sum);
+    std::printf("%-16s %12.2f %24.10f\n", "scene Mrays/s", rate / 1e6, sum);
+}
@@ -1,6 +1,10 @@
 # Compile c++ to linux executable
+# A quick optimized build with debug info. For Release, LTO, PGO and -march variants use the CMake build:
+#     cmake -S . -B build && cmake --build build -j
 g++ \
     src/main.cc \
     -Wall \
+    -pthread \
+    -O2 \
     -g \
-    -o bin/main
\ No newline at end of file
+    -o bin/main
@@ -0,0 +1,73 @@
+# Compile the benchmarks with optimizations, since timing a debug build tells us nothing
+g++ \
+    bench/rng_bench.cc \
+    -Wall \
+    -pthread \
+    -O2 \
+    -o bin/rng_bench
+
+g++ \
+    bench/hit_bench.cc \
+    -Wall \
+    -pthread \
+    -O2 \
+    -o bin/hit_bench
+
+g++ \
+    bench/material_bench.cc \
+    -Wall \
+    -pthread \
+    -O2 \
+    -o bin/material_bench
+
+g++ \
+    bench/sampler_bench.cc \
+    -Wall \
+    -pthread \
+    -O2 \
+    -o bin/sampler_bench
+
+g++ \
+    bench/denoise_bench.cc \
+    -Wall \
+    -pthread \
+    -O2 \
+    -o bin/denoise_bench
+
+g++ \
+    bench/instance_bench.cc \
+    -Wall \
+    -pthread \
+    -O2 \
+    -o bin/instance_bench
+
+g++ \
+    bench/mesh_bench.cc \
+    -Wall \
+    -pthread \
+    -O2 \
+    -o bin/mesh_bench
+
+g++ \
+    bench/vec3_bench.cc \
+    -Wall \
+    -pthread \
+    -O2 \
+    -mavx2 \
+    -o bin/vec3_bench
+
+g++ \
+    bench/vec3_bench.cc \
+    -Wall \
+    -pthread \
+    -O2 \
+    -mavx2 \
+    -DRT_SIMD_VEC3 \
+    -o bin/vec3_bench_simd
+
+g++ \
+    bench/bench.cc \
+    -Wall \
+    -pthread \
+    -O2 \
+    -o bin/bench
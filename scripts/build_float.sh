@@ -0,0 +1,9 @@
+# Compile c++ to linux executable with single precision scene math (real = float)
+g++ \
+    src/main.cc \
+    -Wall \
+    -pthread \
+    -O2 \
+    -g \
+    -DRT_FLOAT \
+    -o bin/main_float
@@ -0,0 +1,16 @@
+#!/usr/bin/env bash
+# Profile-guided Release build in build/pgo: build instrumented, train on the benchmark scenes, rebuild with the
+# profiles. The executables end up in build/pgo/bin. Both builds share one build directory because GCC matches the
+# profiles to the object files by path.
+
+set -e
+
+BUILD=build/pgo
+
+rm -rf "$BUILD/pgo-profiles"
+cmake -S . -B "$BUILD" -DCMAKE_BUILD_TYPE=Release -DRT_PGO=GENERATE
+cmake --build "$BUILD" -j"$(nproc)"
+cmake --build "$BUILD" --target pgo-train
+
+cmake -S . -B "$BUILD" -DRT_PGO=USE
+cmake --build "$BUILD" -j"$(nproc)"
@@ -0,0 +1,9 @@
+# Compile c++ to linux executable with render statistics (--stats) compiled in
+g++ \
+    src/main.cc \
+    -Wall \
+    -pthread \
+    -O2 \
+    -g \
+    -DRT_STATS \
+    -o bin/main_stats
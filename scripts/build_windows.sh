@@ -4,4 +4,5 @@ x86_64-w64-mingw32-g++ \
     src/main.cc \
     -o bin/a.exe \
     -g \
-    -Wall
+    -Wall \
+    -pthread
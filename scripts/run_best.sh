@@ -0,0 +1,20 @@
+#!/usr/bin/env bash
+# Runs the widest -march variant of main in a CMake build directory (default build) that this CPU can execute,
+# passing every argument through.
+
+BIN=${RT_BUILD_DIR:-build}/bin
+FLAGS=$(grep -m1 '^flags' /proc/cpuinfo)
+
+has() {
+    for flag in "$@"; do
+        [[ " $FLAGS " == *" $flag "* ]] || return 1
+    done
+}
+
+if [ -x "$BIN/main_avx512" ] && has avx512f avx512bw avx512cd avx512dq avx512vl; then
+    exec "$BIN/main_avx512" "$@"
+elif [ -x "$BIN/main_avx2" ] && has avx2 bmi1 bmi2 f16c fma abm movbe; then
+    exec "$BIN/main_avx2" "$@"
+else
+    exec "$BIN/main" "$@"
+fi
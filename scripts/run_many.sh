@@ -10,23 +10,12 @@ echo "done building"
 echo "===[       IT BEGINS...        ]==="
 echo "===[ THE WEAVING OF THE FRAMES ]==="
 
-corez=$(expr $(nproc) - 1)
+mkdir -p out/third
 
-letsgo() {
-    echo "===[ FILE ${1} ]==="
-
-    ./bin/main \
-        --frame ${1} \
-        > "out/third/${1}.ppm"
-
-    convert \
-        "out/third/${1}.ppm" \
-        "out/third/${1}.png"
-}
-
-export -f letsgo
-
-parallel -j${corez} letsgo ::: $(seq 60)
+# one worker process per core, each building the scene once and taking tiles of any frame as it becomes free
+./bin/main \
+    --frames 1..60 \
+    --workers "$(nproc)" \
+    --output 'out/third/%d.png'
 
 ffmpeg -r 24 -i 'out/third/%d.png' "out/third/output.gif"
-
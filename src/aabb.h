@@ -0,0 +1,79 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include "interval.h"
+#include "ray.h"
+#include "vec3.h"
+
+#include <utility>
+
+// Axis-aligned bounding box, stored as one interval per axis.
+class aabb
+{
+public:
+    interval x, y, z;
+
+    aabb() {} // The default AABB is empty, since intervals are empty by default.
+
+    aabb(const interval & ix, const interval & iy, const interval & iz) : x(ix), y(iy), z(iz) {}
+
+    // Treat the two points a and b as extrema for the bounding box, so we don't require a particular min/max order.
+    aabb(const point3 & a, const point3 & b)
+    {
+        x = interval(std::fmin(a[0], b[0]), std::fmax(a[0], b[0]));
+        y = interval(std::fmin(a[1], b[1]), std::fmax(a[1], b[1]));
+        z = interval(std::fmin(a[2], b[2]), std::fmax(a[2], b[2]));
+    }
+
+    // The smallest box that holds both boxes.
+    aabb(const aabb & box0, const aabb & box1) : x(box0.x, box1.x), y(box0.y, box1.y), z(box0.z, box1.z) {}
+
+    const interval & axis(int n) const
+    {
+        if (n == 1)
+            return y;
+        if (n == 2)
+            return z;
+        return x;
+    }
+
+    point3 centroid() const
+    {
+        return point3(0.5 * (x.min + x.max), 0.5 * (y.min + y.max), 0.5 * (z.min + z.max));
+    }
+
+    double surface_area() const
+    {
+        double dx = x.size(), dy = y.size(), dz = z.size(); // in double, the SAH sums many of these
+        if (dx < 0 || dy < 0 || dz < 0)
+            return 0; // empty box
+        return 2 * (dx * dy + dy * dz + dz * dx);
+    }
+
+    // Slab test: narrows ray_t down to the overlap of the ray with each axis' slab.
+    bool hit(const ray & r, interval ray_t) const
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            auto invD = 1 / r.direction()[a];
+            auto orig = r.origin()[a];
+
+            auto t0 = (axis(a).min - orig) * invD;
+            auto t1 = (axis(a).max - orig) * invD;
+
+            if (invD < 0)
+                std::swap(t0, t1);
+
+            if (t0 > ray_t.min)
+                ray_t.min = t0;
+            if (t1 < ray_t.max)
+                ray_t.max = t1;
+
+            if (ray_t.max <= ray_t.min)
+                return false;
+        }
+        return true;
+    }
+};
+
+#endif
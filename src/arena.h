@@ -0,0 +1,120 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// A monotonic allocator for objects that live as long as a scene: each object is bump-allocated out of large
+// cache-line-aligned blocks, so objects created one after the other sit next to each other in memory, in creation
+// order, without a heap allocation or a shared_ptr control block of their own. Nothing is freed one by one; the
+// destructor runs the destructors of the objects that need it, newest first, and releases the blocks in one go.
+//
+// An arena is not thread-safe. Objects handed out by it must not outlive it.
+class arena
+{
+public:
+    static constexpr size_t cache_line = 64;
+
+    explicit arena(size_t block_size = size_t(1) << 20) : block_size(block_size) {}
+
+    arena(const arena &)             = delete;
+    arena & operator=(const arena &) = delete;
+
+    ~arena()
+    {
+        for (auto it = destructors.rbegin(); it != destructors.rend(); ++it)
+            for (size_t i = it->count; i-- > 0;)
+                it->destroy(it->first + i * it->stride);
+        for (void * block : blocks)
+            ::operator delete(block, std::align_val_t(cache_line));
+    }
+
+    // Returns `size` bytes aligned to `alignment` (at most a cache line).
+    void * allocate(size_t size, size_t alignment)
+    {
+        size_t offset = (used + alignment - 1) & ~(alignment - 1);
+        if (blocks.empty() || offset + size > capacity)
+        {
+            // Objects larger than a block get a block of their own; the current block keeps its free space.
+            size_t bytes = size > block_size ? size : block_size;
+            void * block = ::operator new(bytes, std::align_val_t(cache_line));
+            if (size > block_size && !blocks.empty())
+            {
+                blocks.insert(blocks.end() - 1, block);
+                reserved += bytes;
+                return block;
+            }
+            blocks.push_back(block);
+            reserved += bytes;
+            capacity = bytes;
+            offset   = 0;
+        }
+        used = offset + size;
+        return static_cast<uint8_t *>(blocks.back()) + offset;
+    }
+
+    // Constructs a T in the arena. The arena runs its destructor unless T is trivially destructible.
+    template <typename T, typename... Args>
+    T * create(Args &&... args)
+    {
+        static_assert(alignof(T) <= cache_line, "arena objects are at most cache line aligned");
+        T * object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        if (!std::is_trivially_destructible<T>::value)
+        {
+            auto destroy = [](void * p) { static_cast<T *>(p)->~T(); };
+            auto bytes   = reinterpret_cast<uint8_t *>(object);
+            if (!destructors.empty() && destructors.back().destroy == destroy &&
+                destructors.back().first + destructors.back().count * sizeof(T) == bytes)
+                destructors.back().count++;
+            else
+                destructors.push_back({bytes, 1, sizeof(T), destroy});
+        }
+        return object;
+    }
+
+    // A shared_ptr to `object` that shares ownership of the arena, for APIs such as hittable_list that hold
+    // shared_ptrs. The pointer keeps the arena alive instead of owning the object, so it costs no allocation.
+    template <typename T>
+    static std::shared_ptr<T> share(const std::shared_ptr<arena> & owner, T * object)
+    {
+        return std::shared_ptr<T>(owner, object);
+    }
+
+    // A shared_ptr to `object` that owns nothing. For pointers stored inside the arena itself, where an owning
+    // pointer would keep the arena alive forever.
+    template <typename T>
+    static std::shared_ptr<T> borrow(T * object)
+    {
+        return std::shared_ptr<T>(std::shared_ptr<void>(), object);
+    }
+
+    // Bytes taken from the system, including the unused ends of blocks.
+    size_t memory_bytes() const
+    {
+        return reserved;
+    }
+
+private:
+    size_t              block_size;
+    size_t              capacity = 0; // size of the current block, the last in `blocks`
+    size_t              used     = 0; // bytes handed out from the current block
+    size_t              reserved = 0;
+    std::vector<void *> blocks;
+
+    // Objects of one type created back to back share a record, so a block of spheres needs only one.
+    struct destructor_run
+    {
+        uint8_t * first;
+        size_t    count;
+        size_t    stride;
+        void (*destroy)(void *);
+    };
+    std::vector<destructor_run> destructors;
+};
+
+#endif
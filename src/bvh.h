@@ -0,0 +1,309 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "aabb.h"
+#include "arena.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "render_stats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Traversal counters for the BVH report.
+// Each thread counts into its own copy and folds it into the totals when the thread exits, so counting never
+// contends between render threads.
+struct bvh_stats
+{
+    inline static std::atomic<uint64_t> total_rays{0};
+    inline static std::atomic<uint64_t> total_nodes_visited{0};
+
+    uint64_t rays          = 0;
+    uint64_t nodes_visited = 0;
+
+    ~bvh_stats()
+    {
+        total_rays += rays;
+        total_nodes_visited += nodes_visited;
+    }
+
+    static bvh_stats & local()
+    {
+        thread_local bvh_stats stats;
+        return stats;
+    }
+};
+
+namespace bvh_build
+{
+
+constexpr int bin_count = 12; // candidate split planes per axis
+
+inline int bin_index(double centroid, double lo, double extent)
+{
+    int b = static_cast<int>(bin_count * (centroid - lo) / extent);
+    return std::clamp(b, 0, bin_count - 1);
+}
+
+// Bounds of the box centroids of the elements in [first, last). `box_of` maps an element to its bounding box.
+template <typename Iter, typename BoxOf>
+aabb centroid_bounds(Iter first, Iter last, BoxOf box_of)
+{
+    aabb centroids;
+    for (auto it = first; it != last; ++it)
+    {
+        auto c    = box_of(*it).centroid();
+        centroids = aabb(centroids, aabb(c, c));
+    }
+    return centroids;
+}
+
+// Cost of intersecting `count` primitives in a leaf whose primitives are tested `lanes` at a time.
+inline double leaf_cost(size_t count, int lanes)
+{
+    return static_cast<double>((count + lanes - 1) / lanes);
+}
+
+// Bins the element centroids along every axis, picks the plane with the lowest surface area heuristic cost and
+// partitions [first, last) around it. `bounds` must enclose every element. `lanes` is how many primitives a leaf
+// tests at once, so SIMD leaves are not split below their width.
+// Returns the partition point, or `first` when no split is cheaper than keeping every element in one leaf.
+template <typename Iter, typename BoxOf>
+Iter sah_partition(Iter first, Iter last, const aabb & bounds, BoxOf box_of, int lanes = 1)
+{
+    struct bin
+    {
+        aabb   bounds;
+        size_t count = 0;
+    };
+
+    aabb   centroids   = centroid_bounds(first, last, box_of);
+    double parent_area = bounds.surface_area();
+    double best_cost   = infinity;
+    int    best_axis   = -1;
+    int    best_bin    = -1;
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        double lo     = centroids.axis(axis).min;
+        double extent = centroids.axis(axis).size();
+        if (extent <= 0)
+            continue;
+
+        bin bins[bin_count];
+        for (auto it = first; it != last; ++it)
+        {
+            auto box = box_of(*it);
+            int  b   = bin_index(box.centroid()[axis], lo, extent);
+            bins[b].count++;
+            bins[b].bounds = aabb(bins[b].bounds, box);
+        }
+
+        // Sweep from the right to get the area and count of everything right of each plane.
+        double right_area[bin_count];
+        size_t right_count[bin_count];
+        aabb   accumulated;
+        size_t count = 0;
+        for (int b = bin_count - 1; b > 0; --b)
+        {
+            accumulated    = aabb(accumulated, bins[b].bounds);
+            count         += bins[b].count;
+            right_area[b]  = accumulated.surface_area();
+            right_count[b] = count;
+        }
+
+        accumulated = aabb();
+        count       = 0;
+        for (int b = 0; b < bin_count - 1; ++b)
+        {
+            accumulated  = aabb(accumulated, bins[b].bounds);
+            count       += bins[b].count;
+            if (count == 0 || right_count[b + 1] == 0)
+                continue;
+
+            double cost = 1.0 + (accumulated.surface_area() * leaf_cost(count, lanes) +
+                                    right_area[b + 1] * leaf_cost(right_count[b + 1], lanes)) /
+                                    parent_area;
+            if (cost < best_cost)
+            {
+                best_cost = cost;
+                best_axis = axis;
+                best_bin  = b;
+            }
+        }
+    }
+
+    if (best_axis < 0 || best_cost >= leaf_cost(last - first, lanes))
+        return first;
+
+    double lo     = centroids.axis(best_axis).min;
+    double extent = centroids.axis(best_axis).size();
+    return std::partition(first, last, [&](const auto & element) {
+        return bin_index(box_of(element).centroid()[best_axis], lo, extent) <= best_bin;
+    });
+}
+
+// Splits [first, last) in half around the median centroid along the widest centroid axis.
+template <typename Iter, typename BoxOf>
+Iter median_partition(Iter first, Iter last, BoxOf box_of)
+{
+    aabb centroids = centroid_bounds(first, last, box_of);
+
+    int axis = 0;
+    if (centroids.y.size() > centroids.axis(axis).size())
+        axis = 1;
+    if (centroids.z.size() > centroids.axis(axis).size())
+        axis = 2;
+
+    auto mid = first + (last - first) / 2;
+    std::nth_element(first, mid, last, [&](const auto & a, const auto & b) {
+        return box_of(a).centroid()[axis] < box_of(b).centroid()[axis];
+    });
+    return mid;
+}
+
+} // namespace bvh_build
+
+// A bounding volume hierarchy over the objects of a hittable_list, built with the binned surface area heuristic.
+// The root owns an arena holding every other node and leaf list, so the tree is allocated in build order, close
+// together, and freed at once.
+class bvh_node : public hittable
+{
+public:
+    static constexpr int max_leaf_size = 4; // a leaf is never forced to split until it holds more than this
+
+    bvh_node(hittable_list list) : storage(std::make_shared<arena>())
+    {
+        build(list.objects, 0, list.objects.size(), *storage);
+    }
+
+    // Builds over objects[start, end), reordering that range in place, with the child nodes in `nodes`.
+    bvh_node(std::vector<std::shared_ptr<hittable>> & objects, size_t start, size_t end, arena & nodes)
+    {
+        build(objects, start, end, nodes);
+    }
+
+    // Counts one hittable::hit call per ray in the render statistics, and the nodes the ray visits in a local that is
+    // folded into the thread's BVH counters once the ray is done.
+    bool hit(const ray & r, interval ray_t, hit_record & rec) const override
+    {
+        if constexpr (render_stats::enabled)
+            render_stats::local().hit_calls++;
+
+        uint64_t nodes_visited = 0;
+        bool     hit_anything  = hit_subtree(r, ray_t, rec, nodes_visited);
+
+        auto & stats = bvh_stats::local();
+        stats.rays++;
+        stats.nodes_visited += nodes_visited;
+        return hit_anything;
+    }
+
+    aabb bounding_box() const override
+    {
+        return bbox;
+    }
+
+    // Number of bvh_node objects constructed so far.
+    static std::atomic<size_t> & node_count()
+    {
+        static std::atomic<size_t> count{0};
+        return count;
+    }
+
+    // Bytes of the arena holding the tree, for the root; 0 for other nodes.
+    size_t memory_bytes() const
+    {
+        return storage ? storage->memory_bytes() : 0;
+    }
+
+private:
+    std::shared_ptr<arena>    storage; // the root's; inner nodes point into it without owning it
+    std::shared_ptr<hittable> left;
+    std::shared_ptr<hittable> right;
+    aabb                      bbox;
+    bool                      inner = false; // both children are bvh_nodes, walked without a virtual call
+
+    bool hit_subtree(const ray & r, interval ray_t, hit_record & rec, uint64_t & nodes_visited) const
+    {
+        nodes_visited++;
+        if (!bbox.hit(r, ray_t))
+            return false;
+
+        if (inner)
+        {
+            bool hit_left  = static_cast<const bvh_node &>(*left).hit_subtree(r, ray_t, rec, nodes_visited);
+            bool hit_right = static_cast<const bvh_node &>(*right).hit_subtree(
+                r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec, nodes_visited);
+            return hit_left || hit_right;
+        }
+
+        bool hit_left  = left->hit(r, ray_t, rec);
+        bool hit_right = right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+        return hit_left || hit_right;
+    }
+
+    void build(std::vector<std::shared_ptr<hittable>> & objects, size_t start, size_t end, arena & nodes)
+    {
+        node_count()++;
+
+        for (size_t i = start; i < end; ++i)
+            bbox = aabb(bbox, objects[i]->bounding_box());
+
+        size_t object_span = end - start;
+
+        if (object_span == 1)
+        {
+            left = right = objects[start];
+            return;
+        }
+
+        if (object_span == 2)
+        {
+            left  = objects[start];
+            right = objects[start + 1];
+            return;
+        }
+
+        auto box_of = [](const std::shared_ptr<hittable> & object) { return object->bounding_box(); };
+        auto first  = objects.begin() + start;
+        auto last   = objects.begin() + end;
+        auto split  = bvh_build::sah_partition(first, last, bbox, box_of);
+
+        if (split == first)
+        {
+            if (object_span <= max_leaf_size)
+            {
+                make_leaf(objects, start, end, nodes);
+                return;
+            }
+
+            // SAH found nothing worth splitting but the leaf would be too large.
+            split = bvh_build::median_partition(first, last, box_of);
+        }
+
+        size_t mid = static_cast<size_t>(split - objects.begin());
+        left       = arena::borrow(nodes.create<bvh_node>(objects, start, mid, nodes));
+        right      = arena::borrow(nodes.create<bvh_node>(objects, mid, end, nodes));
+        inner      = true;
+    }
+
+    void make_leaf(const std::vector<std::shared_ptr<hittable>> & objects, size_t start, size_t end, arena & nodes)
+    {
+        // Split the leaf's objects into two flat lists, so the leaf stays a plain two-child node.
+        size_t mid        = start + (end - start) / 2;
+        auto   left_list  = nodes.create<hittable_list>();
+        auto   right_list = nodes.create<hittable_list>();
+        for (size_t i = start; i < mid; ++i)
+            left_list->add(objects[i]);
+        for (size_t i = mid; i < end; ++i)
+            right_list->add(objects[i]);
+        left  = arena::borrow(left_list);
+        right = arena::borrow(right_list);
+    }
+};
+
+#endif
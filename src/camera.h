@@ -1,46 +1,125 @@
 #ifndef CAMERA_H
-#define CAMERA_h
+#define CAMERA_H
 
 #include "color.h"
+#include "framebuffer.h"
 #include "hittable.h"
 #include "material.h"
+#include "ray_stream.h"
+#include "render_stats.h"
+#include "sampler.h"
+#include "thread_pool.h"
 #include "utils.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <vector>
+
 class camera
 {
   public:
-    double aspect_ratio      = 16.0 / 9.0;       // Ratio of image width over height
-    int    image_width       = 400;              // Rendered image width in pixel count
-    int    samples_per_pixel = 16;               // Count of random samples used for antialiasing
-    int    max_depth         = 8;                // maximum number of ray bounces allowed per raycast
-    double vfov              = 90;               // Vertical view angle (field of view)
-    point3 lookfrom          = point3(0, 0, -1); // Point camera is looking from
-    point3 lookat            = point3(0, 0, 0);  // Point camera is looking at
-    vec3   vup               = vec3(0, 1, 0);    // Camera-relative "up" direction
-    double defocus_angle     = 0;                // Variation angle of rays through each pixel
-    double focus_dist        = 10;               // Distance from camera lookfrom point to plane of perfect focus
-
-    void render(const hittable & world)
+    double   aspect_ratio      = 16.0 / 9.0;       // Ratio of image width over height
+    int      image_width       = 400;              // Rendered image width in pixel count
+    int      samples_per_pixel = 16;               // Count of random samples used for antialiasing
+    int      max_depth         = 8;                // maximum number of ray bounces allowed per raycast
+    double   vfov              = 90;               // Vertical view angle (field of view)
+    point3   lookfrom          = point3(0, 0, -1); // Point camera is looking from
+    point3   lookat            = point3(0, 0, 0);  // Point camera is looking at
+    vec3     vup               = vec3(0, 1, 0);    // Camera-relative "up" direction
+    double   defocus_angle     = 0;                // Variation angle of rays through each pixel
+    double   focus_dist        = 10;               // Distance from camera lookfrom point to plane of perfect focus
+    int      tile_size         = 16;               // Width and height of the square tiles handed to render threads
+    unsigned thread_count      = 0;                // Number of render threads, 0 uses every hardware thread
+    double   noise_threshold   = 0;                // Adaptive sampling: relative error a pixel must reach, 0 disables
+    double   time_budget       = 0;                // Wall-clock seconds after which sampling stops, 0 for no deadline
+    int      roulette_depth    = 3;                // Bounces before Russian roulette may end a path, negative disables
+    bool     wavefront         = false;            // Trace each tile's samples as ray streams, one bounce at a time
+    bool     show_progress     = true;             // Print progress and sample reports to std::clog
+    bool     features          = false;            // Also sum first-hit albedo, normal and depth, for the denoiser
+
+    // Where the numbers behind each sample's pixel position, lens position and bounces come from (see sampler.h).
+    sampling::sampler_kind sampler = sampling::sampler_kind::independent;
+
+    // Called on the render thread after each tile task finishes, with the tile's pixel bounds (x1 and y1 excluded).
+    // Calls come from several threads at once.
+    std::function<void(int x0, int y0, int x1, int y1)> on_tile_done;
+
+    // Renders the world into a framebuffer of summed samples.
+    framebuffer render(const hittable & world)
     {
         init();
 
-        std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+        framebuffer image(image_width, image_height);
+        if (features)
+            image.enable_features();
+        if (noise_threshold > 0 || time_budget > 0)
+            render_adaptive(world, image);
+        else
+            render_tiles(world, image);
 
-        for (int j = 0; j < image_height; ++j)
-        {
-            std::clog << "\rScanlines remaining: " << (image_height - j) << ' ' << std::flush;
-            for (int i = 0; i < image_width; ++i)
-            {
-                color pixel_color(0, 0, 0);
-                for (int sample = 0; sample < samples_per_pixel; sample++)
-                {
-                    ray r = get_ray(i, j);
-                    pixel_color += ray_color(r, max_depth, world);
-                }
-                write_color(std::cout, pixel_color, samples_per_pixel);
-            }
-        }
-        std::clog << "\rDone.                    \n"; // Progress Indicator End
+        return image;
+    }
+
+    struct tile
+    {
+        int x0, y0, x1, y1; // pixel bounds, half-open on the high side
+    };
+
+    // The tiles render() splits the image into, in the order it hands them out.
+    std::vector<tile> tiles()
+    {
+        init();
+        return make_tiles();
+    }
+
+    // The rendered image height, which follows from image_width and aspect_ratio.
+    int height()
+    {
+        init();
+        return image_height;
+    }
+
+    // Adds samples_per_pixel samples to every pixel of tile `t` of `image`, on the calling thread. Pixels draw from
+    // the same RNG streams as in render(), so tiles rendered separately, even in other processes started with the same
+    // seed and scene, assemble into exactly the image render() makes. Adaptive sampling does not apply.
+    void render_tile(const hittable & world, const tile & t, framebuffer & image)
+    {
+        init();
+        stream_stats stats;
+        render_one_tile(world, t, image, stats);
+    }
+
+    // The first hit of a camera ray, kept by render_pass so that a pass can be shaded again without tracing its
+    // camera rays.
+    struct primary_hit
+    {
+        hit_record rec;
+        bool       hit = false;
+    };
+
+    // Adds one sample to every pixel of `image` on `pool`, from the pixels' RNG streams for pass `pass`, so that
+    // passes 0, 1, 2, ... refine the image progressively as in an adaptive render. `hits`, if given, holds one entry
+    // per pixel: the camera rays' first hits are stored in it, or with `reuse` taken from it instead of traced. A pass
+    // makes the same camera rays every time, so the stored hits stay valid, and the image the same, until the
+    // geometry or the settings init() derives the camera frame from change. Materials and max_depth may change.
+    void render_pass(thread_pool & pool, const hittable & world, framebuffer & image, int pass, primary_hit * hits,
+        bool reuse)
+    {
+        init();
+        run_tiles(pool, make_tiles(), pass, "", [&](const tile & t) {
+            for (int j = t.y0; j < t.y1; ++j)
+                for (int i = t.x0; i < t.x1; ++i)
+                    sample_pixel(world, i, j, pass, 1, image, nullptr,
+                        hits ? &hits[size_t(j) * image_width + i] : nullptr, reuse);
+        });
     }
 
   private:
@@ -53,6 +132,525 @@ class camera
     vec3   defocus_disk_u; // Defocus disk horizontal radius
     vec3   defocus_disk_v; // Defocus disk vertical radius
 
+    // The features one camera ray gathers for the denoiser. A smooth mirror or glass shows other surfaces, so the
+    // albedo and normal come from the first surface seen through them, tinted by the mirrors on the way; the depth is
+    // always the first hit's.
+    struct feature_sample
+    {
+        color albedo = color(0, 0, 0);
+        vec3  normal = vec3(0, 0, 0);
+        real  depth  = 0;
+        color tint   = color(1, 1, 1); // the product of the mirrors' albedos so far
+        bool  done   = false;
+    };
+
+    // One path of a wavefront: the ray it is about to trace, what its earlier bounces let through, and what it has
+    // gathered.
+    struct path_state
+    {
+        ray             r;
+        color           throughput;
+        color           radiance;
+        uint32_t        pixel;
+        sampling::state sample;
+    };
+
+    // Per-thread working set of the wavefront renderer, kept between blocks so its arrays are allocated once.
+    struct wavefront_buffers
+    {
+        std::vector<path_state> paths;
+        std::vector<uint32_t>   block_pixels;
+        std::vector<uint32_t>   active, next;                  // indices into paths
+        std::vector<uint32_t>   by_kind[material_kind_count];  // indices into active, recs and hits
+        std::vector<ray>        in;   // the active paths' rays, in the order of recs and hits
+        std::vector<hit_record> recs;
+        std::vector<uint8_t>    hits;
+        ray_stream              rays;
+
+        // What scatter_many returns for one material kind's batch.
+        std::vector<ray>               batch_out;
+        std::vector<color>             batch_attenuation;
+        std::vector<uint8_t>           batch_ok;
+        std::vector<sampling::state *> batch_samples; // the paths' sampler states, for scatter_many
+
+        std::vector<feature_sample> features; // per path, when the image holds features
+    };
+
+    // Rays traced and time spent tracing them by the wavefront renderer, split into camera rays (index 0) and the
+    // secondary rays of later bounces (index 1). Times are summed over the render threads.
+    struct stream_stats
+    {
+        std::atomic<uint64_t> rays[2]        = {};
+        std::atomic<uint64_t> nanoseconds[2] = {};
+    };
+
+    // Running luminance statistics of one pixel for adaptive sampling (Welford's online mean and variance).
+    struct pixel_estimate
+    {
+        double mean   = 0;
+        double m2     = 0;
+        bool   active = true; // still wants samples
+    };
+
+    std::vector<tile> make_tiles() const
+    {
+        std::vector<tile> tiles;
+        for (int y = 0; y < image_height; y += tile_size)
+            for (int x = 0; x < image_width; x += tile_size)
+                tiles.push_back({x, y, std::min(x + tile_size, image_width), std::min(y + tile_size, image_height)});
+        return tiles;
+    }
+
+    // Runs `render_one(tile)` for every tile on the pool and waits for all of them, reporting tiles done. `pass` is
+    // only used to label the tile times in the render statistics.
+    template <typename F>
+    void run_tiles(thread_pool & pool, const std::vector<tile> & tiles, int pass, const std::string & label,
+        F && render_one) const
+    {
+        std::atomic<int> tiles_done{0};
+        std::mutex       progress_mutex;
+        int              tile_count = static_cast<int>(tiles.size());
+
+        for (const auto & t : tiles)
+        {
+            pool.submit([&, t] {
+                if constexpr (render_stats::enabled)
+                {
+                    auto start = std::chrono::steady_clock::now();
+                    render_one(t);
+                    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                    render_stats::local().tiles.push_back({pass, t.x0, t.y0, t.x1, t.y1, elapsed.count()});
+                }
+                else
+                    render_one(t);
+                if (on_tile_done)
+                    on_tile_done(t.x0, t.y0, t.x1, t.y1);
+
+                int done = ++tiles_done;
+                if (!show_progress)
+                    return;
+                std::lock_guard<std::mutex> lock(progress_mutex);
+                std::clog << "\r" << label << "Tiles done: " << done << '/' << tile_count << ' ' << std::flush;
+            });
+        }
+        pool.wait();
+    }
+
+    // Splits the image into tiles and renders them on a thread pool.
+    // Every pixel draws from its own RNG stream, so the image only depends on the seed and never on how the tiles were
+    // scheduled or how many threads there are.
+    void render_tiles(const hittable & world, framebuffer & image) const
+    {
+        auto        tiles = make_tiles();
+        thread_pool pool(thread_count);
+        if (show_progress)
+            std::clog << "Rendering " << tiles.size() << " tiles on " << pool.size() << " threads" << std::endl;
+
+        stream_stats stats;
+        run_tiles(pool, tiles, 0, "", [&](const tile & t) { render_one_tile(world, t, image, stats); });
+
+        if (show_progress)
+        {
+            std::clog << "\rDone.                    \n"; // Progress Indicator End
+            if (wavefront)
+                report_streams(stats);
+        }
+    }
+
+    void render_one_tile(const hittable & world, const tile & t, framebuffer & image, stream_stats & stats) const
+    {
+        if (wavefront)
+        {
+            trace_tile_stream(world, t, 0, samples_per_pixel, image, nullptr, stats);
+            return;
+        }
+        for (int j = t.y0; j < t.y1; ++j)
+            for (int i = t.x0; i < t.x1; ++i)
+                sample_pixel(world, i, j, 0, samples_per_pixel, image, nullptr);
+    }
+
+    // Renders in passes. The first pass gives every pixel a few samples, never more than half of samples_per_pixel;
+    // each later pass adds a batch to the pixels that are still active. With a noise threshold, a pixel drops out once
+    // the standard error of its mean luminance falls below `noise_threshold` relative to the mean, and the samples it
+    // saved can go to the noisier pixels: the total stays within samples_per_pixel * pixel count, and no pixel takes
+    // more than max_adaptive_scale times samples_per_pixel. Without a threshold every pixel stays active until it has
+    // samples_per_pixel samples, which together with a time budget gives a progressive render that stops at the
+    // deadline.
+    //
+    // Pass k of a pixel draws from its own RNG stream, so without a deadline the result is still independent of
+    // thread count and scheduling.
+    void render_adaptive(const hittable & world, framebuffer & image) const
+    {
+        static constexpr int max_adaptive_scale = 8;
+
+        using clock   = std::chrono::steady_clock;
+        auto start    = clock::now();
+        auto deadline = start + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(time_budget));
+
+        size_t pixel_count = size_t(image_width) * image_height;
+        int    batch       = std::max(1, std::min(samples_per_pixel / 2, std::max(8, samples_per_pixel / 8)));
+        int    max_samples = noise_threshold > 0 ? max_adaptive_scale * samples_per_pixel : samples_per_pixel;
+        size_t budget      = size_t(samples_per_pixel) * pixel_count;
+
+        std::vector<pixel_estimate> estimates(pixel_count);
+        std::atomic<size_t>         spent{0};
+
+        auto        tiles = make_tiles();
+        thread_pool pool(thread_count);
+        if (show_progress)
+            std::clog << "Rendering adaptively: " << tiles.size() << " tiles on " << pool.size() << " threads, up to "
+                      << batch << " samples per pixel per pass" << std::endl;
+
+        stream_stats stats;
+        size_t       active = pixel_count;
+        for (int pass = 0; active > 0 && spent < budget; ++pass)
+        {
+            // The first pass always completes so that every pixel has an estimate.
+            if (pass > 0 && time_budget > 0 && clock::now() >= deadline)
+                break;
+
+            // Shrink the last passes so the total never overshoots the budget.
+            int pass_batch = static_cast<int>(std::min<size_t>(batch, (budget - spent) / active));
+            if (pass_batch == 0)
+                break;
+
+            std::string label = "Pass " + std::to_string(pass) + ", " + std::to_string(active) + " active pixels. ";
+            run_tiles(pool, tiles, pass, label, [&](const tile & t) {
+                if (pass > 0 && time_budget > 0 && clock::now() >= deadline)
+                    return;
+
+                if (wavefront)
+                    trace_tile_stream(world, t, pass, pass_batch, image, estimates.data(), stats);
+
+                size_t tile_samples = 0;
+                for (int j = t.y0; j < t.y1; ++j)
+                {
+                    for (int i = t.x0; i < t.x1; ++i)
+                    {
+                        auto & estimate = estimates[size_t(j) * image_width + i];
+                        if (!estimate.active)
+                            continue;
+
+                        if (!wavefront)
+                            sample_pixel(world, i, j, pass, pass_batch, image, &estimate);
+                        tile_samples += pass_batch;
+
+                        int n = image.samples(i, j);
+                        if (n >= max_samples || (noise_threshold > 0 && converged(estimate, n)))
+                            estimate.active = false;
+                    }
+                }
+                spent += tile_samples;
+            });
+
+            active = 0;
+            for (const auto & estimate : estimates)
+                active += estimate.active;
+        }
+
+        if (show_progress)
+        {
+            std::chrono::duration<double> elapsed = clock::now() - start;
+            std::clog << "\rDone.                                                            \n";
+            report_samples(image, budget, elapsed.count());
+            if (wavefront)
+                report_streams(stats);
+        }
+    }
+
+    // Adds `count` samples to pixel (i, j) from the pixel's RNG stream for `pass`, updating `estimate` if given, and
+    // the samples' first-hit features if the image holds them. `first` caches the first hit of a single sample, as in
+    // render_pass.
+    void sample_pixel(const hittable & world, int i, int j, int pass, int count, framebuffer & image,
+        pixel_estimate * estimate, primary_hit * first = nullptr, bool reuse = false) const
+    {
+        size_t pixel = size_t(j) * image_width + i;
+        utils::reseed(pixel + size_t(pass) * image_width * image_height);
+
+        color pixel_color(0, 0, 0);
+        int   n = image.samples(i, j);
+
+        sampling::state state(sampler, i, j, samples_per_pixel);
+        sampling::bind(&state);
+        for (int sample = 0; sample < count; sample++)
+        {
+            state.start(n + sample);
+            feature_sample   f;
+            feature_sample * features     = image.has_features() ? &f : nullptr;
+            ray              r            = get_ray(i, j);
+            color            sample_color = ray_color(r, max_depth, world, first, reuse, features);
+            pixel_color += sample_color;
+            if (features)
+                image.add_features(i, j, sample_color, f.albedo, f.normal, f.depth);
+
+            if (estimate)
+            {
+                double luminance = 0.2126 * sample_color.x() + 0.7152 * sample_color.y() + 0.0722 * sample_color.z();
+                double delta     = luminance - estimate->mean;
+                estimate->mean += delta / (n + sample + 1);
+                estimate->m2 += delta * (luminance - estimate->mean);
+            }
+        }
+        sampling::bind(nullptr);
+        image.at(i, j) += pixel_color;
+        image.samples(i, j) += count;
+    }
+
+    // Adds `count` samples to every pixel of tile `t` (only the active ones if `estimates` is given) by tracing them as
+    // wavefronts, one per 8x8 pixel block: all paths of the block advance one bounce at a time, and each bounce
+    // intersects the whole batch of rays through world.hit_stream. Camera rays are generated one sample of the block
+    // after the other, so every packet of 64 primary rays is coherent. After each bounce the hits are grouped by
+    // material kind and every group is shaded by one scatter_many call.
+    //
+    // The tile draws from one RNG stream in a fixed order, so the result depends on the seed and tile_size but not on
+    // thread count or scheduling. The draws are ordered differently from sample_pixel, so the two modes give
+    // different noise with the same expected image. Each path carries its sampler state, so with any sampler but the
+    // independent one a sample takes the same numbers in both modes.
+    void trace_tile_stream(const hittable & world, const tile & t, int pass, int count, framebuffer & image,
+        pixel_estimate * estimates, stream_stats & stats) const
+    {
+        static constexpr int block = 8;
+
+        size_t pixel_count = size_t(image_width) * image_height;
+        utils::reseed(size_t(t.y0) * image_width + t.x0 + size_t(pass) * pixel_count);
+
+        // Scratch space reused by every block a thread traces.
+        thread_local wavefront_buffers buffers;
+        auto &                         paths = buffers.paths;
+
+        for (int by = t.y0; by < t.y1; by += block)
+        {
+            for (int bx = t.x0; bx < t.x1; bx += block)
+            {
+                buffers.block_pixels.clear();
+                for (int j = by; j < std::min(by + block, t.y1); ++j)
+                    for (int i = bx; i < std::min(bx + block, t.x1); ++i)
+                        if (!estimates || estimates[size_t(j) * image_width + i].active)
+                            buffers.block_pixels.push_back(static_cast<uint32_t>(size_t(j) * image_width + i));
+
+                paths.clear();
+                for (int sample = 0; sample < count; ++sample)
+                {
+                    for (uint32_t p : buffers.block_pixels)
+                    {
+                        uint32_t i = p % image_width, j = p / image_width;
+                        paths.push_back({ray(), color(1, 1, 1), color(0, 0, 0), p,
+                            sampling::state(sampler, i, j, samples_per_pixel)});
+                        auto & path = paths.back();
+                        path.sample.start(image.samples(i, j) + sample);
+                        sampling::bind(&path.sample);
+                        path.r = get_ray(i, j);
+                    }
+                }
+                sampling::bind(nullptr);
+
+                if (image.has_features())
+                    buffers.features.assign(paths.size(), feature_sample());
+                trace_paths(world, buffers, stats);
+
+                // Paths still active ran out of bounces and keep a radiance of zero, like ray_color.
+                for (size_t p = 0; p < paths.size(); ++p)
+                {
+                    const auto & path = paths[p];
+                    uint32_t     i = path.pixel % image_width, j = path.pixel / image_width;
+                    image.at(i, j) += path.radiance;
+                    int n = image.samples(i, j)++;
+                    if (image.has_features())
+                    {
+                        const auto & f = buffers.features[p];
+                        image.add_features(i, j, path.radiance, f.albedo, f.normal, f.depth);
+                    }
+
+                    if (estimates)
+                    {
+                        auto & estimate  = estimates[path.pixel];
+                        double luminance = 0.2126 * path.radiance.x() + 0.7152 * path.radiance.y() +
+                                           0.0722 * path.radiance.z();
+                        double delta = luminance - estimate.mean;
+                        estimate.mean += delta / (n + 1);
+                        estimate.m2 += delta * (luminance - estimate.mean);
+                    }
+                }
+            }
+        }
+    }
+
+    // Advances every path in buffers.paths bounce by bounce until it leaves the scene, is absorbed, loses the
+    // roulette or reaches max_depth. Paths gather features into buffers.features if it has an entry for each.
+    void trace_paths(const hittable & world, wavefront_buffers & buffers, stream_stats & stats) const
+    {
+        auto & paths  = buffers.paths;
+        auto & active = buffers.active;
+        auto & recs   = buffers.recs;
+        auto & hits   = buffers.hits;
+        auto & rays   = buffers.rays;
+
+        active.resize(paths.size());
+        for (uint32_t p = 0; p < paths.size(); ++p)
+            active[p] = p;
+
+        for (int bounce = 0; bounce < max_depth && !active.empty(); ++bounce)
+        {
+            rays.clear();
+            buffers.in.clear();
+            for (uint32_t p : active)
+            {
+                rays.push(paths[p].r, infinity);
+                buffers.in.push_back(paths[p].r);
+            }
+            recs.resize(active.size());
+            hits.resize(active.size());
+
+            auto start = std::chrono::steady_clock::now();
+            world.hit_stream(rays, ray_epsilon, recs.data(), hits.data());
+            std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
+            int                      kind    = bounce == 0 ? 0 : 1;
+            stats.rays[kind] += active.size();
+            stats.nanoseconds[kind] += elapsed.count();
+            if constexpr (render_stats::enabled)
+                render_stats::local().count_rays(bounce, active.size());
+
+            if (!buffers.features.empty())
+                for (uint32_t k = 0; k < active.size(); ++k)
+                    gather_features(buffers.features[active[k]], bounce, buffers.in[k], hits[k], recs[k]);
+
+            // Misses pick up the sky; hits are bucketed by material kind, keeping their order within a kind.
+            for (auto & bucket : buffers.by_kind)
+                bucket.clear();
+            for (uint32_t k = 0; k < active.size(); ++k)
+            {
+                auto & path = paths[active[k]];
+                if (hits[k])
+                    buffers.by_kind[static_cast<int>(recs[k].mat->kind)].push_back(k);
+                else
+                    path.radiance = path.throughput * background(path.r);
+            }
+            if constexpr (render_stats::enabled)
+            {
+                size_t hit_count = 0;
+                for (const auto & bucket : buffers.by_kind)
+                    hit_count += bucket.size();
+                render_stats::local().escaped += active.size() - hit_count;
+            }
+
+            buffers.next.clear();
+            for (int kind = 0; kind < material_kind_count; ++kind)
+                shade_batch(static_cast<material_kind>(kind), bounce, buffers);
+            active.swap(buffers.next);
+        }
+
+        if constexpr (render_stats::enabled)
+            render_stats::local().depth_cutoff += active.size();
+    }
+
+    // Scatters the paths whose hits are of `kind` with one scatter_many call, and queues the paths that carry on for
+    // the next bounce.
+    void shade_batch(material_kind kind, int bounce, wavefront_buffers & buffers) const
+    {
+        const auto & batch = buffers.by_kind[static_cast<int>(kind)];
+        size_t       count = batch.size();
+        if (count == 0)
+            return;
+
+        buffers.batch_out.resize(count);
+        buffers.batch_attenuation.resize(count);
+        buffers.batch_ok.resize(count);
+        buffers.batch_samples.resize(count);
+        for (size_t b = 0; b < count; ++b)
+            buffers.batch_samples[b] = &buffers.paths[buffers.active[batch[b]]].sample;
+        scatter_many(kind, count, batch.data(), buffers.in.data(), buffers.recs.data(),
+            buffers.batch_attenuation.data(), buffers.batch_out.data(), buffers.batch_ok.data(),
+            buffers.batch_samples.data());
+
+        if constexpr (render_stats::enabled)
+        {
+            auto & stats = render_stats::local();
+            for (size_t b = 0; b < count; ++b)
+                (buffers.batch_ok[b] ? stats.scattered : stats.absorbed)[static_cast<int>(kind)]++;
+        }
+
+        for (size_t b = 0; b < count; ++b)
+        {
+            if (!buffers.batch_ok[b])
+                continue;
+
+            uint32_t p      = buffers.active[batch[b]];
+            auto &   path   = buffers.paths[p];
+            path.throughput = path.throughput * buffers.batch_attenuation[b];
+            path.r          = buffers.batch_out[b];
+            sampling::bind(&path.sample);
+            if (survives_roulette(bounce, path.throughput))
+                buffers.next.push_back(p);
+        }
+        sampling::bind(nullptr);
+    }
+
+    // Prints the wavefront tracing rates, per render thread since the times are summed over threads.
+    void report_streams(const stream_stats & stats) const
+    {
+        const char * names[2] = {"primary", "secondary"};
+        std::clog << "Wavefront rays per render thread:";
+        for (int kind = 0; kind < 2; ++kind)
+        {
+            double seconds = stats.nanoseconds[kind] * 1e-9;
+            std::clog << ' ' << names[kind] << ' ' << stats.rays[kind] << " at "
+                      << (seconds > 0 ? stats.rays[kind] / seconds / 1e6 : 0) << " Mrays/s" << (kind == 0 ? "," : "");
+        }
+        std::clog << std::endl;
+    }
+
+    // True once the standard error of the pixel's displayed brightness is at most noise_threshold (on a 0-1 scale).
+    // The image is written through linear_to_gamma (a square root), so an error of e in the linear mean L shows up
+    // as roughly e / (2 sqrt(L)) on screen; the floor on L keeps near-black pixels from demanding endless samples.
+    bool converged(const pixel_estimate & estimate, int n) const
+    {
+        if (n < 2)
+            return false;
+        double variance       = estimate.m2 / (n - 1);
+        double standard_error = std::sqrt(variance / n);
+        return standard_error / (2 * std::sqrt(std::max(estimate.mean, 0.01))) <= noise_threshold;
+    }
+
+    // Prints how the samples were spread over the pixels.
+    void report_samples(const framebuffer & image, size_t budget, double seconds) const
+    {
+        size_t total   = 0;
+        int    min_n   = std::numeric_limits<int>::max();
+        int    max_n   = 0;
+        int    buckets = 8;
+
+        for (int j = 0; j < image_height; ++j)
+        {
+            for (int i = 0; i < image_width; ++i)
+            {
+                int n = image.samples(i, j);
+                total += n;
+                min_n = std::min(min_n, n);
+                max_n = std::max(max_n, n);
+            }
+        }
+
+        // Histogram of the sample counts, in equal-width buckets up to the largest count, and no more buckets than
+        // counts so none of them is empty by construction.
+        int top = std::max(1, max_n);
+        buckets = std::min(buckets, top);
+        std::vector<size_t> histogram(buckets, 0);
+        for (int j = 0; j < image_height; ++j)
+            for (int i = 0; i < image_width; ++i)
+                histogram[std::clamp((image.samples(i, j) - 1) * buckets / top, 0, buckets - 1)]++;
+
+        size_t pixel_count = size_t(image_width) * image_height;
+        std::clog << "Samples: " << total << " of a " << budget << " budget (" << 100.0 * total / budget << "%) in "
+                  << seconds << " s" << std::endl;
+        std::clog << "Samples per pixel: min " << min_n << ", mean " << double(total) / pixel_count << ", max "
+                  << max_n << std::endl;
+        for (int b = 0; b < buckets; ++b)
+        {
+            std::clog << "  " << std::setw(5) << b * top / buckets + 1 << " - " << std::setw(5)
+                      << (b + 1) * top / buckets << " spp: " << std::setw(8) << histogram[b] << " pixels" << std::endl;
+        }
+    }
+
     void init()
     {
         image_height = static_cast<int>(image_width / aspect_ratio);
@@ -90,36 +688,126 @@ class camera
     }
 
     // ray_color will directly give a color output for a single raycast.
-    color ray_color(const ray & r, int depth, const hittable & world) const
+    // The path is followed one bounce at a time, carrying the product of the attenuations so far in `throughput`.
+    // After roulette_depth bounces a path survives each further bounce with probability equal to its brightest
+    // throughput channel and is reweighted by 1/p when it does, so dim paths end early without biasing the image.
+    // If `first` is given the ray's first hit is stored in it, or with `reuse` read from it instead of traced. The path
+    // gathers the ray's features into `features` if given.
+    color ray_color(const ray & r, int depth, const hittable & world, primary_hit * first = nullptr,
+        bool reuse = false, feature_sample * features = nullptr) const
     {
-        // break out if we've maxed our recursion depth
-        if (depth <= 0)
-            return color(0, 0, 0);
-
-        // Check if the ray hit the object
+        color      throughput(1, 1, 1);
+        ray        current = r;
         hit_record rec;
 
-        if (world.hit(r, interval(0.001, infinity), rec))
+        for (int bounce = 0; bounce < depth; ++bounce)
         {
+            if constexpr (render_stats::enabled)
+                render_stats::local().count_rays(bounce);
+
+            // Check if the ray hit the object
+            bool hit;
+            if (bounce == 0 && first && reuse)
+            {
+                hit = first->hit;
+                rec = first->rec;
+            }
+            else
+            {
+                hit = world.hit(current, interval(ray_epsilon, infinity), rec);
+                if (bounce == 0 && first)
+                    *first = {rec, hit};
+            }
+            if (features)
+                gather_features(*features, bounce, current, hit, rec);
+            if (!hit)
+            {
+                if constexpr (render_stats::enabled)
+                    render_stats::local().escaped++;
+                return throughput * background(current);
+            }
+
             ray   scattered;
             color attenuation;
-            if (rec.mat->scatter(r, rec, attenuation, scattered))
-                return attenuation * ray_color(scattered, depth - 1, world);
-            return color(0, 0, 0);
+            bool  scatters = rec.mat->scatter(current, rec, attenuation, scattered);
+            if constexpr (render_stats::enabled)
+            {
+                auto & stats = render_stats::local();
+                (scatters ? stats.scattered : stats.absorbed)[static_cast<int>(rec.mat->kind)]++;
+            }
+            if (!scatters)
+                return color(0, 0, 0);
 
-            // // DIFFUSION
-            // vec3 direction = rec.normal + random_unit_vector();
-            // // custom hack to aded nice colors
-            // return 0.5 * (rec.normal + color(1, 1, 1)) * ray_color(ray(rec.p, direction), depth - 1, world);
-            // return 0.5 * ray_color(ray(rec.p, direction), depth - 1, world);
+            throughput = throughput * attenuation;
+            current    = scattered;
 
-            // COLOR-CODE BY NORMAL VECTOR
-            // return 0.5 * (rec.normal + color(1, 1, 1));
+            if (!survives_roulette(bounce, throughput))
+                return color(0, 0, 0);
         }
 
-        // Gradiant blue sky background
-        vec3   u = unit_vector(r.direction()); // unit vector of our ray
-        double a = 0.5 * (u.y() + 1.0);        // a is the intensity of the color
+        // break out if we've maxed our bounce depth
+        if constexpr (render_stats::enabled)
+            render_stats::local().depth_cutoff++;
+        return color(0, 0, 0);
+    }
+
+    // Russian roulette after `bounce`: once past roulette_depth, the path survives with probability equal to its
+    // brightest throughput channel, and a survivor's throughput is scaled up by 1/p to keep the estimate unbiased.
+    bool survives_roulette(int bounce, color & throughput) const
+    {
+        if (roulette_depth < 0 || bounce < roulette_depth)
+            return true;
+
+        real survival = std::min(real(1), std::max({throughput.x(), throughput.y(), throughput.z()}));
+        if (survival <= 0 || sampling::next_1d() >= survival)
+        {
+            if constexpr (render_stats::enabled)
+                render_stats::local().roulette_ended++;
+            return false;
+        }
+        throughput = throughput / survival;
+        return true;
+    }
+
+    // Takes the features of bounce `bounce` of a camera ray's path into `f`, until they are settled: a miss gives the
+    // sky color and a zero normal, and a surface other than glass or a metal smoother than mirror_fuzz gives its
+    // albedo and normal. Glass and mirrors pass the ray on, but leave their own normal and tint in case the path ends
+    // on them.
+    void gather_features(feature_sample & f, int bounce, const ray & r, bool hit, const hit_record & rec) const
+    {
+        static constexpr real mirror_fuzz = real(0.1);
+
+        if (f.done)
+            return;
+        if (bounce == 0 && hit)
+            f.depth = rec.t * r.direction().length();
+        if (!hit)
+        {
+            f.albedo = f.tint * background(r);
+            f.done   = true;
+            return;
+        }
+
+        const material & m = *rec.mat;
+        if (m.kind == material_kind::dielectric || (m.kind == material_kind::metal && m.fuzz < mirror_fuzz))
+        {
+            if (m.kind == material_kind::metal)
+                f.tint = f.tint * m.albedo;
+            f.albedo = f.tint;
+            if (bounce == 0)
+                f.normal = rec.normal;
+            return;
+        }
+        f.albedo = f.tint * m.albedo;
+        f.normal = rec.normal;
+        f.done   = true;
+    }
+
+    // Gradiant blue sky background
+    color background(const ray & r) const
+    {
+        vec3 u = unit_vector(r.direction()); // unit vector of our ray
+        real a = real(0.5) * (u.y() + 1);    // a is the intensity of the color
         return (1.0 - a) * color(1.0, 1.0, 1.0) + a * color(0.5, 0.7, 1.0);
     }
 
@@ -135,15 +823,15 @@ class camera
 
     vec3 pixel_sample_square() const
     {
-        auto px = -0.5 + utils::random_double();
-        auto py = -0.5 + utils::random_double();
-        return (px * pixel_delta_u) + (py * pixel_delta_v);
+        double px, py;
+        sampling::next_2d(px, py);
+        return ((px - 0.5) * pixel_delta_u) + ((py - 0.5) * pixel_delta_v);
     }
 
     // Returns a random point in the camera defocus disk.
     point3 defocus_disk_sample() const
     {
-        auto p = random_in_unit_disk();
+        auto p = sampling::random_in_unit_disk();
         return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
     }
 };
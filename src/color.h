@@ -13,6 +13,13 @@ inline double linear_to_gamma(double linear_component)
     return sqrt(linear_component);
 }
 
+// Translates one averaged, linear color component into the [0,255] value stored in 8-bit images.
+inline int to_byte(double linear_component)
+{
+    static const interval intensity(0.000, 0.999);
+    return static_cast<int>(255.999 * intensity.clamp(linear_to_gamma(linear_component)));
+}
+
 void write_color(std::ostream & out, color pixel_color, int samples_per_pixel)
 {
     double r = pixel_color.x();
@@ -25,15 +32,8 @@ void write_color(std::ostream & out, color pixel_color, int samples_per_pixel)
     g *= scale;
     b *= scale;
 
-    // Apply the linear to gamma transform.
-    r = linear_to_gamma(r);
-    g = linear_to_gamma(g);
-    b = linear_to_gamma(b);
-
-    // Write the translated [0,255] value of each color component.
-    static const interval intensity(0.000, 0.999);
-    out << static_cast<int>(255.999 * intensity.clamp(r)) << ' ' << static_cast<int>(255.999 * intensity.clamp(g))
-        << ' ' << static_cast<int>(255.999 * intensity.clamp(b)) << '\n';
+    // Write the gamma corrected, translated [0,255] value of each color component.
+    out << to_byte(r) << ' ' << to_byte(g) << ' ' << to_byte(b) << '\n';
 }
 
 #endif
\ No newline at end of file
@@ -3,8 +3,24 @@
 
 #include <limits>
 
-const double infinity = std::numeric_limits<double>::infinity();
+// The floating point type of all geometry and colors. Build with -DRT_FLOAT for single precision, which halves the
+// size of every vector, ray and hit record at the cost of precision.
+#ifdef RT_FLOAT
+using real = float;
+#else
+using real = double;
+#endif
 
-const double pi = 3.1415926535897932385;
+const real infinity = std::numeric_limits<real>::infinity();
 
-#endif
\ No newline at end of file
+const real pi = real(3.1415926535897932385);
+
+// Hits closer than this along a ray are ignored, so a scattered ray does not find the surface it leaves again.
+// Single precision places hit points about 1e-4 off on the scene's large ground sphere, so it needs a wider margin.
+#ifdef RT_FLOAT
+const real ray_epsilon = real(0.01);
+#else
+const real ray_epsilon = 0.001;
+#endif
+
+#endif
@@ -0,0 +1,294 @@
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include "color.h"
+#include "framebuffer.h"
+#include "simd.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <vector>
+
+// The filter works on rows of floats, DENOISE_LANES pixels per instruction (see simd.h).
+#define DENOISE_LANES SIMD_LANES
+
+// An edge-avoiding à-trous wavelet filter (Dammertz et al., "Edge-Avoiding À-Trous Wavelet Transform for fast Global
+// Illumination Filtering", 2010) that turns a render with few samples per pixel into a clean image, steered by the
+// first-hit features a camera gathers with `features` set.
+//
+// Each iteration blurs the image with a 5x5 B3-spline kernel whose taps are spread 2^k pixels apart at iteration k,
+// so four iterations cover a 61 pixel wide footprint for the cost of 100 taps per pixel. A tap's weight falls off
+// with how much its normal and depth differ from the center pixel's, which keeps the blur from crossing the edges of
+// objects, and with how much its lighting does, measured against the noise of the center pixel as its samples'
+// spread estimates it (as in SVGF, Schied et al. 2017), which keeps shadows and reflections that stand out from the
+// noise. Each iteration also works out the variance its blur leaves, so later ones blur less. The color is divided
+// by the albedo before filtering and multiplied back after, so only the lighting is blurred and the colors of small
+// objects stay sharp.
+//
+// Rows are split into bands that run on a thread pool, and each row is filtered DENOISE_LANES pixels at a time.
+namespace denoise
+{
+
+struct settings
+{
+    int      iterations      = 4;     // levels of the wavelet, 1 to 8
+    float    sigma_luminance = 4;     // how far lighting may differ, in standard deviations of the center's noise
+    float    sigma_normal    = 0.3f;  // how far two normals may differ, as the length of their difference
+    float    sigma_depth     = 0.02f; // how far two depths may differ, relative to the center's depth and tap spacing
+    unsigned thread_count    = 0;     // 0 uses every hardware thread
+};
+
+// The features a camera gathers alongside the image.
+enum class feature
+{
+    albedo,
+    normal,
+    depth,
+};
+
+using simd::load;
+using simd::pack;
+using simd::splat;
+using simd::store;
+
+// e^x for x <= 0, to about 1e-5 relative: 2^(x log2 e) split into 2^n, built straight from the exponent bits, times
+// 2^f for the remainder f in [-1/2, 1/2], from its Taylor series. Results below 2^-126 flush to about that.
+inline pack exp_negative(pack x)
+{
+    pack y = max(x * splat(1.44269504f), splat(-126.0f));
+    pack pow2;
+    pack f = y - round_nearest(y, pow2);
+    pack p = splat(0.00961813f);
+    p       = p * f + splat(0.05550411f);
+    p       = p * f + splat(0.24022651f);
+    p       = p * f + splat(0.69314718f);
+    p       = p * f + splat(1.0f);
+    return p * pow2;
+}
+
+// Planes of floats, one per channel, each row padded on both sides so that taps past the left and right edges read
+// the edge pixel without a bounds check. Rows past the top and bottom are clamped by the filter instead.
+struct planes
+{
+    int                width = 0, height = 0;
+    int                pad    = 0; // pixels of padding on each side
+    int                stride = 0; // floats per row
+    std::vector<float> data;
+
+    planes(int channel_count, int _width, int _height, int _pad)
+        : width(_width), height(_height), pad(_pad),
+          stride(_pad + (_width + DENOISE_LANES - 1) / DENOISE_LANES * DENOISE_LANES + _pad),
+          data(size_t(channel_count) * stride * _height)
+    {
+    }
+
+    // The first pixel of row j of `channel`.
+    float * row(int channel, int j)
+    {
+        return &data[(size_t(channel) * height + j) * stride + pad];
+    }
+
+    const float * row(int channel, int j) const
+    {
+        return &data[(size_t(channel) * height + j) * stride + pad];
+    }
+
+    // Copies the edge pixels of row j into its padding.
+    void fill_padding(int channel_count, int j)
+    {
+        for (int c = 0; c < channel_count; ++c)
+        {
+            float * r = row(c, j);
+            std::fill(r - pad, r, r[0]);
+            std::fill(r + width, r - pad + stride, r[width - 1]);
+        }
+    }
+};
+
+// The channels of the planes the filter reads and writes: the lighting and the variance of its luminance.
+constexpr int lighting_channels = 4;
+
+// The channels of the guide planes: the normal (0-2) and the depth (3).
+constexpr int guide_channels = 4;
+
+inline pack luminance(const pack c[3])
+{
+    return splat(0.2126f) * c[0] + splat(0.7152f) * c[1] + splat(0.0722f) * c[2];
+}
+
+// One level of the filter for rows [j0, j1): every pixel of `out` is the weighted mean of 25 pixels of `in`, `step`
+// pixels apart, and its variance follows from theirs.
+inline void filter_rows(const planes & in, const planes & guide, planes & out, int step, const settings & options,
+    int j0, int j1)
+{
+    static const float kernel[5]  = {1.0f / 16, 4.0f / 16, 6.0f / 16, 4.0f / 16, 1.0f / 16};
+    static const float kernel3[3] = {1.0f / 4, 2.0f / 4, 1.0f / 4};
+
+    pack sigma_luminance = splat(options.sigma_luminance);
+    pack inv_normal      = splat(1 / (options.sigma_normal * options.sigma_normal));
+    pack depth_unit      = splat(options.sigma_depth * step);
+    pack tiny            = splat(1e-4f);
+
+    for (int j = j0; j < j1; ++j)
+    {
+        // The rows each vertical tap reads, clamped to the image.
+        int tap_rows[5];
+        for (int t = 0; t < 5; ++t)
+            tap_rows[t] = std::min(std::max(j + (t - 2) * step, 0), in.height - 1);
+
+        for (int i = 0; i < in.width; i += DENOISE_LANES)
+        {
+            pack c[3], n[3];
+            for (int k = 0; k < 3; ++k)
+            {
+                c[k] = load(in.row(k, j) + i);
+                n[k] = load(guide.row(k, j) + i);
+            }
+            // The variance behind the luminance weights is blurred over 3x3 pixels first: a few samples per pixel give
+            // a noisy estimate, and one that comes out too low would keep the noise it should remove.
+            pack variance = splat(0);
+            for (int ty = -1; ty <= 1; ++ty)
+            {
+                const float * v = in.row(3, std::min(std::max(j + ty, 0), in.height - 1)) + i;
+                for (int tx = -1; tx <= 1; ++tx)
+                    variance = variance + splat(kernel3[ty + 1] * kernel3[tx + 1]) * load(v + tx);
+            }
+            pack l             = luminance(c);
+            pack inv_luminance = splat(1) / (sigma_luminance * sqrt(variance) + tiny);
+            pack d             = load(guide.row(3, j) + i);
+            pack inv_depth     = splat(1) / max(d * depth_unit, tiny);
+
+            pack sum[3]       = {splat(0), splat(0), splat(0)};
+            pack variance_sum = splat(0);
+            pack weight_sum   = splat(0);
+            for (int ty = 0; ty < 5; ++ty)
+            {
+                int q_row = tap_rows[ty];
+                for (int tx = 0; tx < 5; ++tx)
+                {
+                    int  q = i + (tx - 2) * step;
+                    pack qc[3], normal_distance = splat(0);
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        qc[k]           = load(in.row(k, q_row) + q);
+                        pack dn         = load(guide.row(k, q_row) + q) - n[k];
+                        normal_distance = normal_distance + dn * dn;
+                    }
+                    pack distance = abs(luminance(qc) - l) * inv_luminance + normal_distance * inv_normal +
+                                    abs(load(guide.row(3, q_row) + q) - d) * inv_depth;
+
+                    pack w = splat(kernel[ty] * kernel[tx]) * exp_negative(splat(0) - distance);
+                    for (int k = 0; k < 3; ++k)
+                        sum[k] = sum[k] + w * qc[k];
+                    variance_sum = variance_sum + w * w * load(in.row(3, q_row) + q);
+                    weight_sum   = weight_sum + w;
+                }
+            }
+            // The center tap has a weight of 36/256, so the sum never vanishes.
+            pack inv_weight = splat(1) / weight_sum;
+            for (int k = 0; k < 3; ++k)
+                store(out.row(k, j) + i, sum[k] * inv_weight);
+            store(out.row(3, j) + i, variance_sum * inv_weight * inv_weight);
+        }
+        out.fill_padding(lighting_channels, j);
+    }
+}
+
+// Returns `image` filtered, with the same sample counts. The image must hold features (see
+// framebuffer::enable_features); the filter runs on `pool`.
+inline framebuffer filter(const framebuffer & image, const settings & options, thread_pool & pool)
+{
+    static constexpr int   band_rows   = 8;
+    static constexpr float albedo_bias = 1e-3f; // keeps black surfaces from dividing by zero
+
+    int width      = image.width;
+    int height     = image.height;
+    int iterations = std::min(std::max(options.iterations, 1), 8);
+    int pad        = 2 << (iterations - 1); // the widest reach of a tap
+
+    planes             guide(guide_channels, width, height, pad);
+    planes             ping(lighting_channels, width, height, pad), pong(lighting_channels, width, height, pad);
+    std::vector<color> albedos(size_t(width) * height);
+
+    auto run_bands = [&](auto && work) {
+        for (int j0 = 0; j0 < height; j0 += band_rows)
+            pool.submit([&, j0] { work(j0, std::min(j0 + band_rows, height)); });
+        pool.wait();
+    };
+
+    // The lighting is the color with the albedo divided out, and its variance is scaled to match.
+    run_bands([&](int j0, int j1) {
+        for (int j = j0; j < j1; ++j)
+        {
+            for (int i = 0; i < width; ++i)
+            {
+                color c = image.average(i, j);
+                color a = image.albedo(i, j) + color(albedo_bias, albedo_bias, albedo_bias);
+                vec3  n = image.normal(i, j);
+                for (int k = 0; k < 3; ++k)
+                {
+                    ping.row(k, j)[i]  = static_cast<float>(c[k] / a[k]);
+                    guide.row(k, j)[i] = static_cast<float>(n[k]);
+                }
+                double a_luminance = 0.2126 * a.x() + 0.7152 * a.y() + 0.0722 * a.z();
+                ping.row(3, j)[i]  = static_cast<float>(image.variance(i, j) / (a_luminance * a_luminance));
+                guide.row(3, j)[i] = static_cast<float>(image.depth(i, j));
+
+                albedos[size_t(j) * width + i] = a;
+            }
+            ping.fill_padding(lighting_channels, j);
+            guide.fill_padding(guide_channels, j);
+        }
+    });
+
+    planes * in  = &ping;
+    planes * out = &pong;
+    for (int k = 0; k < iterations; ++k)
+    {
+        run_bands([&](int j0, int j1) { filter_rows(*in, guide, *out, 1 << k, options, j0, j1); });
+        std::swap(in, out);
+    }
+
+    framebuffer result = image;
+    for (int j = 0; j < height; ++j)
+    {
+        for (int i = 0; i < width; ++i)
+        {
+            color lighting(in->row(0, j)[i], in->row(1, j)[i], in->row(2, j)[i]);
+            result.at(i, j) = lighting * albedos[size_t(j) * width + i] * image.samples(i, j);
+        }
+    }
+    return result;
+}
+
+// The same on a pool of options.thread_count threads of its own.
+inline framebuffer filter(const framebuffer & image, const settings & options)
+{
+    thread_pool pool(options.thread_count);
+    return filter(image, options, pool);
+}
+
+// One of the image's features as an image of its own, for writing out: the albedo as a color, the normal with its
+// x, y and z in the red, green and blue channels, and the depth in all three.
+inline framebuffer feature_image(const framebuffer & image, feature which)
+{
+    framebuffer result(image.width, image.height);
+    for (int j = 0; j < image.height; ++j)
+    {
+        for (int i = 0; i < image.width; ++i)
+        {
+            if (which == feature::albedo)
+                result.at(i, j) = image.albedo(i, j);
+            else if (which == feature::normal)
+                result.at(i, j) = image.normal(i, j);
+            else
+                result.at(i, j) = color(1, 1, 1) * image.depth(i, j);
+            result.samples(i, j) = 1;
+        }
+    }
+    return result;
+}
+
+} // namespace denoise
+
+#endif
@@ -0,0 +1,386 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include "camera.h"
+#include "framebuffer.h"
+#include "hittable.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define DISTRIBUTED_SUPPORTED 1
+#else
+#define DISTRIBUTED_SUPPORTED 0
+#endif
+
+#include <cerrno>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+// Rendering across processes: a coordinator splits frames into tiles and hands them out one at a time to worker
+// processes, which keep the scene loaded between jobs and send each tile's pixels back. A worker asks for nothing
+// but the next tile, so a slow frame or a slow worker never holds the others up, and a single large frame is spread
+// over every worker.
+//
+// Each worker talks to the coordinator over one byte stream: it reads jobs on stdin and writes results on stdout.
+// The coordinator starts local workers as copies of its own executable, each on one end of a socket pair. Since a
+// worker needs nothing but the stream, one on another host could be driven through anything that forwards stdin and
+// stdout, such as ssh.
+//
+// Workers build the scene from the coordinator's own arguments and seed, and a pixel draws from the same RNG streams
+// whichever process renders it, so the assembled image is exactly the one a single process would render.
+namespace distributed
+{
+
+enum class message_type : uint32_t
+{
+    hello  = 1, // worker to coordinator once its scene is ready; the bounds are the whole image
+    job    = 2, // coordinator to worker: render this tile of this frame
+    result = 3, // worker to coordinator: the tile, followed by its pixels
+    quit   = 4, // coordinator to worker: no more jobs
+};
+
+// Every message starts with this header. Fields are in host byte order, as the workers are built from the same
+// sources for the same kind of machine.
+struct message
+{
+    message_type type;
+    int32_t      frame;
+    int32_t      x0, y0, x1, y1; // tile bounds, half-open on the high side
+};
+
+// One pixel of a result: the summed samples and their count, as framebuffer holds them.
+struct pixel_record
+{
+    double   rgb[3];
+    uint32_t samples;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(message) == 24 && sizeof(pixel_record) == 32, "protocol records must not contain padding");
+
+#if DISTRIBUTED_SUPPORTED
+
+inline bool read_all(int fd, void * data, size_t size)
+{
+    auto bytes = static_cast<uint8_t *>(data);
+    while (size > 0)
+    {
+        ssize_t got = ::read(fd, bytes, size);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return false;
+        bytes += got;
+        size -= static_cast<size_t>(got);
+    }
+    return true;
+}
+
+inline bool write_all(int fd, const void * data, size_t size)
+{
+    auto bytes = static_cast<const uint8_t *>(data);
+    while (size > 0)
+    {
+        ssize_t put = ::write(fd, bytes, size);
+        if (put < 0 && errno == EINTR)
+            continue;
+        if (put <= 0)
+            return false;
+        bytes += put;
+        size -= static_cast<size_t>(put);
+    }
+    return true;
+}
+
+inline size_t tile_pixels(const message & m)
+{
+    return size_t(m.x1 - m.x0) * (m.y1 - m.y0);
+}
+
+// Serves jobs read from `in` until the coordinator sends quit or closes the stream, writing results to `out`.
+// `frame_camera(frame)` gives the camera a frame is rendered with. Returns the process exit status.
+inline int run_worker(const hittable & world, const std::function<camera(int frame)> & frame_camera, int in, int out)
+{
+    camera cam           = frame_camera(0);
+    int    current_frame = 0;
+    int    width         = cam.image_width;
+    int    height        = cam.height();
+
+    message hello = {message_type::hello, 0, 0, 0, width, height};
+    if (!write_all(out, &hello, sizeof(hello)))
+        return 1;
+
+    framebuffer               scratch(width, height);
+    std::vector<pixel_record> pixels;
+    message                   job;
+    while (read_all(in, &job, sizeof(job)) && job.type == message_type::job)
+    {
+        if (job.x0 < 0 || job.y0 < 0 || job.x1 > width || job.y1 > height || job.x0 >= job.x1 || job.y0 >= job.y1)
+        {
+            std::cerr << "Worker: job tile out of the image" << std::endl;
+            return 1;
+        }
+        if (job.frame != current_frame)
+        {
+            cam           = frame_camera(job.frame);
+            current_frame = job.frame;
+        }
+
+        for (int j = job.y0; j < job.y1; ++j)
+        {
+            for (int i = job.x0; i < job.x1; ++i)
+            {
+                scratch.at(i, j)      = color(0, 0, 0);
+                scratch.samples(i, j) = 0;
+            }
+        }
+        cam.render_tile(world, {job.x0, job.y0, job.x1, job.y1}, scratch);
+
+        pixels.clear();
+        for (int j = job.y0; j < job.y1; ++j)
+        {
+            for (int i = job.x0; i < job.x1; ++i)
+            {
+                const color & c = scratch.at(i, j);
+                pixels.push_back({{c.x(), c.y(), c.z()}, static_cast<uint32_t>(scratch.samples(i, j)), 0});
+            }
+        }
+
+        message result = job;
+        result.type    = message_type::result;
+        if (!write_all(out, &result, sizeof(result)) ||
+            !write_all(out, pixels.data(), pixels.size() * sizeof(pixel_record)))
+            return 1;
+    }
+    return 0;
+}
+
+// Renders frames `first` to `last` with `worker_count` local workers, each started as `program` with `arguments`,
+// and calls `finish(frame, image)` on the coordinator's thread as each frame is completed. Frames complete roughly
+// in order, since tiles are handed out frame by frame. Jobs a worker had in hand when it died go to the others.
+// Returns false if a worker could not be started, they all died, or `finish` failed.
+inline bool run_coordinator(int worker_count, const std::string & program, const std::vector<std::string> & arguments,
+    int first, int last, camera cam, const std::function<bool(int frame, const framebuffer & image)> & finish)
+{
+    // Each worker has this many jobs queued so that it never waits for the coordinator between tiles.
+    static constexpr size_t jobs_in_flight = 2;
+
+    struct worker
+    {
+        pid_t               pid;
+        int                 fd;
+        std::deque<message> jobs; // sent and not yet answered, in the order they were sent
+        bool                alive = true;
+    };
+
+    struct pending_frame
+    {
+        framebuffer image;
+        size_t      tiles_left;
+    };
+
+    // A worker that dies mid-write must not kill the coordinator.
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<char *> argv;
+    argv.push_back(const_cast<char *>(program.c_str()));
+    for (const auto & argument : arguments)
+        argv.push_back(const_cast<char *>(argument.c_str()));
+    argv.push_back(nullptr);
+
+    std::vector<worker> workers;
+    for (int w = 0; w < worker_count; ++w)
+    {
+        int ends[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, ends) != 0)
+        {
+            std::cerr << "Could not create a socket pair for worker " << w << std::endl;
+            return false;
+        }
+        // Later workers must not inherit this one's end, or its stream would never close.
+        fcntl(ends[0], F_SETFD, FD_CLOEXEC);
+
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            dup2(ends[1], STDIN_FILENO);
+            dup2(ends[1], STDOUT_FILENO);
+            close(ends[0]);
+            close(ends[1]);
+            execvp(argv[0], argv.data());
+            std::cerr << "Could not start worker " << program << std::endl;
+            _exit(127);
+        }
+        close(ends[1]);
+        if (pid < 0)
+        {
+            close(ends[0]);
+            std::cerr << "Could not fork worker " << w << std::endl;
+            return false;
+        }
+        workers.push_back({pid, ends[0], {}});
+    }
+
+    int    width      = cam.image_width;
+    int    height     = cam.height();
+    size_t tiles_done = 0;
+
+    auto retire = [&](worker & w, std::deque<message> & queue) {
+        // Its unfinished jobs go back to the front of the queue, in their original order.
+        queue.insert(queue.begin(), w.jobs.begin(), w.jobs.end());
+        w.jobs.clear();
+        w.alive = false;
+        close(w.fd);
+        std::cerr << (tiles_done && cam.show_progress ? "\n" : "") << "Worker " << w.pid
+                  << " stopped responding, handing its tiles to the others" << std::endl;
+    };
+
+    std::deque<message> queue;
+    auto                tiles = cam.tiles();
+    for (int frame = first; frame <= last; ++frame)
+        for (const auto & t : tiles)
+            queue.push_back({message_type::job, frame, t.x0, t.y0, t.x1, t.y1});
+
+    for (auto & w : workers)
+    {
+        message hello;
+        if (!read_all(w.fd, &hello, sizeof(hello)) || hello.type != message_type::hello)
+            retire(w, queue);
+        else if (hello.x1 != width || hello.y1 != height)
+        {
+            std::cerr << "Worker " << w.pid << " renders " << hello.x1 << 'x' << hello.y1 << " images, expected "
+                      << width << 'x' << height << std::endl;
+            retire(w, queue);
+        }
+    }
+
+    std::map<int, pending_frame> frames;
+    std::vector<pixel_record>    pixels;
+    size_t                       tiles_total = queue.size();
+    bool                         ok          = true;
+
+    std::clog << "Rendering " << tiles_total << " tiles of " << last - first + 1 << " frames on " << worker_count
+              << " worker processes" << std::endl;
+
+    while (ok && tiles_done < tiles_total)
+    {
+        for (auto & w : workers)
+        {
+            while (w.alive && w.jobs.size() < jobs_in_flight && !queue.empty())
+            {
+                message job = queue.front();
+                if (!write_all(w.fd, &job, sizeof(job)))
+                {
+                    retire(w, queue);
+                    break;
+                }
+                queue.pop_front();
+                w.jobs.push_back(job);
+            }
+        }
+
+        std::vector<pollfd>   fds;
+        std::vector<worker *> polled;
+        for (auto & w : workers)
+        {
+            if (w.alive && !w.jobs.empty())
+            {
+                fds.push_back({w.fd, POLLIN, 0});
+                polled.push_back(&w);
+            }
+        }
+        if (fds.empty())
+        {
+            std::cerr << "Every worker has stopped, " << tiles_total - tiles_done << " tiles left unrendered"
+                      << std::endl;
+            ok = false;
+            break;
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "Could not wait for the workers" << std::endl;
+            ok = false;
+            break;
+        }
+
+        for (size_t k = 0; k < fds.size(); ++k)
+        {
+            if (!fds[k].revents)
+                continue;
+            worker &      w        = *polled[k];
+            const auto &  expected = w.jobs.front();
+            message       result;
+            if (!read_all(w.fd, &result, sizeof(result)) || result.type != message_type::result ||
+                result.frame != expected.frame || result.x0 != expected.x0 || result.y0 != expected.y0 ||
+                result.x1 != expected.x1 || result.y1 != expected.y1)
+            {
+                retire(w, queue);
+                continue;
+            }
+            pixels.resize(tile_pixels(result));
+            if (!read_all(w.fd, pixels.data(), pixels.size() * sizeof(pixel_record)))
+            {
+                retire(w, queue);
+                continue;
+            }
+            w.jobs.pop_front();
+
+            auto found = frames.find(result.frame);
+            if (found == frames.end())
+                found = frames.emplace(result.frame, pending_frame{framebuffer(width, height), tiles.size()}).first;
+            auto & image = found->second.image;
+            auto   pixel = pixels.begin();
+            for (int j = result.y0; j < result.y1; ++j)
+            {
+                for (int i = result.x0; i < result.x1; ++i, ++pixel)
+                {
+                    image.at(i, j)      = color(pixel->rgb[0], pixel->rgb[1], pixel->rgb[2]);
+                    image.samples(i, j) = static_cast<int>(pixel->samples);
+                }
+            }
+
+            ++tiles_done;
+            if (cam.show_progress)
+                std::clog << "\rTiles done: " << tiles_done << '/' << tiles_total << ' ' << std::flush;
+            if (--found->second.tiles_left == 0)
+            {
+                if (cam.show_progress)
+                    std::clog << '\n';
+                if (!finish(found->first, image))
+                    ok = false;
+                frames.erase(found);
+            }
+        }
+    }
+
+    for (auto & w : workers)
+    {
+        if (w.alive)
+        {
+            message quit = {message_type::quit, 0, 0, 0, 0, 0};
+            write_all(w.fd, &quit, sizeof(quit));
+            close(w.fd);
+        }
+    }
+    for (auto & w : workers)
+        waitpid(w.pid, nullptr, 0);
+    return ok;
+}
+
+#endif
+
+} // namespace distributed
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "color.h"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+// framebuffer holds the summed sample colors of every pixel in an image, stored row by row from the top left, along
+// with how many samples went into each pixel.
+//
+// It can also hold the summed features of each sample's first hit (the surface albedo, shading normal and distance
+// along the camera ray) that the denoiser in denoise.h steers its filter with, and the summed squared luminance of
+// the samples, from which it estimates how noisy each pixel is. They take memory only once enabled.
+class framebuffer
+{
+public:
+    int width  = 0;
+    int height = 0;
+
+    framebuffer() {}
+
+    framebuffer(int _width, int _height)
+        : width(_width), height(_height), pixels(size_t(_width) * _height), sample_counts(size_t(_width) * _height)
+    {
+    }
+
+    color & at(int i, int j)
+    {
+        return pixels[size_t(j) * width + i];
+    }
+
+    const color & at(int i, int j) const
+    {
+        return pixels[size_t(j) * width + i];
+    }
+
+    int & samples(int i, int j)
+    {
+        return sample_counts[size_t(j) * width + i];
+    }
+
+    int samples(int i, int j) const
+    {
+        return sample_counts[size_t(j) * width + i];
+    }
+
+    // The pixel's color averaged over its samples, still in linear space.
+    color average(int i, int j) const
+    {
+        size_t p = size_t(j) * width + i;
+        return pixels[p] * (1.0 / sample_counts[p]);
+    }
+
+    // Starts summing features, for every pixel from zero.
+    void enable_features()
+    {
+        albedo_sums.assign(pixels.size(), color(0, 0, 0));
+        normal_sums.assign(pixels.size(), vec3(0, 0, 0));
+        depth_sums.assign(pixels.size(), 0);
+        square_sums.assign(pixels.size(), 0);
+    }
+
+    bool has_features() const
+    {
+        return !albedo_sums.empty();
+    }
+
+    // Adds the features of one sample of pixel (i, j), whose color is `sample`. A camera ray that misses adds the
+    // background as its albedo, a zero normal and a depth of zero.
+    void add_features(int i, int j, const color & sample, const color & albedo, const vec3 & normal, real depth)
+    {
+        size_t p         = size_t(j) * width + i;
+        double luminance = 0.2126 * sample.x() + 0.7152 * sample.y() + 0.0722 * sample.z();
+        albedo_sums[p] += albedo;
+        normal_sums[p] += normal;
+        depth_sums[p] += depth;
+        square_sums[p] += luminance * luminance;
+    }
+
+    // The features averaged over the pixel's samples. Averaged normals are shorter than unit length where a pixel
+    // straddles an edge.
+    color albedo(int i, int j) const
+    {
+        size_t p = size_t(j) * width + i;
+        return albedo_sums[p] * (1.0 / sample_counts[p]);
+    }
+
+    vec3 normal(int i, int j) const
+    {
+        size_t p = size_t(j) * width + i;
+        return normal_sums[p] * (1.0 / sample_counts[p]);
+    }
+
+    real depth(int i, int j) const
+    {
+        size_t p = size_t(j) * width + i;
+        return depth_sums[p] / sample_counts[p];
+    }
+
+    // The variance of the pixel's mean luminance, estimated from its samples' spread.
+    double variance(int i, int j) const
+    {
+        size_t p    = size_t(j) * width + i;
+        int    n    = sample_counts[p];
+        double mean = 0.2126 * pixels[p].x() + 0.7152 * pixels[p].y() + 0.0722 * pixels[p].z();
+        mean /= n;
+        return std::max(0.0, square_sums[p] - n * mean * mean) / (std::max(n - 1, 1) * double(n));
+    }
+
+    // Writes the whole image as a plain PPM, averaging each pixel over its own sample count.
+    void write_ppm(std::ostream & out) const
+    {
+        out << "P3\n" << width << ' ' << height << "\n255\n";
+        for (size_t p = 0; p < pixels.size(); ++p)
+            write_color(out, pixels[p], sample_counts[p]);
+    }
+
+private:
+    std::vector<color>  pixels;
+    std::vector<int>    sample_counts;
+    std::vector<color>  albedo_sums; // the features, empty until enable_features()
+    std::vector<vec3>   normal_sums;
+    std::vector<real>   depth_sums;
+    std::vector<double> square_sums;
+};
+
+#endif
@@ -1,21 +1,25 @@
 #ifndef HITTABLE_H
 #define HITTABLE_H
 
+#include "aabb.h"
 #include "interval.h"
 #include "ray.h"
+#include "ray_stream.h"
 
-#include <memory>
+#include <cstdint>
 
 class material;
 
+// What a ray hit. Records are filled and copied for every candidate hit during traversal, so the material is a
+// plain observer pointer: the objects of the scene own their materials and outlive every render.
 class hit_record
 {
 public:
-    point3                    p;
-    vec3                      normal;
-    double                    t;
-    bool                      front_face;
-    std::shared_ptr<material> mat;
+    point3           p;
+    vec3             normal;
+    real             t;
+    bool             front_face;
+    const material * mat = nullptr;
 
     // Sets the hit record normal vector.
     // NOTE: the parameter `outward_normal` is assumed to have unit length.
@@ -32,6 +36,22 @@ public:
     virtual ~hittable() = default;
 
     virtual bool hit(const ray & r, interval ray_t, hit_record & rec) const = 0;
+
+    // Intersects every ray of the stream over (t_min, rays.t_max[k]). For each ray that hits, sets hits[k], fills
+    // recs[k] and shrinks rays.t_max[k] to the hit. Acceleration structures override this to walk the rays as
+    // packets; the default traces them one at a time.
+    virtual void hit_stream(ray_stream & rays, real t_min, hit_record * recs, uint8_t * hits) const
+    {
+        for (size_t k = 0; k < rays.size(); ++k)
+        {
+            hits[k] = hit(rays.get(k), interval(t_min, rays.t_max[k]), recs[k]);
+            if (hits[k])
+                rays.t_max[k] = recs[k].t;
+        }
+    }
+
+    // Box that encloses everything this object can ever report a hit on.
+    virtual aabb bounding_box() const = 0;
 };
 
 #endif
\ No newline at end of file
@@ -1,9 +1,12 @@
 #ifndef HITTABLE_LIST_H
 #define HITTABLE_LIST_H
 
+#include "arena.h"
 #include "hittable.h"
+#include "render_stats.h"
 
 #include <memory>
+#include <utility>
 #include <vector>
 
 class hittable_list : public hittable
@@ -21,15 +24,34 @@ public:
     void clear()
     {
         objects.clear();
+        storage.reset();
+        bbox = aabb();
+    }
+
+    // Constructs a T in the list's arena and adds it. Objects made this way are packed together in creation order
+    // instead of being one heap allocation each, and the arena is freed once the list and every pointer to its
+    // objects are gone.
+    template <typename T, typename... Args>
+    std::shared_ptr<T> make(Args &&... args)
+    {
+        if (!storage)
+            storage = std::make_shared<arena>();
+        auto object = arena::share(storage, storage->create<T>(std::forward<Args>(args)...));
+        add(object);
+        return object;
     }
 
     void add(std::shared_ptr<hittable> object)
     {
         objects.push_back(object);
+        bbox = aabb(bbox, object->bounding_box());
     }
 
     bool hit(const ray & r, interval ray_t, hit_record & rec) const override
     {
+        if constexpr (render_stats::enabled)
+            render_stats::local().hit_calls++;
+
         hit_record temp_rec;
         bool       hit_anything   = false;
         auto       closest_so_far = ray_t.max;
@@ -46,6 +68,21 @@ public:
 
         return hit_anything;
     }
+
+    aabb bounding_box() const override
+    {
+        return bbox;
+    }
+
+    // Bytes held by the arena behind make(), 0 if nothing was made.
+    size_t arena_bytes() const
+    {
+        return storage ? storage->memory_bytes() : 0;
+    }
+
+private:
+    std::shared_ptr<arena> storage;
+    aabb                   bbox;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,229 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include "color.h"
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Encoders that turn a framebuffer into a complete image file in memory, so the file is written with a single
+// buffered I/O call instead of one formatted write per pixel.
+namespace image_writer
+{
+
+using bytes = std::vector<uint8_t>;
+
+inline void append(bytes & out, const std::string & text)
+{
+    out.insert(out.end(), text.begin(), text.end());
+}
+
+inline void append_u32_be(bytes & out, uint32_t value)
+{
+    out.push_back(static_cast<uint8_t>(value >> 24));
+    out.push_back(static_cast<uint8_t>(value >> 16));
+    out.push_back(static_cast<uint8_t>(value >> 8));
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+// Binary PPM (P6): 8-bit gamma corrected RGB, the same values the plain P3 output holds.
+inline bytes encode_ppm(const framebuffer & image)
+{
+    bytes out;
+    append(out, "P6\n" + std::to_string(image.width) + ' ' + std::to_string(image.height) + "\n255\n");
+    out.reserve(out.size() + size_t(image.width) * image.height * 3);
+
+    for (int j = 0; j < image.height; ++j)
+    {
+        for (int i = 0; i < image.width; ++i)
+        {
+            color c = image.average(i, j);
+            out.push_back(static_cast<uint8_t>(to_byte(c.x())));
+            out.push_back(static_cast<uint8_t>(to_byte(c.y())));
+            out.push_back(static_cast<uint8_t>(to_byte(c.z())));
+        }
+    }
+    return out;
+}
+
+// Portable float map: linear, unclamped 32-bit float RGB for HDR accumulation and post-processing. Rows are stored
+// bottom to top and the negative scale marks the floats as little endian.
+inline bytes encode_pfm(const framebuffer & image)
+{
+    bytes out;
+    append(out, "PF\n" + std::to_string(image.width) + ' ' + std::to_string(image.height) + "\n-1.0\n");
+
+    size_t header = out.size();
+    out.resize(header + size_t(image.width) * image.height * 3 * sizeof(float));
+
+    uint8_t * dst = out.data() + header;
+    for (int j = image.height - 1; j >= 0; --j)
+    {
+        for (int i = 0; i < image.width; ++i)
+        {
+            color c      = image.average(i, j);
+            float rgb[3] = {static_cast<float>(c.x()), static_cast<float>(c.y()), static_cast<float>(c.z())};
+            for (float component : rgb)
+            {
+                // store little endian whatever the host order is
+                uint32_t bits;
+                std::memcpy(&bits, &component, sizeof(bits));
+                for (int k = 0; k < 4; ++k)
+                    *dst++ = static_cast<uint8_t>(bits >> (8 * k));
+            }
+        }
+    }
+    return out;
+}
+
+inline uint32_t crc32(const uint8_t * data, size_t length, uint32_t crc = 0)
+{
+    static const auto table = [] {
+        std::vector<uint32_t> t(256);
+        for (uint32_t n = 0; n < 256; ++n)
+        {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            t[n] = c;
+        }
+        return t;
+    }();
+
+    crc = ~crc;
+    for (size_t i = 0; i < length; ++i)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+inline uint32_t adler32(const uint8_t * data, size_t length)
+{
+    uint32_t a = 1, b = 0;
+    for (size_t i = 0; i < length; ++i)
+    {
+        a = (a + data[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    return (b << 16) | a;
+}
+
+inline void append_png_chunk(bytes & out, const char * type, const bytes & data)
+{
+    append_u32_be(out, static_cast<uint32_t>(data.size()));
+    size_t type_start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    append_u32_be(out, crc32(out.data() + type_start, out.size() - type_start));
+}
+
+// PNG with 8-bit RGB pixels. The image data is a zlib stream made of stored (uncompressed) deflate blocks, which
+// every PNG reader accepts and which needs no compression library.
+inline bytes encode_png(const framebuffer & image)
+{
+    // Raw scanlines, each prefixed by filter type 0 (none).
+    bytes raw;
+    raw.reserve(size_t(image.height) * (1 + size_t(image.width) * 3));
+    for (int j = 0; j < image.height; ++j)
+    {
+        raw.push_back(0);
+        for (int i = 0; i < image.width; ++i)
+        {
+            color c = image.average(i, j);
+            raw.push_back(static_cast<uint8_t>(to_byte(c.x())));
+            raw.push_back(static_cast<uint8_t>(to_byte(c.y())));
+            raw.push_back(static_cast<uint8_t>(to_byte(c.z())));
+        }
+    }
+
+    bytes zlib = {0x78, 0x01}; // deflate, 32K window, no preset dictionary
+    zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+    size_t offset = 0;
+    do
+    {
+        size_t   block = std::min<size_t>(65535, raw.size() - offset);
+        bool     last  = offset + block == raw.size();
+        uint16_t len   = static_cast<uint16_t>(block);
+        zlib.push_back(last ? 1 : 0); // BFINAL, BTYPE 00 = stored
+        zlib.push_back(static_cast<uint8_t>(len));
+        zlib.push_back(static_cast<uint8_t>(len >> 8));
+        zlib.push_back(static_cast<uint8_t>(~len));
+        zlib.push_back(static_cast<uint8_t>(~len >> 8));
+        zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + block);
+        offset += block;
+    } while (offset < raw.size());
+    append_u32_be(zlib, adler32(raw.data(), raw.size()));
+
+    bytes header;
+    append_u32_be(header, static_cast<uint32_t>(image.width));
+    append_u32_be(header, static_cast<uint32_t>(image.height));
+    header.insert(header.end(), {8, 2, 0, 0, 0}); // 8-bit depth, truecolor, deflate, adaptive filters, no interlace
+
+    bytes out = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    append_png_chunk(out, "IHDR", header);
+    append_png_chunk(out, "IDAT", zlib);
+    append_png_chunk(out, "IEND", {});
+    return out;
+}
+
+inline bool ends_with(const std::string & text, const std::string & suffix)
+{
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// True if `path` has an extension that write() knows how to encode.
+inline bool supported(const std::string & path)
+{
+    return ends_with(path, ".ppm") || ends_with(path, ".png") || ends_with(path, ".pfm");
+}
+
+// Encodes the image in the format named by the extension of `path` (.ppm, .png or .pfm) into `data`. Returns false
+// and prints the reason if the format is unknown.
+inline bool encode(const framebuffer & image, const std::string & path, bytes & data)
+{
+    if (ends_with(path, ".ppm"))
+        data = encode_ppm(image);
+    else if (ends_with(path, ".png"))
+        data = encode_png(image);
+    else if (ends_with(path, ".pfm"))
+        data = encode_pfm(image);
+    else
+    {
+        std::cerr << "Unknown image format for " << path << ", use .ppm, .png or .pfm" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Writes `data` to `path` with one fwrite. Returns false and prints the reason if it cannot be written.
+inline bool write_file(const bytes & data, const std::string & path)
+{
+    FILE * file = std::fopen(path.c_str(), "wb");
+    if (!file)
+    {
+        std::cerr << "Could not open " << path << " for writing" << std::endl;
+        return false;
+    }
+    bool ok = std::fwrite(data.data(), 1, data.size(), file) == data.size();
+    ok      = std::fclose(file) == 0 && ok;
+    if (!ok)
+        std::cerr << "Could not write " << path << std::endl;
+    return ok;
+}
+
+// Encodes the image in the format named by the extension of `path` (.ppm, .png or .pfm) and writes it with one
+// fwrite. Returns false and prints the reason if the format is unknown or the file cannot be written.
+inline bool write(const framebuffer & image, const std::string & path)
+{
+    bytes data;
+    return encode(image, path, data) && write_file(data, path);
+}
+
+} // namespace image_writer
+
+#endif
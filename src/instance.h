@@ -0,0 +1,269 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "aabb.h"
+#include "hittable.h"
+#include "linear_bvh.h"
+#include "material.h"
+#include "render_stats.h"
+#include "sphere.h"
+#include "transform.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// Traces `r` against `prototype` placed in the world by `placement`. The ray is taken into the prototype's own space
+// rather than the prototype into the world: origin and direction go through the inverse placement, which keeps the
+// ray parameter t meaning the same point in both spaces, so `ray_t` and the hit distance need no conversion. The hit
+// point is then taken from the world ray and the normal turned back into the world.
+inline bool hit_placed(
+    const hittable & prototype, const transform & placement, const ray & r, interval ray_t, hit_record & rec)
+{
+    ray local(placement.to_object(r.origin()), placement.to_object_vector(r.direction()));
+    if (!prototype.hit(local, ray_t, rec))
+        return false;
+    rec.p      = r.at(rec.t);
+    rec.normal = placement.to_world_normal(rec.normal);
+    return true;
+}
+
+// One placed copy of a prototype, which may be a sphere, a list, a BVH or another instance. Any number of instances
+// can share one prototype, so a scene costs the memory of its distinct geometry plus a placement per copy. An
+// instance can also give its copy a material of its own in place of the prototype's.
+class instance : public hittable
+{
+public:
+    instance(std::shared_ptr<const hittable> _prototype, const transform & _placement)
+        : prototype(std::move(_prototype)), placement(_placement)
+    {
+        bbox = placement.to_world(prototype->bounding_box());
+    }
+
+    instance(std::shared_ptr<const hittable> _prototype, const transform & _placement,
+        const material_table & _materials, material_table::id _material)
+        : instance(std::move(_prototype), _placement)
+    {
+        materials = &_materials;
+        mat       = _material;
+    }
+
+    bool hit(const ray & r, interval ray_t, hit_record & rec) const override
+    {
+        if constexpr (render_stats::enabled)
+            render_stats::local().hit_calls++;
+
+        if (!hit_placed(*prototype, placement, r, ray_t, rec))
+            return false;
+        if (materials)
+            rec.mat = &(*materials)[mat];
+        return true;
+    }
+
+    aabb bounding_box() const override
+    {
+        return bbox;
+    }
+
+private:
+    std::shared_ptr<const hittable> prototype;
+    transform                       placement;
+    const material_table *          materials = nullptr; // owned by the scene, null to keep the prototype's
+    material_table::id              mat       = 0;
+    aabb                            bbox;
+};
+
+// A two-level BVH for scenes made of many copies of a few prototypes. The bottom level is whatever acceleration each
+// prototype has of its own (a linear_bvh over a list, a sphere_soup, a single sphere), built once however often it is
+// placed. The top level is a linear_bvh_tree over the placed bounds of the instances, whose leaves hold the instances
+// themselves: a placement, a prototype index and a material, 40 bytes each, stored contiguously in leaf order. Rays
+// walk the top level in world space and drop into a prototype's own space at each instance they reach.
+//
+// Instances are added with add() and the tree is built once with build(), before the first ray.
+class instance_bvh : public hittable
+{
+public:
+    static constexpr int                max_leaf_size = 4;
+    static constexpr material_table::id keep_material = std::numeric_limits<material_table::id>::max();
+
+    // `materials` is the table that instances' own materials are looked up in, if any of them have one.
+    explicit instance_bvh(const material_table * _materials = nullptr) : materials(_materials) {}
+
+    // Instances the objects of `list`: every sphere becomes a copy of one unit sphere (or of one hollow unit sphere),
+    // moved and scaled into place and given the sphere's material, and any other object is placed once as it is.
+    // The spheres' materials must all come from `_materials`.
+    instance_bvh(const hittable_list & list, const material_table & _materials) : materials(&_materials)
+    {
+        uint32_t unit   = add_prototype(std::make_shared<sphere>(point3(0, 0, 0), 1, _materials, 0));
+        uint32_t hollow = add_prototype(std::make_shared<sphere>(point3(0, 0, 0), -1, _materials, 0));
+
+        records.reserve(list.objects.size());
+        for (const auto & object : list.objects)
+        {
+            auto s = dynamic_cast<const sphere *>(object.get());
+            if (!s)
+            {
+                add(add_prototype(object), transform());
+                continue;
+            }
+            if (&s->material_source() != materials)
+                throw std::runtime_error("instance_bvh needs the spheres' materials in the table it was given");
+
+            real radius = s->signed_radius();
+            add(radius < 0 ? hollow : unit,
+                transform::translation(s->center_point()) * transform::scaling(std::fabs(radius)), s->material_id());
+        }
+        build();
+    }
+
+    // Adds a prototype and returns the index instances refer to it by.
+    uint32_t add_prototype(std::shared_ptr<const hittable> prototype)
+    {
+        prototypes.push_back(std::move(prototype));
+        return static_cast<uint32_t>(prototypes.size() - 1);
+    }
+
+    // Places a copy of prototype `prototype`, with material `material` of the table in place of its own unless it is
+    // keep_material.
+    void add(uint32_t prototype, const transform & placement, material_table::id material = keep_material)
+    {
+        records.push_back({placement, prototype, material});
+    }
+
+    void reserve(size_t count)
+    {
+        records.reserve(count);
+    }
+
+    // Builds the top level over the instances added so far.
+    void build()
+    {
+        std::vector<aabb> prototype_boxes;
+        for (const auto & prototype : prototypes)
+            prototype_boxes.push_back(prototype->bounding_box());
+
+        auto placed_box = [&](size_t i) {
+            return records[i].placement.to_world(prototype_boxes[records[i].prototype]);
+        };
+        // A whole leaf costs the SAH one test, so it fills the leaves and keeps the top level small.
+        auto order = tree.build(records.size(), placed_box, max_leaf_size, max_leaf_size);
+
+        // Put the records in leaf order in place, one cycle of the permutation at a time, rather than through a
+        // second copy of them. A slot of `order` is set to its own index once its record is in place.
+        for (size_t start = 0; start < order.size(); ++start)
+        {
+            if (order[start] == start)
+                continue;
+            instance_record held = records[start];
+            size_t          slot = start;
+            while (order[slot] != start)
+            {
+                size_t from   = order[slot];
+                records[slot] = records[from];
+                order[slot]   = static_cast<uint32_t>(slot);
+                slot          = from;
+            }
+            records[slot] = held;
+            order[slot]   = static_cast<uint32_t>(slot);
+        }
+        std::vector<uint32_t>().swap(order);
+        tree.nodes.shrink_to_fit();
+    }
+
+    bool hit(const ray & r, interval ray_t, hit_record & rec) const override
+    {
+        if constexpr (render_stats::enabled)
+            render_stats::local().hit_calls++;
+
+        return tree.traverse(r, ray_t, [&](uint32_t first, uint32_t count, interval & leaf_t) {
+            bool hit_anything = false;
+            for (uint32_t i = first; i < first + count; ++i)
+            {
+                if (hit_instance(records[i], r, leaf_t, rec))
+                {
+                    hit_anything = true;
+                    leaf_t.max   = rec.t;
+                }
+            }
+            return hit_anything;
+        });
+    }
+
+    // The top level walks the stream in packets; each instance a ray reaches traces it on its own.
+    void hit_stream(ray_stream & rays, real t_min, hit_record * recs, uint8_t * hits) const override
+    {
+        if constexpr (render_stats::enabled)
+            render_stats::local().hit_calls += rays.size();
+
+        std::fill(hits, hits + rays.size(), 0);
+        tree.traverse_stream(rays, t_min, [&](size_t k, uint32_t first, uint32_t count, interval & leaf_t) {
+            ray r = rays.get(k);
+            for (uint32_t i = first; i < first + count; ++i)
+            {
+                if (hit_instance(records[i], r, leaf_t, recs[k]))
+                {
+                    hits[k]    = 1;
+                    leaf_t.max = recs[k].t;
+                }
+            }
+        });
+    }
+
+    aabb bounding_box() const override
+    {
+        return tree.bounds();
+    }
+
+    size_t size() const
+    {
+        return records.size();
+    }
+
+    size_t prototype_count() const
+    {
+        return prototypes.size();
+    }
+
+    size_t node_count() const
+    {
+        return tree.nodes.size();
+    }
+
+    // Bytes used by the instances and the top-level nodes, not counting the prototypes.
+    size_t memory_bytes() const
+    {
+        return records.capacity() * sizeof(instance_record) + tree.nodes.capacity() * sizeof(linear_bvh_node) +
+               prototypes.capacity() * sizeof(prototypes[0]);
+    }
+
+private:
+    struct instance_record
+    {
+        transform          placement;
+        uint32_t           prototype;
+        material_table::id material;
+    };
+
+    static_assert(sizeof(instance_record) == 40, "instance_record must stay 40 bytes");
+
+    bool hit_instance(const instance_record & record, const ray & r, const interval & ray_t, hit_record & rec) const
+    {
+        if (!hit_placed(*prototypes[record.prototype], record.placement, r, ray_t, rec))
+            return false;
+        if (record.material != keep_material)
+            rec.mat = &(*materials)[record.material];
+        return true;
+    }
+
+    std::vector<std::shared_ptr<const hittable>> prototypes;
+    std::vector<instance_record>                 records; // leaf order once built
+    const material_table *                       materials;
+    linear_bvh_tree                              tree;
+};
+
+#endif
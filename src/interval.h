@@ -3,26 +3,36 @@
 
 #include "constants.h"
 
+#include <cmath>
+
 class interval
 {
 public:
-    double min, max;
+    real min, max;
 
     interval() : min(+infinity), max(-infinity) {} // Default interval is empty
 
-    interval(double _min, double _max) : min(_min), max(_max) {}
+    interval(real _min, real _max) : min(_min), max(_max) {}
+
+    // The smallest interval that holds both `a` and `b`.
+    interval(const interval & a, const interval & b) : min(std::fmin(a.min, b.min)), max(std::fmax(a.max, b.max)) {}
+
+    real size() const
+    {
+        return max - min;
+    }
 
-    bool contains(double x) const
+    bool contains(real x) const
     {
         return min <= x && x <= max;
     }
 
-    bool surrounds(double x) const
+    bool surrounds(real x) const
     {
         return min < x && x < max;
     }
 
-    double clamp(double x) const
+    real clamp(real x) const
     {
         if (x < min)
         {
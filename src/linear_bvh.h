@@ -0,0 +1,474 @@
+#ifndef LINEAR_BVH_H
+#define LINEAR_BVH_H
+
+#include "aabb.h"
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// One node of a linear_bvh, packed into 32 bytes so two nodes share a cache line.
+// The bounds are floats rounded outwards, so they never shrink the (possibly double precision) box they were made from.
+struct alignas(32) linear_bvh_node
+{
+    float    bounds_min[3];
+    uint32_t offset; // leaf: index of the first primitive, interior: index of the second child
+    float    bounds_max[3];
+    uint16_t count; // number of primitives in a leaf, 0 for interior nodes
+    uint8_t  axis;  // interior: axis along which the second child lies further out than the first
+    uint8_t  pad;
+};
+
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node must stay 32 bytes");
+
+// A BVH flattened into one array of nodes in depth-first order: the first child of a node is the next node in the
+// array and the second child is found through `offset`. The tree only stores node bounds; leaves refer to runs of a
+// primitive order returned by build(), which the owner uses to lay its primitives out contiguously in leaf order.
+// Traversal is iterative with a small fixed stack and visits the child nearer to the ray origin first, which lets the
+// hit distance cull the far child early.
+class linear_bvh_tree
+{
+public:
+    static constexpr int stack_size    = 64; // deferred far children during traversal
+    static constexpr int max_sah_depth = 32; // below this depth splits are median splits, so the depth stays bounded
+    static constexpr int packet_size   = 64; // rays walked through the tree together by traverse_stream
+
+    std::vector<linear_bvh_node> nodes; // depth-first order, root first
+
+    // Builds the tree over `boxes` and returns the order the primitives must be stored in: a leaf covers
+    // order[offset, offset + count). Leaves hold at most `max_leaf_size` primitives, and `lanes` tells the SAH how
+    // many primitives a leaf intersects at once.
+    std::vector<uint32_t> build(const std::vector<aabb> & boxes, int max_leaf_size, int lanes = 1)
+    {
+        return build(boxes.size(), [&](size_t i) { return boxes[i]; }, max_leaf_size, lanes);
+    }
+
+    // The same, with the box of primitive i given by `box_of(i)`, for owners that would rather not keep an array of
+    // boxes alongside the tree's own copy while it is built.
+    template <typename BoxOf>
+    std::vector<uint32_t> build(size_t count, BoxOf && box_of, int max_leaf_size, int lanes = 1)
+    {
+        std::vector<build_entry> entries;
+        entries.reserve(count);
+        for (size_t i = 0; i < count; ++i)
+            entries.push_back(build_entry(box_of(i), static_cast<uint32_t>(i)));
+
+        std::vector<uint32_t> order;
+        order.reserve(count);
+        nodes.clear();
+        nodes.reserve(2 * count);
+        if (!entries.empty())
+            build(entries, 0, entries.size(), 0, max_leaf_size, lanes, order);
+        return order;
+    }
+
+    // Walks the tree and calls `leaf_hit(first, count, ray_t)` for every leaf the ray reaches. The callback tests
+    // the primitives at [first, first + count) of the build order and narrows `ray_t.max` to any hit it finds.
+    template <typename LeafHit>
+    bool traverse(const ray & r, interval & ray_t, LeafHit && leaf_hit) const
+    {
+        if (nodes.empty())
+            return false;
+
+        const point3 origin          = r.origin();
+        const vec3   dir             = r.direction();
+        const real   inv_dir[3]      = {1 / dir[0], 1 / dir[1], 1 / dir[2]};
+        const bool   dir_negative[3] = {inv_dir[0] < 0, inv_dir[1] < 0, inv_dir[2] < 0};
+
+        uint32_t stack[stack_size];
+        int      stack_top     = 0;
+        uint32_t current       = 0;
+        uint64_t nodes_visited = 0;
+        bool     hit_anything  = false;
+
+        while (true)
+        {
+            const linear_bvh_node & node = nodes[current];
+            nodes_visited++;
+
+            if (node_hit(node, origin, inv_dir, ray_t))
+            {
+                if (node.count > 0)
+                {
+                    if (leaf_hit(node.offset, node.count, ray_t))
+                        hit_anything = true;
+                }
+                else if (dir_negative[node.axis])
+                {
+                    stack[stack_top++] = current + 1;
+                    current            = node.offset;
+                    continue;
+                }
+                else
+                {
+                    stack[stack_top++] = node.offset;
+                    current            = current + 1;
+                    continue;
+                }
+            }
+
+            if (stack_top == 0)
+                break;
+            current = stack[--stack_top];
+        }
+
+        auto & stats = bvh_stats::local();
+        stats.rays++;
+        stats.nodes_visited += nodes_visited;
+
+        return hit_anything;
+    }
+
+    // Traces the rays of a stream in packets of up to packet_size consecutive rays, calling
+    // `leaf_hit(k, first, count, ray_t)` for every ray k that reaches a leaf. The callback narrows `ray_t.max` like
+    // the one of traverse(), and the narrowed distance is written back to rays.t_max.
+    // A packet whose rays all point into the same octant is walked through the tree together; any other packet is
+    // too incoherent to share a traversal order, so its rays are traced one at a time.
+    template <typename LeafHit>
+    void traverse_stream(ray_stream & rays, real t_min, LeafHit && leaf_hit) const
+    {
+        if (nodes.empty())
+            return;
+
+        for (size_t first = 0; first < rays.size(); first += packet_size)
+        {
+            size_t count = std::min<size_t>(packet_size, rays.size() - first);
+            if (same_octant(rays, first, count))
+            {
+                traverse_packet(rays, first, count, t_min, leaf_hit);
+                continue;
+            }
+
+            for (size_t k = first; k < first + count; ++k)
+            {
+                interval ray_t(t_min, rays.t_max[k]);
+                traverse(rays.get(k), ray_t, [&](uint32_t leaf_first, uint32_t leaf_count, interval & leaf_t) {
+                    leaf_hit(k, leaf_first, leaf_count, leaf_t);
+                    return false;
+                });
+                rays.t_max[k] = ray_t.max;
+            }
+        }
+    }
+
+    aabb bounds() const
+    {
+        if (nodes.empty())
+            return aabb();
+        const auto & root = nodes[0];
+        return aabb(point3(root.bounds_min[0], root.bounds_min[1], root.bounds_min[2]),
+            point3(root.bounds_max[0], root.bounds_max[1], root.bounds_max[2]));
+    }
+
+private:
+    // A primitive's box in single precision, rounded outward as the nodes store it, to keep the build's working set
+    // at 28 bytes per primitive.
+    struct build_entry
+    {
+        float    lo[3], hi[3];
+        uint32_t index; // into the boxes given to build()
+
+        build_entry(const aabb & box, uint32_t _index) : index(_index)
+        {
+            for (int a = 0; a < 3; ++a)
+            {
+                lo[a] = round_down(box.axis(a).min);
+                hi[a] = round_up(box.axis(a).max);
+            }
+        }
+
+        aabb box() const
+        {
+            return aabb(interval(lo[0], hi[0]), interval(lo[1], hi[1]), interval(lo[2], hi[2]));
+        }
+    };
+
+    static bool same_octant(const ray_stream & rays, size_t first, size_t count)
+    {
+        bool x = rays.dir_x[first] < 0, y = rays.dir_y[first] < 0, z = rays.dir_z[first] < 0;
+        for (size_t k = first + 1; k < first + count; ++k)
+            if ((rays.dir_x[k] < 0) != x || (rays.dir_y[k] < 0) != y || (rays.dir_z[k] < 0) != z)
+                return false;
+        return true;
+    }
+
+    // Walks one packet through the tree. Each stack entry remembers the first ray of the packet that reached the
+    // parent; rays before it missed an ancestor and are skipped. A node is entered as soon as one ray reaches it,
+    // without testing the rest, so a coherent packet descends for little more than the cost of its first ray, and
+    // only leaves test every remaining ray. The near-first order of the shared octant is right for every ray.
+    template <typename LeafHit>
+    void traverse_packet(ray_stream & rays, size_t first, size_t count, real t_min, LeafHit & leaf_hit) const
+    {
+        struct entry
+        {
+            uint32_t node;
+            uint32_t first_active;
+        };
+
+        point3 origin[packet_size];
+        real   inv_dir[packet_size][3];
+        for (size_t k = 0; k < count; ++k)
+        {
+            origin[k]     = point3(rays.origin_x[first + k], rays.origin_y[first + k], rays.origin_z[first + k]);
+            inv_dir[k][0] = 1 / rays.dir_x[first + k];
+            inv_dir[k][1] = 1 / rays.dir_y[first + k];
+            inv_dir[k][2] = 1 / rays.dir_z[first + k];
+        }
+        const bool dir_negative[3] = {inv_dir[0][0] < 0, inv_dir[0][1] < 0, inv_dir[0][2] < 0};
+        real *     t_max           = &rays.t_max[first];
+
+        entry    stack[stack_size];
+        int      stack_top     = 0;
+        entry    current       = {0, 0};
+        uint64_t nodes_visited = 0;
+
+        while (true)
+        {
+            const linear_bvh_node & node = nodes[current.node];
+
+            uint32_t k = current.first_active;
+            while (k < count && !node_hit(node, origin[k], inv_dir[k], interval(t_min, t_max[k])))
+                ++k;
+            nodes_visited += k - current.first_active + (k < count);
+
+            if (k < count)
+            {
+                if (node.count > 0)
+                {
+                    // Ray k is known to reach the leaf; the ones after it still need their box test.
+                    for (uint32_t reached = k; k < count; ++k)
+                    {
+                        if (k > reached && !node_hit(node, origin[k], inv_dir[k], interval(t_min, t_max[k])))
+                            continue;
+                        interval ray_t(t_min, t_max[k]);
+                        leaf_hit(first + k, node.offset, node.count, ray_t);
+                        t_max[k] = ray_t.max;
+                    }
+                }
+                else if (dir_negative[node.axis])
+                {
+                    stack[stack_top++] = {current.node + 1, k};
+                    current            = {node.offset, k};
+                    continue;
+                }
+                else
+                {
+                    stack[stack_top++] = {node.offset, k};
+                    current            = {current.node + 1, k};
+                    continue;
+                }
+            }
+
+            if (stack_top == 0)
+                break;
+            current = stack[--stack_top];
+        }
+
+        auto & stats = bvh_stats::local();
+        stats.rays += count;
+        stats.nodes_visited += nodes_visited;
+    }
+
+    // Appends the subtree over entries[start, end) to `nodes` and returns the index of its root.
+    uint32_t build(std::vector<build_entry> & entries, size_t start, size_t end, int depth, int max_leaf_size,
+        int lanes, std::vector<uint32_t> & order)
+    {
+        uint32_t node_index = static_cast<uint32_t>(nodes.size());
+        nodes.emplace_back();
+
+        aabb bounds;
+        for (size_t i = start; i < end; ++i)
+            bounds = aabb(bounds, entries[i].box());
+        set_bounds(nodes[node_index], bounds);
+
+        auto   box_of = [](const build_entry & e) { return e.box(); };
+        auto   first  = entries.begin() + start;
+        auto   last   = entries.begin() + end;
+        auto   split  = first;
+        size_t span   = end - start;
+        if (span > 1)
+            split = depth < max_sah_depth ? bvh_build::sah_partition(first, last, bounds, box_of, lanes)
+                                          : bvh_build::median_partition(first, last, box_of);
+
+        if (split == first && span > static_cast<size_t>(max_leaf_size))
+            split = bvh_build::median_partition(first, last, box_of);
+
+        if (split == first)
+        {
+            nodes[node_index].offset = static_cast<uint32_t>(order.size());
+            nodes[node_index].count  = static_cast<uint16_t>(span);
+            for (size_t i = start; i < end; ++i)
+                order.push_back(entries[i].index);
+            return node_index;
+        }
+
+        // Lay the children out so the second one always lies towards +axis of the first.
+        size_t mid      = static_cast<size_t>(split - entries.begin());
+        bool   reversed = false;
+        nodes[node_index].axis = near_axis(entries, start, mid, end, reversed);
+
+        uint32_t second;
+        if (reversed)
+        {
+            build(entries, mid, end, depth + 1, max_leaf_size, lanes, order);
+            second = build(entries, start, mid, depth + 1, max_leaf_size, lanes, order);
+        }
+        else
+        {
+            build(entries, start, mid, depth + 1, max_leaf_size, lanes, order);
+            second = build(entries, mid, end, depth + 1, max_leaf_size, lanes, order);
+        }
+
+        nodes[node_index].offset = second;
+        nodes[node_index].count  = 0;
+        return node_index;
+    }
+
+    // The axis along which the centroids of [start, mid) and [mid, end) are furthest apart. `reversed` is set when
+    // [mid, end) lies on the negative side. Rays travelling towards -axis usually reach the +axis child first.
+    static uint8_t near_axis(
+        const std::vector<build_entry> & entries, size_t start, size_t mid, size_t end, bool & reversed)
+    {
+        vec3 first_sum, second_sum;
+        for (size_t i = start; i < mid; ++i)
+            first_sum += entries[i].box().centroid();
+        for (size_t i = mid; i < end; ++i)
+            second_sum += entries[i].box().centroid();
+
+        vec3    delta = second_sum / double(end - mid) - first_sum / double(mid - start);
+        uint8_t axis  = 0;
+        if (fabs(delta[1]) > fabs(delta[axis]))
+            axis = 1;
+        if (fabs(delta[2]) > fabs(delta[axis]))
+            axis = 2;
+        reversed = delta[axis] < 0;
+        return axis;
+    }
+
+    static void set_bounds(linear_bvh_node & node, const aabb & box)
+    {
+        for (int a = 0; a < 3; ++a)
+        {
+            node.bounds_min[a] = round_down(box.axis(a).min);
+            node.bounds_max[a] = round_up(box.axis(a).max);
+        }
+    }
+
+    static float round_down(double x)
+    {
+        float f = static_cast<float>(x);
+        return f > x ? std::nextafter(f, -INFINITY) : f;
+    }
+
+    static float round_up(double x)
+    {
+        float f = static_cast<float>(x);
+        return f < x ? std::nextafter(f, INFINITY) : f;
+    }
+
+    static bool node_hit(const linear_bvh_node & node, const point3 & origin, const real * inv_dir, interval ray_t)
+    {
+        for (int a = 0; a < 3; ++a)
+        {
+            real t0 = (node.bounds_min[a] - origin[a]) * inv_dir[a];
+            real t1 = (node.bounds_max[a] - origin[a]) * inv_dir[a];
+            if (inv_dir[a] < 0)
+                std::swap(t0, t1);
+            ray_t.min = t0 > ray_t.min ? t0 : ray_t.min;
+            ray_t.max = t1 < ray_t.max ? t1 : ray_t.max;
+        }
+        return ray_t.min <= ray_t.max;
+    }
+};
+
+// A hittable over the objects of a hittable_list, traced through a linear_bvh_tree. The objects are stored
+// contiguously in leaf order, so each leaf is one run of the primitive array.
+//
+// Memory footprint: 32 bytes per node plus 24 per primitive (a shared_ptr that keeps it alive and a plain pointer to
+// it in leaf order), in three contiguous arrays, where a pointer-based bvh_node spends ~112 bytes plus allocator
+// overhead per node, scattered across the heap.
+class linear_bvh : public hittable
+{
+public:
+    static constexpr int max_leaf_size = 4; // a leaf is never forced to split until it holds more than this
+
+    linear_bvh(const hittable_list & list) : objects(list.objects)
+    {
+        std::vector<aabb> boxes;
+        boxes.reserve(objects.size());
+        for (const auto & object : objects)
+            boxes.push_back(object->bounding_box());
+
+        for (uint32_t index : tree.build(boxes, max_leaf_size))
+            primitives.push_back(objects[index].get());
+    }
+
+    bool hit(const ray & r, interval ray_t, hit_record & rec) const override
+    {
+        if constexpr (render_stats::enabled)
+            render_stats::local().hit_calls++;
+
+        return tree.traverse(r, ray_t, [&](uint32_t first, uint32_t count, interval & leaf_t) {
+            bool hit_anything = false;
+            for (uint32_t i = first; i < first + count; ++i)
+            {
+                if (primitives[i]->hit(r, leaf_t, rec))
+                {
+                    hit_anything = true;
+                    leaf_t.max   = rec.t;
+                }
+            }
+            return hit_anything;
+        });
+    }
+
+    // Counts one hittable::hit call per ray in the render statistics.
+    void hit_stream(ray_stream & rays, real t_min, hit_record * recs, uint8_t * hits) const override
+    {
+        if constexpr (render_stats::enabled)
+            render_stats::local().hit_calls += rays.size();
+
+        std::fill(hits, hits + rays.size(), 0);
+        tree.traverse_stream(rays, t_min, [&](size_t k, uint32_t first, uint32_t count, interval & leaf_t) {
+            ray r = rays.get(k);
+            for (uint32_t i = first; i < first + count; ++i)
+            {
+                if (primitives[i]->hit(r, leaf_t, recs[k]))
+                {
+                    hits[k]    = 1;
+                    leaf_t.max = recs[k].t;
+                }
+            }
+        });
+    }
+
+    aabb bounding_box() const override
+    {
+        return tree.bounds();
+    }
+
+    size_t node_count() const
+    {
+        return tree.nodes.size();
+    }
+
+    // Bytes used by the node and primitive arrays, not counting the primitives themselves.
+    size_t memory_bytes() const
+    {
+        return tree.nodes.size() * sizeof(linear_bvh_node) + objects.size() * sizeof(objects[0]) +
+               primitives.size() * sizeof(const hittable *);
+    }
+
+private:
+    std::vector<std::shared_ptr<hittable>> objects;    // keeps the primitives alive
+    std::vector<const hittable *>          primitives; // leaf order
+    linear_bvh_tree                        tree;
+};
+
+#endif
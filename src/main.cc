@@ -1,220 +1,785 @@
-#include "camera.h"
-#include "color.h"
-#include "hittable_list.h"
-#include "material.h"
-#include "sphere.h"
-#include "third_party/argparse.hpp"
-
-#include <fstream>
-#include <iostream>
-#include <memory>
-#include <string>
-
-// SHOW macro prints a variable's name and then its value
-#define SHOW(a) std::clog << #a << ": " << (a) << std::endl;
-
-int main(int argc, char * argv[])
-{
-    // ========================================
-    // ARGUMENT PARSING
-    // ========================================
-
-    argparse::ArgumentParser program("raytrace");
-
-    program.add_argument("-f", "--fancy")
-        .help("sets higher samples per pixel and ray depth count")
-        .default_value(false)
-        .implicit_value(true);
-
-    program.add_argument("-r", "--randomize")
-        .help("seeds the RNG with the current time")
-        .default_value(false)
-        .implicit_value(true);
-
-    program.add_argument("-s", "--samples")
-        .help("sets the number of samples per pixel")
-        .default_value(16)
-        .metavar("INT")
-        .scan<'i', int>();
-
-    program.add_argument("-d", "--depth")
-        .help("sets maximum number of ray bounces")
-        .default_value(8)
-        .metavar("INT")
-        .scan<'i', int>();
-
-    program.add_argument("--seed")
-        .help("seeds the RNG with an unsigned integer you provide")
-        .metavar("UINT")
-        .scan<'i', unsigned int>();
-
-    program.add_argument("--fov")
-        .help("Camera's Vertical Field of View")
-        .default_value(20)
-        .metavar("INT")
-        .scan<'i', int>();
-
-    program.add_argument("--frame")
-        .help("SPECIAL: frame number to use when making animations")
-        .metavar("INT")
-        .scan<'i', int>();
-
-    try
-    {
-        program.parse_args(argc, argv);
-    }
-    catch (const std::runtime_error & err)
-    {
-        std::cerr << err.what() << std::endl;
-        std::cerr << program;
-        std::exit(1);
-    }
-
-    // ========================================
-    // RANDOM NUMBER GENERATOR SETTINGS
-    // ========================================
-
-    if (program.is_used("seed"))
-    {
-        unsigned int seed = program.get<unsigned int>("seed");
-        std::clog << "Enabled: Custom RNG seed provided: " << seed << std::endl;
-        utils::randomize(seed);
-    }
-    else if (program.is_used("randomize") && program.get<bool>("randomize"))
-    {
-        std::clog << "Enabled: Randomize the RNG seed" << std::endl;
-        utils::randomize(); // seed the randomizer with current time to get a different image each time
-    }
-
-    // ========================================
-    // SET UP THE CAMERA AND WORLD
-    // ========================================
-
-    hittable_list world; // the list of all objects in our world
-    camera        cam;   // how we view this world
-
-    // cam.image_width       = 1200;
-    cam.samples_per_pixel = 16;
-    cam.max_depth         = 8;
-    cam.vfov              = 20;
-    cam.lookfrom          = point3(13, 2, 3);
-    cam.lookat            = point3(0, 0, 0);
-    cam.vup               = vec3(0, 1, 0);
-    cam.defocus_angle     = 0.6;
-    cam.focus_dist        = 10.0;
-
-    if (program.is_used("fancy") && program.get<bool>("fancy"))
-    {
-        cam.samples_per_pixel = 128;
-        cam.max_depth         = 32;
-    }
-
-    if (program.is_used("samples"))
-        cam.samples_per_pixel = program.get<int>("samples");
-
-    if (program.is_used("depth"))
-        cam.max_depth = program.get<int>("depth");
-
-    if (program.is_used("fov"))
-        cam.vfov = program.get<int>("fov");
-
-    if (program.is_used("frame"))
-    {
-        int    frame  = program.get<int>("frame");
-        double period = 60.0;
-        double t      = 2.0 * pi * frame / period;
-        double x      = 13.0 * cos(t) + 0.1;
-        double z      = 13.0 * sin(t) + 0.1;
-        cam.lookfrom  = point3(x, 2, z);
-    }
-
-    // ========================================
-    // DEBUGGING INFO
-    // ========================================
-    // SHOW(cam.samples_per_pixel);
-    // SHOW(cam.max_depth);
-    // SHOW(cam.lookfrom);
-
-    // ========================================
-    // DEFINE THE MATERIALS AND SPHERES
-    // ========================================
-
-    // auto material_ground = std::make_shared<lambertian>(color(0.1, 0.8, 0.2)); // green
-    // auto material_center = std::make_shared<dielectric>(1.5);
-    // auto material_left   = std::make_shared<dielectric>(1.5);
-
-    // auto material_gold   = std::make_shared<metal>(color(0.8, 0.6, 0.2), 0.7);
-    // auto material_red    = std::make_shared<lambertian>(color(0.7, 0.3, 0.3));
-    // auto material_silver = std::make_shared<metal>(color(0.8, 0.8, 0.8), 0.3);
-
-    // world.add(std::make_shared<sphere>(point3(0.0, -100.5, -3.0), 100.0, material_ground)); // GROUND
-    // world.add(std::make_shared<sphere>(point3(0.0, 0.0, -1.0), 0.5, material_red));         // MIDDLE
-    // world.add(std::make_shared<sphere>(point3(-1.0, 0.0, -1.0), -0.5, material_left));      // LEFT
-    // world.add(std::make_shared<sphere>(point3(1.0, 0.0, -1.0), 0.5, material_gold));        // RIGHT
-
-    // for (int i = 0; i < 20; i++)
-    // {
-    //     double x   = utils::random_double_range(-7.0, 7.0);
-    //     double y   = utils::random_double_range(0.0, 0.0);
-    //     double z   = utils::random_double_range(-5.0, -2.0);
-    //     auto   c   = color(utils::random_double(), utils::random_double(), utils::random_double());
-    //     auto   mat = std::make_shared<lambertian>(c);
-    //     world.add(std::make_shared<sphere>(point3(x, y, z), 0.25, mat));
-    // }
-
-    // ========================================
-    // THE BOOKS VERSION OF THE WORLD
-    // ========================================
-
-    using namespace std;
-
-    auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
-    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground_material));
-
-    for (int a = -11; a < 11; a++)
-    {
-        for (int b = -11; b < 11; b++)
-        {
-            auto   choose_mat = utils::random_double();
-            point3 center(a + 0.9 * utils::random_double(), 0.2, b + 0.9 * utils::random_double());
-
-            if ((center - point3(4, 0.2, 0)).length() > 0.9)
-            {
-                shared_ptr<material> sphere_material;
-
-                if (choose_mat < 0.8)
-                {
-                    // diffuse
-                    auto albedo     = color::random() * color::random();
-                    sphere_material = make_shared<lambertian>(albedo);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-                else if (choose_mat < 0.95)
-                {
-                    // metal
-                    auto albedo     = color::random(0.5, 1);
-                    auto fuzz       = utils::random_double_range(0, 0.5);
-                    sphere_material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-                else
-                {
-                    // glass
-                    sphere_material = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-            }
-        }
-    }
-
-    auto material1 = make_shared<dielectric>(1.5);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
-
-    auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
-
-    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
-
-    cam.render(world);
+#include "bvh.h"
+#include "camera.h"
+#include "color.h"
+#include "denoise.h"
+#include "distributed.h"
+#include "hittable_list.h"
+#include "image_writer.h"
+#include "instance.h"
+#include "linear_bvh.h"
+#include "material.h"
+#include "preview.h"
+#include "render_stats.h"
+#include "sampler.h"
+#include "scene_file.h"
+#include "scenes.h"
+#include "sphere.h"
+#include "sphere_soup.h"
+#include "third_party/argparse.hpp"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// SHOW macro prints a variable's name and then its value
+#define SHOW(a) std::clog << #a << ": " << (a) << std::endl;
+
+// Camera position for frame `frame` of the animation: one orbit around the scene every 60 frames.
+point3 orbit_lookfrom(int frame)
+{
+    double period = 60.0;
+    double t      = 2.0 * pi * frame / period;
+    double x      = 13.0 * cos(t) + 0.1;
+    double z      = 13.0 * sin(t) + 0.1;
+    return point3(x, 2, z);
+}
+
+// Parses a frame range written as "A..B" into its first and last frame, both included.
+bool parse_frame_range(const std::string & text, int & first, int & last)
+{
+    size_t dots = text.find("..");
+    if (dots == std::string::npos)
+        return false;
+    try
+    {
+        size_t used = 0;
+        first       = std::stoi(text.substr(0, dots), &used);
+        if (used != dots)
+            return false;
+        std::string rest = text.substr(dots + 2);
+        last             = std::stoi(rest, &used);
+        return used == rest.size() && first <= last;
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+}
+
+// The output path of frame `frame`: `pattern` with its "%d" replaced by the frame number.
+std::string frame_path(const std::string & pattern, int frame)
+{
+    std::string path = pattern;
+    return path.replace(path.find("%d"), 2, std::to_string(frame));
+}
+
+// The arguments a worker process is started with: the coordinator's own, minus the options that only concern the
+// coordinator, plus --worker and the seed the coordinator settled on, so every worker builds the same scene.
+std::vector<std::string> worker_arguments(int argc, char * argv[])
+{
+    std::vector<std::string> arguments;
+    for (int a = 1; a < argc; ++a)
+    {
+        std::string arg = argv[a];
+        if (arg == "--workers" || arg == "--seed")
+            ++a; // and its value
+        else if (arg == "-r" || arg == "--randomize" || arg.rfind("--workers=", 0) == 0 ||
+                 arg.rfind("--seed=", 0) == 0)
+            continue;
+        else
+            arguments.push_back(arg);
+    }
+    arguments.push_back("--worker");
+    arguments.push_back("--seed");
+    arguments.push_back(std::to_string(utils::base_seed()));
+    return arguments;
+}
+
+// Writes the render statistics gathered so far to `path` as JSON, with the settings of the run that produced them.
+bool write_stats(const std::string & path, const argparse::ArgumentParser & program, const camera & cam,
+    int frame_count, double seconds)
+{
+    std::ofstream out(path);
+    if (!out)
+    {
+        std::cerr << "Could not open " << path << " for writing" << std::endl;
+        return false;
+    }
+
+    out << "{\n";
+    out << "  \"run\": {\"accel\": \"" << program.get<std::string>("accel") << "\", \"spheres\": "
+        << program.get<int>("spheres") << ", \"image_width\": " << cam.image_width << ", \"samples_per_pixel\": "
+        << cam.samples_per_pixel << ", \"max_depth\": " << cam.max_depth << ", \"roulette_depth\": "
+        << cam.roulette_depth << ", \"wavefront\": " << (cam.wavefront ? "true" : "false") << ", \"sampler\": \""
+        << sampling::name(cam.sampler) << "\", \"frames\": " << frame_count << ", \"seconds\": " << seconds << "},\n";
+    out << "  \"bvh\": {\"rays\": " << bvh_stats::total_rays << ", \"nodes_visited\": "
+        << bvh_stats::total_nodes_visited << "},\n";
+    out << "  \"counters\": ";
+    render_stats::collect().write_json(out, "  ");
+    out << "\n}\n";
+
+    if (!out)
+        std::cerr << "Could not write " << path << std::endl;
+    return static_cast<bool>(out);
+}
+
+int main(int argc, char * argv[])
+{
+    // ========================================
+    // ARGUMENT PARSING
+    // ========================================
+
+    argparse::ArgumentParser program("raytrace");
+
+    program.add_argument("-f", "--fancy")
+        .help("sets higher samples per pixel and ray depth count")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("-r", "--randomize")
+        .help("seeds the RNG with the current time")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("-s", "--samples")
+        .help("sets the number of samples per pixel")
+        .default_value(16)
+        .metavar("INT")
+        .scan<'i', int>();
+
+    program.add_argument("-d", "--depth")
+        .help("sets maximum number of ray bounces")
+        .default_value(8)
+        .metavar("INT")
+        .scan<'i', int>();
+
+    program.add_argument("--roulette-depth")
+        .help("bounces after which Russian roulette may end dim paths early, negative disables it")
+        .default_value(3)
+        .metavar("INT")
+        .scan<'i', int>();
+
+    program.add_argument("--wavefront")
+        .help("traces each tile as ray streams one bounce at a time, shading hits grouped by material")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--sampler")
+        .help("where sample positions come from: independent (random numbers), stratified (multi-jittered), sobol "
+              "(Owen-scrambled Sobol) or blue-noise (Sobol shifted per pixel by a blue-noise mask)")
+        .default_value(std::string("independent"))
+        .metavar("NAME")
+        .action([](const std::string & value) {
+            sampling::sampler_kind kind;
+            if (!sampling::parse(value, kind))
+                throw std::runtime_error("--sampler must be one of: independent, stratified, sobol, blue-noise");
+            return value;
+        });
+
+    program.add_argument("--denoise")
+        .help("gathers the albedo, normal and depth of each camera ray's first hit and filters the finished image "
+              "with an edge-avoiding wavelet denoiser guided by them, for clean images from few samples per pixel")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--features")
+        .help("writes the first-hit albedo, normal and depth averaged over each pixel to PREFIX.albedo.pfm, "
+              "PREFIX.normal.pfm and PREFIX.depth.pfm")
+        .metavar("PREFIX");
+
+    program.add_argument("--seed")
+        .help("seeds the RNG with an unsigned integer you provide")
+        .metavar("UINT")
+        .scan<'i', unsigned int>();
+
+    program.add_argument("--noise-threshold")
+        .help("adaptive sampling: stop sampling a pixel once the standard error of its displayed value is below this")
+        .metavar("FLOAT")
+        .scan<'g', double>();
+
+    program.add_argument("--time-budget")
+        .help("stop sampling after this many seconds of rendering")
+        .metavar("SECONDS")
+        .scan<'g', double>();
+
+    program.add_argument("-o", "--output")
+        .help("writes the image to a file instead of a plain PPM on stdout: .ppm (binary P6), .png or .pfm (float)")
+        .metavar("FILE")
+        .action([](const std::string & value) {
+            if (!image_writer::supported(value))
+                throw std::runtime_error("--output must end in .ppm, .png or .pfm");
+            return value;
+        });
+
+    program.add_argument("--accel")
+        .help("acceleration structure to trace against: linear, bvh (pointer tree), lbvh (flattened tree), soup "
+              "(SIMD sphere soup in a flattened tree) or instances (every sphere a placed copy of one unit sphere, "
+              "in a two-level BVH)")
+        .default_value(std::string("lbvh"))
+        .metavar("NAME")
+        .action([](const std::string & value) {
+            if (value != "linear" && value != "bvh" && value != "lbvh" && value != "soup" && value != "instances")
+                throw std::runtime_error("--accel must be one of: linear, bvh, lbvh, soup, instances");
+            return value;
+        });
+
+    program.add_argument("--spheres")
+        .help("number of small sphere slots in the book scene, more slots make smaller spheres")
+        .default_value(484)
+        .metavar("INT")
+        .scan<'i', int>();
+
+    program.add_argument("--scene")
+        .help("loads the camera, materials and spheres from a scene file (text or binary) instead of building the "
+              "book scene; without --accel its spheres go straight into a sphere soup, or into a linear BVH if it has "
+              "meshes")
+        .metavar("FILE");
+
+    program.add_argument("--export-scene")
+        .help("writes the book scene and the camera settings to FILE, in binary if it ends in .bin and as text "
+              "otherwise, then exits without rendering")
+        .metavar("FILE");
+
+    program.add_argument("--fov")
+        .help("Camera's Vertical Field of View")
+        .default_value(20)
+        .metavar("INT")
+        .scan<'i', int>();
+
+    program.add_argument("--frame")
+        .help("SPECIAL: frame number to use when making animations")
+        .metavar("INT")
+        .scan<'i', int>();
+
+    program.add_argument("--frames")
+        .help("renders the animation frames A to B (inclusive) from one scene, writing each to --output with %d "
+              "replaced by the frame number")
+        .metavar("A..B")
+        .action([](const std::string & value) {
+            int first, last;
+            if (!parse_frame_range(value, first, last))
+                throw std::runtime_error("--frames must look like 1..60");
+            return value;
+        });
+
+    program.add_argument("--frame-parallel")
+        .help("with --frames: render whole frames concurrently, one per thread, instead of one frame at a time")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--stats")
+        .help("writes render statistics (rays per bounce, intersection tests, scatter outcomes, tile times) to FILE "
+              "as JSON; needs a build with -DRT_STATS")
+        .metavar("FILE");
+
+    program.add_argument("--workers")
+        .help("renders with this many local worker processes, each keeping the scene loaded and taking tiles of every "
+              "frame as it becomes free")
+        .metavar("INT")
+        .scan<'i', int>();
+
+    program.add_argument("--worker")
+        .help("serves render jobs from a coordinator over stdin and stdout; --workers starts processes with this")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--preview")
+        .help("refines the image one sample per pixel at a time, writing it to --output as it goes, and reads camera "
+              "and material statements (as in a scene file) or quit from stdin to change the view while it runs")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--preview-interval")
+        .help("with --preview: milliseconds between snapshots")
+        .default_value(250)
+        .metavar("MS")
+        .scan<'i', int>();
+
+    program.add_argument("--preview-cache")
+        .help("with --preview: megabytes for the camera-ray hits kept so material changes skip tracing them")
+        .default_value(256)
+        .metavar("MB")
+        .scan<'i', int>();
+
+    program.add_argument("-t", "--threads")
+        .help("sets the number of render threads, 0 uses every hardware thread")
+        .default_value(0)
+        .metavar("INT")
+        .scan<'i', int>();
+
+    try
+    {
+        program.parse_args(argc, argv);
+    }
+    catch (const std::runtime_error & err)
+    {
+        std::cerr << err.what() << std::endl;
+        std::cerr << program;
+        std::exit(1);
+    }
+
+    if (program.is_used("stats") && !render_stats::enabled)
+    {
+        std::cerr << "--stats needs a build with render statistics, see scripts/build_stats.sh" << std::endl;
+        std::exit(1);
+    }
+
+    if (program.is_used("scene") && program.is_used("export-scene"))
+    {
+        std::cerr << "--scene and --export-scene cannot be used together" << std::endl;
+        std::exit(1);
+    }
+
+    if (program.is_used("frames"))
+    {
+        if (program.is_used("frame"))
+        {
+            std::cerr << "--frame and --frames cannot be used together" << std::endl;
+            std::exit(1);
+        }
+        if (!program.is_used("output") || program.get<std::string>("output").find("%d") == std::string::npos)
+        {
+            std::cerr << "--frames needs an --output pattern containing %d, such as out/third/%d.png" << std::endl;
+            std::exit(1);
+        }
+    }
+
+    if (program.is_used("features") && program.is_used("frames"))
+    {
+        std::cerr << "--features writes a single image's features and cannot be used with --frames" << std::endl;
+        std::exit(1);
+    }
+
+    if (program.is_used("threads") && program.get<int>("threads") < 0)
+    {
+        std::cerr << "--threads must be 0 or more" << std::endl;
+        std::exit(1);
+    }
+
+    if (program.get<bool>("preview"))
+    {
+        if (!program.is_used("output"))
+        {
+            std::cerr << "--preview needs an --output file (or named pipe) for its snapshots" << std::endl;
+            std::exit(1);
+        }
+        for (const char * option : {"frames", "frame-parallel", "noise-threshold", "time-budget", "wavefront",
+                 "workers", "worker", "export-scene", "denoise", "features"})
+        {
+            if (program.is_used(option))
+            {
+                std::cerr << "--" << option << " cannot be used with --preview" << std::endl;
+                std::exit(1);
+            }
+        }
+    }
+
+    bool worker = program.get<bool>("worker");
+    if (program.is_used("workers") || worker)
+    {
+        if (!DISTRIBUTED_SUPPORTED)
+        {
+            std::cerr << "--workers and --worker need a POSIX system" << std::endl;
+            std::exit(1);
+        }
+        if (program.is_used("workers") && program.get<int>("workers") < 1)
+        {
+            std::cerr << "--workers must be at least 1" << std::endl;
+            std::exit(1);
+        }
+        for (const char * option :
+            {"noise-threshold", "time-budget", "frame-parallel", "stats", "export-scene", "denoise", "features"})
+        {
+            if (program.is_used(option))
+            {
+                std::cerr << "--" << option << " cannot be used with distributed rendering" << std::endl;
+                std::exit(1);
+            }
+        }
+    }
+
+    // Workers share the coordinator's stderr, so a worker keeps its log to itself rather than interleave it with the
+    // coordinator's progress line.
+    if (worker)
+        std::clog.rdbuf(nullptr);
+
+    // ========================================
+    // RANDOM NUMBER GENERATOR SETTINGS
+    // ========================================
+
+    if (program.is_used("seed"))
+    {
+        unsigned int seed = program.get<unsigned int>("seed");
+        std::clog << "Enabled: Custom RNG seed provided: " << seed << std::endl;
+        utils::randomize(seed);
+    }
+    else if (program.is_used("randomize") && program.get<bool>("randomize"))
+    {
+        std::clog << "Enabled: Randomize the RNG seed" << std::endl;
+        utils::randomize(); // seed the randomizer with current time to get a different image each time
+    }
+
+    // ========================================
+    // SET UP THE CAMERA AND WORLD
+    // ========================================
+
+    material_table materials; // every material in our world, referred to by index
+    hittable_list  world;     // the list of all objects in our world
+    camera         cam;       // how we view this world
+
+    // cam.image_width       = 1200;
+    cam.samples_per_pixel = 16;
+    cam.max_depth         = 8;
+    book_view(cam);
+
+    // A scene file replaces these settings with its own, and the options below still override them.
+    scene_file::scene loaded;
+    if (program.is_used("scene"))
+    {
+        auto start = std::chrono::steady_clock::now();
+        if (!scene_file::load(program.get<std::string>("scene"), loaded))
+            return 1;
+        std::chrono::duration<double, std::milli> load_time = std::chrono::steady_clock::now() - start;
+        size_t triangles = 0;
+        for (const auto & mesh : loaded.meshes)
+            triangles += mesh.buffers->triangle_count();
+        std::clog << "Scene: " << loaded.material_count() << " materials, " << loaded.sphere_count() << " spheres and "
+                  << loaded.meshes.size() << " meshes (" << triangles << " triangles) loaded in " << load_time.count()
+                  << " ms" << std::endl;
+        scene_file::apply_camera(loaded.view, cam);
+    }
+
+    if (program.is_used("fancy") && program.get<bool>("fancy"))
+    {
+        cam.samples_per_pixel = 128;
+        cam.max_depth         = 32;
+    }
+
+    if (program.is_used("samples"))
+        cam.samples_per_pixel = program.get<int>("samples");
+
+    if (program.is_used("depth"))
+        cam.max_depth = program.get<int>("depth");
+
+    if (program.is_used("roulette-depth"))
+        cam.roulette_depth = program.get<int>("roulette-depth");
+
+    if (program.is_used("wavefront"))
+        cam.wavefront = program.get<bool>("wavefront");
+
+    if (program.is_used("sampler"))
+        sampling::parse(program.get<std::string>("sampler"), cam.sampler);
+
+    if (program.is_used("threads"))
+        cam.thread_count = static_cast<unsigned int>(program.get<int>("threads"));
+
+    if (program.is_used("noise-threshold"))
+    {
+        cam.noise_threshold = program.get<double>("noise-threshold");
+        if (cam.samples_per_pixel < 2)
+        {
+            std::cerr << "--noise-threshold needs at least 2 samples per pixel to estimate noise from" << std::endl;
+            return 1;
+        }
+    }
+
+    if (program.is_used("time-budget"))
+        cam.time_budget = program.get<double>("time-budget");
+
+    if (program.is_used("fov"))
+        cam.vfov = program.get<int>("fov");
+
+    if (program.is_used("frame"))
+        cam.lookfrom = orbit_lookfrom(program.get<int>("frame"));
+
+    cam.features = program.get<bool>("denoise") || program.is_used("features");
+
+    // ========================================
+    // DEBUGGING INFO
+    // ========================================
+    // SHOW(cam.samples_per_pixel);
+    // SHOW(cam.max_depth);
+    // SHOW(cam.lookfrom);
+
+    // Writes the finished image to --output, or as a plain PPM to stdout.
+    auto save = [&program](const framebuffer & image) {
+        if (!program.is_used("output"))
+        {
+            image.write_ppm(std::cout);
+            return true;
+        }
+        return image_writer::write(image, program.get<std::string>("output"));
+    };
+
+    // The stage after camera::render: filters the image with `threads` threads if --denoise asks for it.
+    auto denoised = [&program](framebuffer image, unsigned int threads) {
+        if (!program.get<bool>("denoise"))
+            return image;
+        denoise::settings options;
+        options.thread_count = threads;
+        return denoise::filter(image, options);
+    };
+
+    // ========================================
+    // DISTRIBUTED RENDERING
+    // ========================================
+
+#if DISTRIBUTED_SUPPORTED
+    // The coordinator never builds the scene: the workers each build their own and keep it between tiles.
+    if (program.is_used("workers"))
+    {
+        int first = 0, last = 0;
+        if (program.is_used("frames"))
+            parse_frame_range(program.get<std::string>("frames"), first, last);
+
+        auto start  = std::chrono::steady_clock::now();
+        auto finish = [&](int frame, const framebuffer & image) {
+            if (!program.is_used("frames"))
+                return save(image);
+            std::string path = frame_path(program.get<std::string>("output"), frame);
+            std::clog << "Frame " << frame << " written to " << path << std::endl;
+            return image_writer::write(image, path);
+        };
+        bool ok = distributed::run_coordinator(program.get<int>("workers"), argv[0], worker_arguments(argc, argv),
+            first, last, cam, finish);
+        std::chrono::duration<double> render_time = std::chrono::steady_clock::now() - start;
+        std::clog << "Render: " << last - first + 1 << " frames in " << render_time.count() << " s" << std::endl;
+        return ok ? 0 : 1;
+    }
+#endif
+
+    // ========================================
+    // DEFINE THE MATERIALS AND SPHERES
+    // ========================================
+
+    // auto material_ground = materials.add(material::lambertian(color(0.1, 0.8, 0.2))); // green
+    // auto material_center = materials.add(material::dielectric(1.5));
+    // auto material_left   = materials.add(material::dielectric(1.5));
+
+    // auto material_gold   = materials.add(material::metal(color(0.8, 0.6, 0.2), 0.7));
+    // auto material_red    = materials.add(material::lambertian(color(0.7, 0.3, 0.3)));
+    // auto material_silver = materials.add(material::metal(color(0.8, 0.8, 0.8), 0.3));
+
+    // world.add(std::make_shared<sphere>(point3(0.0, -100.5, -3.0), 100.0, materials, material_ground)); // GROUND
+    // world.add(std::make_shared<sphere>(point3(0.0, 0.0, -1.0), 0.5, materials, material_red));         // MIDDLE
+    // world.add(std::make_shared<sphere>(point3(-1.0, 0.0, -1.0), -0.5, materials, material_left));      // LEFT
+    // world.add(std::make_shared<sphere>(point3(1.0, 0.0, -1.0), 0.5, materials, material_gold));        // RIGHT
+
+    // for (int i = 0; i < 20; i++)
+    // {
+    //     double x   = utils::random_double_range(-7.0, 7.0);
+    //     double y   = utils::random_double_range(0.0, 0.0);
+    //     double z   = utils::random_double_range(-5.0, -2.0);
+    //     auto   c   = color(utils::random_double(), utils::random_double(), utils::random_double());
+    //     auto   mat = materials.add(material::lambertian(c));
+    //     world.add(std::make_shared<sphere>(point3(x, y, z), 0.25, materials, mat));
+    // }
+
+    // ========================================
+    // THE BOOKS VERSION OF THE WORLD
+    // ========================================
+
+    if (!program.is_used("scene"))
+    {
+        auto start = std::chrono::steady_clock::now();
+        book_scene(world, materials, program.get<int>("spheres"));
+        std::chrono::duration<double, std::milli> build_time = std::chrono::steady_clock::now() - start;
+        std::clog << "Scene: " << world.objects.size() << " objects (" << world.arena_bytes() << " bytes) and "
+                  << materials.size() << " materials built in " << build_time.count() << " ms" << std::endl;
+    }
+
+    if (program.is_used("export-scene"))
+    {
+        auto exported = scene_file::from_world(world, materials, cam);
+        return scene_file::write(exported, program.get<std::string>("export-scene")) ? 0 : 1;
+    }
+
+    // ========================================
+    // ACCELERATION STRUCTURE AND RENDER
+    // ========================================
+
+    std::string accel = program.get<std::string>("accel");
+    if (program.is_used("scene") && !program.is_used("accel"))
+        accel = loaded.meshes.empty() ? "soup" : "lbvh";
+    if (accel == "soup" && !loaded.meshes.empty())
+    {
+        std::cerr << "--accel soup only holds spheres, and the scene has meshes" << std::endl;
+        return 1;
+    }
+
+    std::shared_ptr<hittable> accelerated;
+
+    auto start = std::chrono::steady_clock::now();
+    if (program.is_used("scene") && accel != "soup")
+        scene_file::build_world(loaded, world, materials);
+
+    if (accel == "linear")
+    {
+        std::clog << "Acceleration: linear list of " << world.objects.size() << " objects" << std::endl;
+        accelerated = std::make_shared<hittable_list>(world);
+    }
+    else if (accel == "bvh")
+    {
+        auto bvh = std::make_shared<bvh_node>(world);
+        std::chrono::duration<double, std::milli> build_time = std::chrono::steady_clock::now() - start;
+        std::clog << "Acceleration: BVH over " << world.objects.size() << " objects, " << bvh_node::node_count()
+                  << " nodes, " << bvh->memory_bytes() << " bytes, built in " << build_time.count() << " ms"
+                  << std::endl;
+        accelerated = bvh;
+    }
+    else if (accel == "soup")
+    {
+        std::shared_ptr<sphere_soup> soup;
+        if (program.is_used("scene"))
+        {
+            soup = std::make_shared<sphere_soup>();
+            scene_file::build_soup(loaded, *soup, materials); // no sphere objects in between
+        }
+        else
+            soup = std::make_shared<sphere_soup>(world);
+        std::chrono::duration<double, std::milli> build_time = std::chrono::steady_clock::now() - start;
+        std::clog << "Acceleration: sphere soup of " << soup->size() << " spheres, " << sphere_soup::lanes
+                  << " per SIMD test, " << soup->node_count() << " nodes, " << soup->memory_bytes()
+                  << " bytes, built in " << build_time.count() << " ms" << std::endl;
+        accelerated = soup;
+    }
+    else if (accel == "instances")
+    {
+        auto instances = std::make_shared<instance_bvh>(world, materials);
+        std::chrono::duration<double, std::milli> build_time = std::chrono::steady_clock::now() - start;
+        std::clog << "Acceleration: " << instances->size() << " instances of " << instances->prototype_count()
+                  << " prototypes, " << instances->node_count() << " top-level nodes, " << instances->memory_bytes()
+                  << " bytes, built in " << build_time.count() << " ms" << std::endl;
+        accelerated = instances;
+    }
+    else
+    {
+        auto lbvh = std::make_shared<linear_bvh>(world);
+        std::chrono::duration<double, std::milli> build_time = std::chrono::steady_clock::now() - start;
+        std::clog << "Acceleration: linear BVH over " << world.objects.size() << " objects, " << lbvh->node_count()
+                  << " nodes, " << lbvh->memory_bytes() << " bytes ("
+                  << static_cast<double>(lbvh->memory_bytes()) / world.objects.size() << " per primitive), built in "
+                  << build_time.count() << " ms" << std::endl;
+        accelerated = lbvh;
+    }
+
+#if DISTRIBUTED_SUPPORTED
+    if (worker)
+    {
+        auto frame_camera = [&](int frame) {
+            camera frame_cam = cam;
+            if (program.is_used("frames"))
+                frame_cam.lookfrom = orbit_lookfrom(frame);
+            return frame_cam;
+        };
+        return distributed::run_worker(*accelerated, frame_camera, STDIN_FILENO, STDOUT_FILENO);
+    }
+#endif
+
+    if (program.get<bool>("preview"))
+    {
+        preview::settings options;
+        options.path        = program.get<std::string>("output");
+        options.interval    = program.get<int>("preview-interval") / 1000.0;
+        options.cache_bytes = size_t(std::max(0, program.get<int>("preview-cache"))) << 20;
+
+        // A sphere soup keeps copies of its materials, which have to change along with the table's.
+        auto soup         = std::dynamic_pointer_cast<sphere_soup>(accelerated);
+        auto set_material = [&](material_table::id id, const material & m) {
+            if (id >= materials.size())
+                return false;
+            if (soup)
+                soup->update_material(materials[id], m);
+            materials.set(id, m);
+            return true;
+        };
+        return preview::run(*accelerated, cam, set_material, options) ? 0 : 1;
+    }
+
+    if (program.is_used("frames"))
+    {
+        int first, last;
+        parse_frame_range(program.get<std::string>("frames"), first, last);
+        std::string pattern     = program.get<std::string>("output");
+        int         frame_count = last - first + 1;
+
+        start = std::chrono::steady_clock::now();
+        std::atomic<bool> ok{true};
+        if (program.get<bool>("frame-parallel"))
+        {
+            // Each frame renders on a single thread, so the pool keeps one whole frame per worker in flight.
+            thread_pool pool(cam.thread_count);
+            std::mutex  log_mutex;
+            std::clog << "Rendering frames " << first << " to " << last << ", " << pool.size() << " at a time"
+                      << std::endl;
+            for (int frame = first; frame <= last; ++frame)
+            {
+                pool.submit([&, frame] {
+                    camera frame_cam        = cam;
+                    frame_cam.lookfrom      = orbit_lookfrom(frame);
+                    frame_cam.thread_count  = 1;
+                    frame_cam.show_progress = false;
+                    std::string path        = frame_path(pattern, frame);
+                    if (!image_writer::write(denoised(frame_cam.render(*accelerated), 1), path))
+                        ok = false;
+                    std::lock_guard<std::mutex> lock(log_mutex);
+                    std::clog << "Frame " << frame << " written to " << path << std::endl;
+                });
+            }
+            pool.wait();
+        }
+        else
+        {
+            for (int frame = first; frame <= last; ++frame)
+            {
+                camera frame_cam   = cam;
+                frame_cam.lookfrom = orbit_lookfrom(frame);
+                std::string path   = frame_path(pattern, frame);
+                if (!image_writer::write(denoised(frame_cam.render(*accelerated), cam.thread_count), path))
+                    ok = false;
+                std::clog << "Frame " << frame << " written to " << path << std::endl;
+            }
+        }
+        std::chrono::duration<double> render_time = std::chrono::steady_clock::now() - start;
+        std::clog << "Render: " << frame_count << " frames in " << render_time.count() << " s, "
+                  << render_time.count() / frame_count << " s per frame" << std::endl;
+        if (program.is_used("stats") &&
+            !write_stats(program.get<std::string>("stats"), program, cam, frame_count, render_time.count()))
+            ok = false;
+        return ok ? 0 : 1;
+    }
+
+    start = std::chrono::steady_clock::now();
+    auto image = cam.render(*accelerated);
+    std::chrono::duration<double> render_time = std::chrono::steady_clock::now() - start;
+    std::clog << "Render: " << render_time.count() << " s" << std::endl;
+
+    double rays = static_cast<double>(bvh_stats::total_rays);
+    if (rays > 0)
+        std::clog << "BVH traversal: " << bvh_stats::total_nodes_visited / rays << " nodes visited per ray over "
+                  << bvh_stats::total_rays << " rays, " << rays / render_time.count() / 1e6 << " Mrays/s"
+                  << std::endl;
+
+    if (program.is_used("features"))
+    {
+        std::string prefix = program.get<std::string>("features");
+        for (auto which : {denoise::feature::albedo, denoise::feature::normal, denoise::feature::depth})
+        {
+            const char * name = which == denoise::feature::albedo ? ".albedo.pfm"
+                                : which == denoise::feature::normal ? ".normal.pfm"
+                                                                    : ".depth.pfm";
+            if (!image_writer::write(denoise::feature_image(image, which), prefix + name))
+                return 1;
+        }
+    }
+
+    if (program.get<bool>("denoise"))
+    {
+        start = std::chrono::steady_clock::now();
+        image = denoised(std::move(image), cam.thread_count);
+        std::chrono::duration<double, std::milli> denoise_time = std::chrono::steady_clock::now() - start;
+        std::clog << "Denoise: " << denoise_time.count() << " ms" << std::endl;
+    }
+
+    if (program.is_used("stats") &&
+        !write_stats(program.get<std::string>("stats"), program, cam, 1, render_time.count()))
+        return 1;
+    return save(image) ? 0 : 1;
 }
\ No newline at end of file
@@ -0,0 +1,131 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MAPPED_FILE_MMAP 1
+#else
+#define MAPPED_FILE_MMAP 0
+#endif
+
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A whole file opened read-only: memory-mapped where the platform has mmap, otherwise read into memory.
+class mapped_file
+{
+public:
+    mapped_file() {}
+    mapped_file(const mapped_file &)             = delete;
+    mapped_file & operator=(const mapped_file &) = delete;
+
+    mapped_file(mapped_file && other) noexcept
+    {
+        swap(other);
+    }
+
+    mapped_file & operator=(mapped_file && other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
+    ~mapped_file()
+    {
+#if MAPPED_FILE_MMAP
+        if (mapped)
+            munmap(const_cast<uint8_t *>(bytes), length);
+#endif
+    }
+
+    // Returns false and prints the reason if the file cannot be read.
+    bool open(const std::string & path)
+    {
+        *this = mapped_file();
+#if MAPPED_FILE_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            std::cerr << "Could not open " << path << std::endl;
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0)
+        {
+            ::close(fd);
+            std::cerr << "Could not read " << path << std::endl;
+            return false;
+        }
+        size_t size = static_cast<size_t>(info.st_size);
+        if (size > 0)
+        {
+            void * address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (address == MAP_FAILED)
+            {
+                ::close(fd);
+                std::cerr << "Could not map " << path << std::endl;
+                return false;
+            }
+            bytes  = static_cast<const uint8_t *>(address);
+            length = size;
+            mapped = true;
+        }
+        ::close(fd); // the mapping keeps its own reference to the file
+        return true;
+#else
+        FILE * file = std::fopen(path.c_str(), "rb");
+        if (!file)
+        {
+            std::cerr << "Could not open " << path << std::endl;
+            return false;
+        }
+        uint8_t chunk[1 << 16];
+        size_t  got;
+        while ((got = std::fread(chunk, 1, sizeof(chunk), file)) > 0)
+            contents.insert(contents.end(), chunk, chunk + got);
+        bool ok = !std::ferror(file);
+        std::fclose(file);
+        if (!ok)
+        {
+            std::cerr << "Could not read " << path << std::endl;
+            return false;
+        }
+        bytes  = contents.data();
+        length = contents.size();
+        return true;
+#endif
+    }
+
+    const uint8_t * data() const
+    {
+        return bytes;
+    }
+
+    size_t size() const
+    {
+        return length;
+    }
+
+private:
+    const uint8_t *      bytes  = nullptr;
+    size_t               length = 0;
+    bool                 mapped = false;
+    std::vector<uint8_t> contents; // the file itself when it could not be mapped
+
+    void swap(mapped_file & other) noexcept
+    {
+        std::swap(bytes, other.bytes);
+        std::swap(length, other.length);
+        std::swap(mapped, other.mapped);
+        std::swap(contents, other.contents);
+    }
+};
+
+#endif
@@ -4,24 +4,77 @@
 #include "color.h"
 #include "hittable.h"
 #include "ray.h"
+#include "sampler.h"
 #include "utils.h"
 
-class material
-{
-  public:
-    virtual ~material() = default;
+#include <cstdint>
+#include <vector>
 
-    virtual bool scatter(const ray & r_in, const hit_record & rec, color & attenuation, ray & scattered) const = 0;
+// The kinds of material a surface can have. The set is closed, so a material is a plain tagged value and every
+// scatter dispatches with a switch instead of a virtual call.
+enum class material_kind : uint8_t
+{
+    lambertian,
+    metal,
+    dielectric,
 };
 
-class lambertian : public material
+constexpr int material_kind_count = 3;
+
+// A material as one flat value: `kind` says which of the fields below it uses.
+//   lambertian: albedo
+//   metal:      albedo, fuzz
+//   dielectric: ir
+class material
 {
   public:
-    lambertian(const color & a) : albedo(a) {}
+    material_kind kind   = material_kind::lambertian;
+    color         albedo = color(0, 0, 0);
+    real          fuzz   = 0;
+    real          ir     = 1; // Index of Refraction
+
+    static material lambertian(const color & a)
+    {
+        material m;
+        m.kind   = material_kind::lambertian;
+        m.albedo = a;
+        return m;
+    }
 
-    bool scatter(const ray & r_in, const hit_record & rec, color & attenuation, ray & scattered) const override
+    static material metal(const color & a, real f)
     {
-        auto scatter_direction = rec.normal + random_unit_vector();
+        material m;
+        m.kind   = material_kind::metal;
+        m.albedo = a;
+        m.fuzz   = f < 1 ? f : 1;
+        return m;
+    }
+
+    static material dielectric(real index_of_refraction)
+    {
+        material m;
+        m.kind = material_kind::dielectric;
+        m.ir   = index_of_refraction;
+        return m;
+    }
+
+    bool scatter(const ray & r_in, const hit_record & rec, color & attenuation, ray & scattered) const
+    {
+        switch (kind)
+        {
+        case material_kind::lambertian:
+            return scatter_lambertian(r_in, rec, attenuation, scattered);
+        case material_kind::metal:
+            return scatter_metal(r_in, rec, attenuation, scattered);
+        case material_kind::dielectric:
+            return scatter_dielectric(r_in, rec, attenuation, scattered);
+        }
+        return false;
+    }
+
+    bool scatter_lambertian(const ray & r_in, const hit_record & rec, color & attenuation, ray & scattered) const
+    {
+        auto scatter_direction = rec.normal + sampling::random_unit_vector();
 
         if (scatter_direction.near_zero())
             scatter_direction = rec.normal;
@@ -31,44 +84,25 @@ class lambertian : public material
         return true;
     }
 
-  private:
-    color albedo;
-};
-
-class metal : public material
-{
-  public:
-    metal(const color & a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
-
-    bool scatter(const ray & r_in, const hit_record & rec, color & attenuation, ray & scattered) const override
+    bool scatter_metal(const ray & r_in, const hit_record & rec, color & attenuation, ray & scattered) const
     {
         vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-        scattered      = ray(rec.p, reflected + fuzz * random_unit_vector());
+        scattered      = ray(rec.p, reflected + fuzz * sampling::random_unit_vector());
         attenuation    = albedo;
         return (dot(scattered.direction(), rec.normal) > 0);
     }
 
-  private:
-    color  albedo;
-    double fuzz;
-};
-
-class dielectric : public material
-{
-  public:
-    dielectric(double index_of_refraction) : ir(index_of_refraction) {}
-
-    bool scatter(const ray & r_in, const hit_record & rec, color & attenuation, ray & scattered) const override
+    bool scatter_dielectric(const ray & r_in, const hit_record & rec, color & attenuation, ray & scattered) const
     {
-        attenuation             = color(1.0, 1.0, 1.0);
-        double refraction_ratio = rec.front_face ? (1.0 / ir) : ir;
-        vec3   unit_direction   = unit_vector(r_in.direction());
-        double cos_theta        = fmin(dot(-unit_direction, rec.normal), 1.0);
-        double sin_theta        = sqrt(1.0 - cos_theta * cos_theta);
-        bool   cannot_refract   = refraction_ratio * sin_theta > 1.0;
-        vec3   direction;
-
-        if (cannot_refract || reflectance(cos_theta, refraction_ratio) > utils::random_double())
+        attenuation           = color(1.0, 1.0, 1.0);
+        real refraction_ratio = rec.front_face ? (1 / ir) : ir;
+        vec3 unit_direction   = unit_vector(r_in.direction());
+        real cos_theta        = std::fmin(dot(-unit_direction, rec.normal), real(1));
+        real sin_theta        = std::sqrt(1 - cos_theta * cos_theta);
+        bool cannot_refract   = refraction_ratio * sin_theta > 1;
+        vec3 direction;
+
+        if (cannot_refract || reflectance(cos_theta, refraction_ratio) > sampling::next_1d())
             direction = reflect(unit_direction, rec.normal);
         else
             direction = refract(unit_direction, rec.normal, refraction_ratio);
@@ -78,15 +112,90 @@ class dielectric : public material
     }
 
   private:
-    double ir; // Index of Refraction
-
-    static double reflectance(double cosine, double ref_idx)
+    static real reflectance(real cosine, real ref_idx)
     {
         // Use Schlick's approximation for reflectance.
         auto r0 = (1 - ref_idx) / (1 + ref_idx);
         r0      = r0 * r0;
-        return r0 + (1 - r0) * pow((1 - cosine), 5);
+        return r0 + (1 - r0) * std::pow((1 - cosine), 5);
+    }
+};
+
+// Scatters a batch of `count` hits whose materials are all of kind `kind`. Entry i reads the hit at index[i] of
+// r_in and recs, and writes attenuation[i], scattered[i] and whether the ray carried on to ok[i]. The kind is switched
+// on once for the whole batch, so the loop body is one straight-line scatter, and the index list lets a caller batch
+// hits in place without copying them. Random numbers are drawn in entry order, exactly as calling material::scatter
+// on each entry would draw them. If `samples` is given, entry i draws from the sampler state samples[i].
+inline void scatter_many(material_kind kind, size_t count, const uint32_t * index, const ray * r_in,
+    const hit_record * recs, color * attenuation, ray * scattered, uint8_t * ok,
+    sampling::state * const * samples = nullptr)
+{
+    sampling::state * outer = sampling::active();
+    switch (kind)
+    {
+    case material_kind::lambertian:
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (samples)
+                sampling::bind(samples[i]);
+            const auto & rec = recs[index[i]];
+            ok[i]            = rec.mat->scatter_lambertian(r_in[index[i]], rec, attenuation[i], scattered[i]);
+        }
+        break;
+    case material_kind::metal:
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (samples)
+                sampling::bind(samples[i]);
+            const auto & rec = recs[index[i]];
+            ok[i]            = rec.mat->scatter_metal(r_in[index[i]], rec, attenuation[i], scattered[i]);
+        }
+        break;
+    case material_kind::dielectric:
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (samples)
+                sampling::bind(samples[i]);
+            const auto & rec = recs[index[i]];
+            ok[i]            = rec.mat->scatter_dielectric(r_in[index[i]], rec, attenuation[i], scattered[i]);
+        }
+        break;
+    }
+    sampling::bind(outer);
+}
+
+// The materials of a scene, stored contiguously and referred to by index. Objects keep the table and an index, and
+// only turn them into a pointer when they report a hit, so adding materials (which may move the array) is safe
+// while the scene is being built.
+class material_table
+{
+  public:
+    using id = uint32_t;
+
+    id add(const material & m)
+    {
+        entries.push_back(m);
+        return static_cast<id>(entries.size() - 1);
     }
+
+    const material & operator[](id index) const
+    {
+        return entries[index];
+    }
+
+    // Changes a material in place, so objects that refer to it see the new settings on their next hit.
+    void set(id index, const material & m)
+    {
+        entries[index] = m;
+    }
+
+    size_t size() const
+    {
+        return entries.size();
+    }
+
+  private:
+    std::vector<material> entries;
 };
 
-#endif
\ No newline at end of file
+#endif
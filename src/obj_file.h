@@ -0,0 +1,330 @@
+#ifndef OBJ_FILE_H
+#define OBJ_FILE_H
+
+#include "mapped_file.h"
+#include "thread_pool.h"
+#include "triangle_mesh.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+// Wavefront OBJ files, as triangle meshes. Only geometry is read:
+//
+//     v X Y Z [W]            a position
+//     vn X Y Z               a normal
+//     f V/T/N V/T/N V/T/N    a face of three or more corners, also written V, V/T and V//N; negative indices count
+//                            back from the latest vertex. Faces with more corners are split into a fan of triangles.
+//
+// Every other statement (texture coordinates, groups, materials, lines) is skipped.
+//
+// The file is memory-mapped and parsed in two passes over chunks of a few megabytes that run in parallel on a thread
+// pool. Chunks start and end at line breaks. The first pass only counts each chunk's lines, vertices, normals and
+// triangles, which tells every chunk where its values go in the mesh and what the indices before it count up to, so
+// the second pass parses numbers straight into buffers of their final size: a file of any size is read with no copy
+// in between and no memory beyond the mesh itself.
+namespace obj_file
+{
+
+constexpr size_t chunk_bytes = 4 << 20;
+
+// What a chunk holds, counted by the first pass, and where its values start in the mesh once summed up.
+struct chunk
+{
+    const char * begin;
+    const char * end;
+    size_t       lines     = 0;
+    size_t       positions = 0;
+    size_t       normals   = 0;
+    size_t       triangles = 0;
+    size_t       line_base = 0, position_base = 0, normal_base = 0, triangle_base = 0;
+    std::string  error; // the first problem the second pass found, with its line number
+};
+
+inline bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline const char * skip_space(const char * p, const char * end)
+{
+    while (p < end && is_space(*p))
+        ++p;
+    return p;
+}
+
+inline const char * line_end(const char * p, const char * end)
+{
+    auto found = static_cast<const char *>(std::memchr(p, '\n', end - p));
+    return found ? found : end;
+}
+
+// The statement keyword at p: 'v' for a position, 'n' for a normal, 'f' for a face and 0 for anything else.
+inline char statement(const char *& p, const char * end)
+{
+    p = skip_space(p, end);
+    if (p < end && *p == 'v' && p + 1 < end && is_space(p[1]))
+    {
+        p += 2;
+        return 'v';
+    }
+    if (p + 2 < end && p[0] == 'v' && p[1] == 'n' && is_space(p[2]))
+    {
+        p += 3;
+        return 'n';
+    }
+    if (p < end && *p == 'f' && p + 1 < end && is_space(p[1]))
+    {
+        p += 2;
+        return 'f';
+    }
+    return 0;
+}
+
+// Counts the corners of the face whose corners start at p.
+inline size_t face_corners(const char * p, const char * end)
+{
+    size_t corners = 0;
+    while (true)
+    {
+        p = skip_space(p, end);
+        if (p == end || *p == '#')
+            return corners;
+        ++corners;
+        while (p < end && !is_space(*p))
+            ++p;
+    }
+}
+
+inline void count(chunk & c)
+{
+    for (const char * p = c.begin; p < c.end;)
+    {
+        const char * end = line_end(p, c.end);
+        c.lines++;
+        switch (statement(p, end))
+        {
+        case 'v':
+            c.positions++;
+            break;
+        case 'n':
+            c.normals++;
+            break;
+        case 'f':
+        {
+            size_t corners = face_corners(p, end);
+            c.triangles += corners >= 3 ? corners - 2 : 0;
+            break;
+        }
+        default:
+            break;
+        }
+        p = end + 1;
+    }
+}
+
+inline bool parse_float(const char *& p, const char * end, float & value)
+{
+    p = skip_space(p, end);
+    if (p < end && *p == '+')
+        ++p;
+    auto result = std::from_chars(p, end, value);
+    if (result.ec != std::errc())
+        return false;
+    p = result.ptr;
+    return true;
+}
+
+// Reads one OBJ index and turns it into a 0-based one, given how many values came before this line. An index that
+// is left out (as the texture index of V//N) reads as `missing`.
+inline bool parse_index(const char *& p, const char * end, size_t before, uint32_t missing, uint32_t & index)
+{
+    if (p == end || is_space(*p) || *p == '/')
+    {
+        index = missing;
+        return true;
+    }
+    long long value;
+    auto      result = std::from_chars(p, end, value);
+    if (result.ec != std::errc() || value == 0)
+        return false;
+    p                  = result.ptr;
+    long long resolved = value > 0 ? value - 1 : static_cast<long long>(before) + value;
+    if (resolved < 0 || static_cast<unsigned long long>(resolved) >= before)
+        return false;
+    index = static_cast<uint32_t>(resolved);
+    return true;
+}
+
+inline void parse(chunk & c, mesh_buffers & mesh, bool normals)
+{
+    size_t   line     = c.line_base;
+    size_t   position = c.position_base;
+    size_t   normal   = c.normal_base;
+    size_t   triangle = c.triangle_base;
+    uint32_t corner[3], corner_normal[3];
+    auto     fail = [&](const char * what) { c.error = "line " + std::to_string(line) + ": " + what; };
+
+    for (const char * p = c.begin; p < c.end;)
+    {
+        const char * end = line_end(p, c.end);
+        ++line;
+        switch (statement(p, end))
+        {
+        case 'v':
+            if (!parse_float(p, end, mesh.x[position]) || !parse_float(p, end, mesh.y[position]) ||
+                !parse_float(p, end, mesh.z[position]))
+                return fail("a vertex needs X Y Z");
+            ++position;
+            break;
+        case 'n':
+            if (!parse_float(p, end, mesh.nx[normal]) || !parse_float(p, end, mesh.ny[normal]) ||
+                !parse_float(p, end, mesh.nz[normal]))
+                return fail("a normal needs X Y Z");
+            ++normal;
+            break;
+        case 'f':
+        {
+            // Corner k > 2 adds the triangle (corner 0, corner k - 1, corner k).
+            for (int k = 0;; ++k)
+            {
+                p = skip_space(p, end);
+                if (p == end || *p == '#')
+                {
+                    if (k < 3)
+                        return fail("a face needs at least three corners");
+                    break;
+                }
+                uint32_t v, texture, n = mesh_buffers::no_normal;
+                if (!parse_index(p, end, position, mesh_buffers::no_normal, v))
+                    return fail("bad or out of range vertex index");
+                if (p < end && *p == '/')
+                {
+                    ++p;
+                    size_t any = std::numeric_limits<uint32_t>::max() - 1; // texture coordinates are not kept
+                    if (!parse_index(p, end, any, 0, texture))
+                        return fail("bad texture coordinate index");
+                    if (p < end && *p == '/')
+                    {
+                        ++p;
+                        if (!parse_index(p, end, normal, mesh_buffers::no_normal, n))
+                            return fail("bad or out of range normal index");
+                    }
+                }
+                if (p < end && !is_space(*p) && *p != '#')
+                    return fail("bad face corner");
+                if (v == mesh_buffers::no_normal)
+                    return fail("a face corner needs a vertex index");
+
+                int slot = k < 3 ? k : 2;
+                if (k >= 3)
+                {
+                    corner[1]        = corner[2];
+                    corner_normal[1] = corner_normal[2];
+                }
+                corner[slot]        = v;
+                corner_normal[slot] = n;
+                if (k >= 2)
+                {
+                    std::copy(corner, corner + 3, &mesh.indices[3 * triangle]);
+                    if (normals)
+                    {
+                        bool complete = corner_normal[0] != mesh_buffers::no_normal &&
+                                        corner_normal[1] != mesh_buffers::no_normal &&
+                                        corner_normal[2] != mesh_buffers::no_normal;
+                        for (int i = 0; i < 3; ++i)
+                            mesh.normal_indices[3 * triangle + i] =
+                                complete ? corner_normal[i] : mesh_buffers::no_normal;
+                    }
+                    ++triangle;
+                }
+            }
+            break;
+        }
+        default:
+            break;
+        }
+        p = end + 1;
+    }
+}
+
+// Reads the OBJ file at `path` into `mesh`, parsing on `thread_count` threads (0 for every hardware thread). Returns
+// false and prints the reason if the file cannot be read or is malformed.
+inline bool load(const std::string & path, mesh_buffers & mesh, unsigned thread_count = 0)
+{
+    mapped_file file;
+    if (!file.open(path))
+        return false;
+
+    // Chunks of about chunk_bytes, each ending just after a line break.
+    std::vector<chunk> chunks;
+    const char *       data = reinterpret_cast<const char *>(file.data());
+    const char *       end  = data + file.size();
+    for (const char * p = data; p < end;)
+    {
+        const char * stop = end - p > static_cast<std::ptrdiff_t>(chunk_bytes) ? line_end(p + chunk_bytes, end) : end;
+        stop              = std::min(stop + 1, end);
+        chunk c;
+        c.begin = p;
+        c.end   = stop;
+        chunks.push_back(c);
+        p = stop;
+    }
+
+    thread_pool pool(thread_count);
+    for (auto & c : chunks)
+        pool.submit([&c] { count(c); });
+    pool.wait();
+
+    size_t lines = 0, positions = 0, normals = 0, triangles = 0;
+    for (auto & c : chunks)
+    {
+        c.line_base     = lines;
+        c.position_base = positions;
+        c.normal_base   = normals;
+        c.triangle_base = triangles;
+        lines += c.lines;
+        positions += c.positions;
+        normals += c.normals;
+        triangles += c.triangles;
+    }
+    if (positions >= mesh_buffers::no_normal || normals >= mesh_buffers::no_normal)
+    {
+        std::cerr << path << ": too many vertices for 32-bit indices" << std::endl;
+        return false;
+    }
+
+    mesh = mesh_buffers();
+    for (auto * column : {&mesh.x, &mesh.y, &mesh.z})
+        column->resize(positions);
+    for (auto * column : {&mesh.nx, &mesh.ny, &mesh.nz})
+        column->resize(normals);
+    mesh.indices.resize(3 * triangles);
+    if (normals > 0)
+        mesh.normal_indices.resize(3 * triangles);
+
+    for (auto & c : chunks)
+        pool.submit([&c, &mesh, normals] { parse(c, mesh, normals > 0); });
+    pool.wait();
+
+    for (const auto & c : chunks)
+    {
+        if (!c.error.empty())
+        {
+            std::cerr << path << ": " << c.error << std::endl;
+            mesh = mesh_buffers();
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace obj_file
+
+#endif
@@ -0,0 +1,302 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include "camera.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "image_writer.h"
+#include "material.h"
+#include "scene_file.h"
+#include "thread_pool.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/stat.h>
+#define PREVIEW_ATOMIC_SNAPSHOTS 1
+#else
+#define PREVIEW_ATOMIC_SNAPSHOTS 0
+#endif
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Progressive preview: the image is refined one sample per pixel at a time into a buffer that persists between
+// passes, and written out every few hundred milliseconds, so a first noisy image is on disk after a single pass
+// instead of after a whole render. Settings are changed while it runs by typing scene file statements on stdin:
+//
+//     camera vfov 25                      any camera field, as in a scene file
+//     material m3 metal 0.8 0.8 0.8 0.1   material 3 of the scene (m<index> as --export-scene names them)
+//     quit
+//
+// A change to the camera's placement or image size starts the image over. A change to a material or max_depth
+// starts it over too, but keeps the first hits of the camera rays, which only depend on the camera and the geometry:
+// the passes they were cached for are shaded again without tracing their camera rays. samples_per_pixel only sets
+// where refinement stops. Once stdin is closed the preview finishes refining and returns.
+namespace preview
+{
+
+struct settings
+{
+    std::string path;                    // an image file, or a named pipe a viewer reads snapshots from
+    double      interval    = 0.25;      // seconds between snapshots while refining
+    size_t      cache_bytes = 256 << 20; // how much the cached camera-ray hits may take
+};
+
+// What a command changes.
+enum class change
+{
+    none,
+    target,  // samples_per_pixel only
+    shading, // the image starts over; cached camera-ray hits stay valid
+    camera,  // the image starts over without them
+    quit,
+};
+
+// Lines read from stdin on a thread of their own, so the render loop never waits for input.
+struct input
+{
+    std::mutex              mutex;
+    std::deque<std::string> lines;
+    bool                    closed = false;
+};
+
+inline std::shared_ptr<input> read_stdin()
+{
+    auto shared = std::make_shared<input>();
+    std::thread([shared] {
+        std::string line;
+        while (std::getline(std::cin, line))
+        {
+            std::lock_guard<std::mutex> lock(shared->mutex);
+            shared->lines.push_back(line);
+            if (line == "quit")
+                break;
+        }
+        std::lock_guard<std::mutex> lock(shared->mutex);
+        shared->closed = true;
+    }).detach();
+    return shared;
+}
+
+// Applies one command to `cam` or, through `set_material`, to the scene. Returns what it changed, or none with a
+// message in `error`.
+inline change apply(const std::string & line, camera & cam,
+    const std::function<bool(material_table::id, const material &)> & set_material, std::string & error)
+{
+    std::istringstream in(line.substr(0, line.find('#')));
+    std::string        statement;
+    if (!(in >> statement))
+        return change::none;
+
+    auto trailing = [&] {
+        std::string extra;
+        if (in >> extra)
+            error = "unexpected '" + extra + "' at the end of the line";
+        return !error.empty();
+    };
+
+    if (statement == "quit")
+        return change::quit;
+
+    if (statement == "camera")
+    {
+        auto before = scene_file::camera_settings(cam);
+        auto after  = before;
+        error       = scene_file::parse_camera(in, after);
+        if (!error.empty() || trailing())
+            return change::none;
+        error = scene_file::check_camera(after);
+        if (!error.empty())
+            return change::none;
+        scene_file::apply_camera(after, cam);
+
+        // Every other field goes into the image size or the camera frame that init() works out. The stratified
+        // sampler sizes its patterns by samples_per_pixel, so with it a new count starts over as well.
+        bool depth_changed       = before.max_depth != after.max_depth;
+        bool spp_changed         = before.samples_per_pixel != after.samples_per_pixel;
+        before.samples_per_pixel = after.samples_per_pixel;
+        before.max_depth         = after.max_depth;
+        if (std::memcmp(&before, &after, sizeof(before)) != 0 ||
+            (spp_changed && cam.sampler == sampling::sampler_kind::stratified))
+            return change::camera;
+        return depth_changed ? change::shading : change::target;
+    }
+
+    if (statement == "material")
+    {
+        std::string                 name;
+        scene_file::material_record r;
+        error = scene_file::parse_material(in, name, r);
+        if (!error.empty() || trailing())
+            return change::none;
+
+        // Materials are known by their index, written m<index> by --export-scene.
+        std::string        digits = name.compare(0, 1, "m") == 0 ? name.substr(1) : name;
+        std::istringstream number(digits);
+        material_table::id id;
+        if (!(number >> id) || !number.eof() || !set_material(id, scene_file::to_material(r)))
+        {
+            error = "no material " + name + " in the scene";
+            return change::none;
+        }
+        return change::shading;
+    }
+
+    error = "unknown statement '" + statement + "'";
+    return change::none;
+}
+
+// Writes the image to `path` so that a reader never sees half of it: through a temporary file that replaces the
+// last snapshot in one rename, or straight into the pipe if `path` is a named pipe.
+inline bool snapshot(const framebuffer & image, const std::string & path)
+{
+    image_writer::bytes data;
+    if (!image_writer::encode(image, path, data))
+        return false;
+#if PREVIEW_ATOMIC_SNAPSHOTS
+    struct stat status;
+    if (stat(path.c_str(), &status) == 0 && S_ISFIFO(status.st_mode))
+        return image_writer::write_file(data, path);
+
+    std::string part = path + ".part";
+    if (!image_writer::write_file(data, part))
+        return false;
+    if (std::rename(part.c_str(), path.c_str()) != 0)
+    {
+        std::cerr << "Could not replace " << path << std::endl;
+        return false;
+    }
+    return true;
+#else
+    return image_writer::write_file(data, path);
+#endif
+}
+
+// Runs the preview of `world` through `cam` until stdin says quit, or closes and the image is refined to
+// samples_per_pixel. `set_material(id, m)` changes a material of the scene, returning false for an unknown id.
+// Returns false if a snapshot could not be written.
+inline bool run(const hittable & world, camera cam,
+    const std::function<bool(material_table::id, const material &)> & set_material, const settings & options)
+{
+    using clock = std::chrono::steady_clock;
+
+    bool log          = cam.show_progress;
+    cam.show_progress = false;
+
+    thread_pool pool(cam.thread_count);
+    auto        commands = read_stdin();
+
+    std::vector<std::vector<camera::primary_hit>> cache; // the camera-ray hits of passes 0, 1, ...
+    framebuffer                                   image(cam.image_width, cam.height());
+    int                                           pass          = 0;
+    bool                                          dirty         = false; // passes not written yet
+    bool                                          first_reused  = false; // pass 0 took its hits from the cache
+    bool                                          progress      = false; // a progress line is showing
+    auto                                          started       = clock::now();
+    auto                                          last_snapshot = started;
+
+    if (log)
+        std::clog << "Preview on " << pool.size() << " threads, writing " << options.path << " every "
+                  << options.interval * 1000 << " ms; type camera, material or quit statements" << std::endl;
+
+    while (true)
+    {
+        std::vector<std::string> lines;
+        bool                     closed;
+        {
+            std::lock_guard<std::mutex> lock(commands->mutex);
+            lines.assign(commands->lines.begin(), commands->lines.end());
+            commands->lines.clear();
+            closed = commands->closed;
+        }
+
+        change restart = change::none;
+        bool   quit    = false;
+        for (const auto & line : lines)
+        {
+            std::string error;
+            change      c = apply(line, cam, set_material, error);
+            if (!error.empty())
+            {
+                std::cerr << (progress ? "\n" : "") << "Preview: " << error << std::endl;
+                progress = false;
+            }
+            if (c == change::quit)
+                quit = true;
+            else if (c == change::camera || (c == change::shading && restart != change::camera))
+                restart = c;
+        }
+        if (quit)
+            break;
+        if (restart != change::none)
+        {
+            if (restart == change::camera)
+                cache.clear();
+            image   = framebuffer(cam.image_width, cam.height());
+            pass    = 0;
+            started = clock::now();
+        }
+
+        if (pass < cam.samples_per_pixel)
+        {
+            // Each pass caches its camera-ray hits while the budget lasts, and reuses them after a restart.
+            size_t                pixels = size_t(image.width) * image.height;
+            camera::primary_hit * hits   = nullptr;
+            bool                  reuse  = size_t(pass) < cache.size();
+            if (reuse)
+                hits = cache[pass].data();
+            else if (size_t(pass) == cache.size() &&
+                     (cache.size() + 1) * pixels * sizeof(camera::primary_hit) <= options.cache_bytes)
+            {
+                cache.emplace_back(pixels);
+                hits = cache.back().data();
+            }
+            cam.render_pass(pool, world, image, pass, hits, reuse);
+            if (pass == 0)
+                first_reused = reuse;
+            ++pass;
+            dirty = true;
+        }
+        else if (closed)
+            break;
+        else
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+        auto                          now     = clock::now();
+        std::chrono::duration<double> elapsed = now - last_snapshot;
+        if (dirty && (pass == 1 || pass == cam.samples_per_pixel || elapsed.count() >= options.interval))
+        {
+            if (!snapshot(image, options.path))
+                return false;
+            dirty         = false;
+            last_snapshot = now;
+            if (log && pass == 1)
+            {
+                std::chrono::duration<double, std::milli> first = now - started;
+                std::clog << (progress ? "\n" : "") << "Preview: first image in " << first.count() << " ms"
+                          << (first_reused ? ", camera-ray hits from the cache" : "") << std::endl;
+            }
+            if (log)
+                std::clog << "\rPreview: " << pass << '/' << cam.samples_per_pixel << " samples per pixel "
+                          << std::flush;
+            progress = log;
+        }
+    }
+
+    if (progress)
+        std::clog << std::endl;
+    return !dirty || snapshot(image, options.path);
+}
+
+} // namespace preview
+
+#endif
@@ -19,7 +19,7 @@ public:
         return dir;
     }
 
-    point3 at(double t) const
+    point3 at(real t) const
     {
         return orig + t * dir;
     }
@@ -0,0 +1,54 @@
+#ifndef RAY_STREAM_H
+#define RAY_STREAM_H
+
+#include "ray.h"
+#include "vec3.h"
+
+#include <vector>
+
+// A batch of rays stored as structure-of-arrays: every coordinate of the origins and directions lives in its own
+// contiguous array, so a loop that tests one box against many rays reads unit-stride memory the compiler can
+// vectorize. `t_max` holds the far end of each ray's interval and shrinks to the nearest hit during traversal.
+class ray_stream
+{
+public:
+    std::vector<real> origin_x, origin_y, origin_z;
+    std::vector<real> dir_x, dir_y, dir_z;
+    std::vector<real> t_max;
+
+    size_t size() const
+    {
+        return t_max.size();
+    }
+
+    void clear()
+    {
+        origin_x.clear();
+        origin_y.clear();
+        origin_z.clear();
+        dir_x.clear();
+        dir_y.clear();
+        dir_z.clear();
+        t_max.clear();
+    }
+
+    void push(const ray & r, real max)
+    {
+        point3 o = r.origin();
+        vec3   d = r.direction();
+        origin_x.push_back(o.x());
+        origin_y.push_back(o.y());
+        origin_z.push_back(o.z());
+        dir_x.push_back(d.x());
+        dir_y.push_back(d.y());
+        dir_z.push_back(d.z());
+        t_max.push_back(max);
+    }
+
+    ray get(size_t k) const
+    {
+        return ray(point3(origin_x[k], origin_y[k], origin_z[k]), vec3(dir_x[k], dir_y[k], dir_z[k]));
+    }
+};
+
+#endif
@@ -0,0 +1,160 @@
+#ifndef RENDER_STATS_H
+#define RENDER_STATS_H
+
+#include "material.h"
+
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Hot-path counters for regression tracking, compiled in only with -DRT_STATS.
+// Every counting site is guarded by `if constexpr (render_stats::enabled)`, so without the flag the counters are
+// never touched and the render loops compile exactly as before. With it, each thread counts into its own copy, which
+// is folded into the totals under a lock when the thread exits; the render pools are joined before a render
+// returns, so the totals are complete once it has.
+struct render_stats
+{
+#ifdef RT_STATS
+    static constexpr bool enabled = true;
+#else
+    static constexpr bool enabled = false;
+#endif
+
+    // Wall time of one tile task. `pass` is the adaptive sampling pass, always 0 for a plain render.
+    struct tile_time
+    {
+        int    pass;
+        int    x0, y0, x1, y1;
+        double seconds;
+    };
+
+    std::vector<uint64_t>  rays_by_depth;                       // rays traced, by bounce (0 for camera rays)
+    uint64_t               hit_calls                      = 0;  // hittable::hit calls, nested ones included
+    uint64_t               sphere_tests                   = 0;  // ray-sphere intersection tests
+    uint64_t               sphere_hits                    = 0;  // tests with a root inside the ray interval
+    uint64_t               triangle_tests                 = 0;  // ray-triangle intersection tests
+    uint64_t               triangle_hits                  = 0;  // tests that hit inside the ray interval
+    uint64_t               scattered[material_kind_count] = {}; // scatter calls that continued the path, by kind
+    uint64_t               absorbed[material_kind_count]  = {}; // scatter calls that returned false, by kind
+    uint64_t               escaped                        = 0;  // rays that hit nothing and saw the background
+    uint64_t               roulette_ended                 = 0;  // paths ended by Russian roulette
+    uint64_t               depth_cutoff                   = 0;  // paths still going when max_depth was reached
+    std::vector<tile_time> tiles;                               // each thread's tiles in the order it finished them
+
+    void count_rays(int bounce, uint64_t count = 1)
+    {
+        if (rays_by_depth.size() <= size_t(bounce))
+            rays_by_depth.resize(bounce + 1);
+        rays_by_depth[bounce] += count;
+    }
+
+    void merge(const render_stats & other)
+    {
+        if (rays_by_depth.size() < other.rays_by_depth.size())
+            rays_by_depth.resize(other.rays_by_depth.size());
+        for (size_t d = 0; d < other.rays_by_depth.size(); ++d)
+            rays_by_depth[d] += other.rays_by_depth[d];
+
+        hit_calls += other.hit_calls;
+        sphere_tests += other.sphere_tests;
+        sphere_hits += other.sphere_hits;
+        triangle_tests += other.triangle_tests;
+        triangle_hits += other.triangle_hits;
+        for (int k = 0; k < material_kind_count; ++k)
+        {
+            scattered[k] += other.scattered[k];
+            absorbed[k] += other.absorbed[k];
+        }
+        escaped += other.escaped;
+        roulette_ended += other.roulette_ended;
+        depth_cutoff += other.depth_cutoff;
+        tiles.insert(tiles.end(), other.tiles.begin(), other.tiles.end());
+    }
+
+    // The calling thread's counters.
+    static render_stats & local();
+
+    // The counters of every thread that has exited so far.
+    static render_stats collect()
+    {
+        std::lock_guard<std::mutex> lock(totals_mutex());
+        return totals();
+    }
+
+    // Writes the counters as one JSON object, each nested line prefixed by `indent`.
+    void write_json(std::ostream & out, const std::string & indent = "") const
+    {
+        static const char * kind_names[material_kind_count] = {"lambertian", "metal", "dielectric"};
+
+        uint64_t rays = 0;
+        for (uint64_t n : rays_by_depth)
+            rays += n;
+
+        out << "{\n";
+        out << indent << "  \"rays\": " << rays << ",\n";
+        out << indent << "  \"rays_by_depth\": [";
+        for (size_t d = 0; d < rays_by_depth.size(); ++d)
+            out << (d ? ", " : "") << rays_by_depth[d];
+        out << "],\n";
+        out << indent << "  \"hit_calls\": " << hit_calls << ",\n";
+        out << indent << "  \"sphere_tests\": " << sphere_tests << ",\n";
+        out << indent << "  \"sphere_hits\": " << sphere_hits << ",\n";
+        out << indent << "  \"triangle_tests\": " << triangle_tests << ",\n";
+        out << indent << "  \"triangle_hits\": " << triangle_hits << ",\n";
+        out << indent << "  \"scatter\": {";
+        for (int k = 0; k < material_kind_count; ++k)
+            out << (k ? ", " : "") << '"' << kind_names[k] << "\": {\"scattered\": " << scattered[k]
+                << ", \"absorbed\": " << absorbed[k] << '}';
+        out << "},\n";
+        out << indent << "  \"escaped\": " << escaped << ",\n";
+        out << indent << "  \"roulette_ended\": " << roulette_ended << ",\n";
+        out << indent << "  \"depth_cutoff\": " << depth_cutoff << ",\n";
+        out << indent << "  \"tiles\": [";
+        for (size_t t = 0; t < tiles.size(); ++t)
+        {
+            const auto & tile = tiles[t];
+            out << (t ? "," : "") << '\n'
+                << indent << "    {\"pass\": " << tile.pass << ", \"x0\": " << tile.x0 << ", \"y0\": " << tile.y0
+                << ", \"x1\": " << tile.x1 << ", \"y1\": " << tile.y1 << ", \"seconds\": " << tile.seconds << '}';
+        }
+        out << (tiles.empty() ? "" : "\n" + indent + "  ") << "]\n";
+        out << indent << '}';
+    }
+
+  private:
+    struct thread_counters;
+
+    static std::mutex & totals_mutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static render_stats & totals()
+    {
+        static render_stats stats;
+        return stats;
+    }
+};
+
+// One thread's counters, folded into the totals when the thread exits.
+struct render_stats::thread_counters
+{
+    render_stats stats;
+
+    ~thread_counters()
+    {
+        std::lock_guard<std::mutex> lock(totals_mutex());
+        totals().merge(stats);
+    }
+};
+
+inline render_stats & render_stats::local()
+{
+    thread_local thread_counters counters;
+    return counters.stats;
+}
+
+#endif
@@ -0,0 +1,438 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "constants.h"
+#include "utils.h"
+#include "vec3.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Where the random numbers of a camera sample come from. Every draw of a sample (pixel jitter, lens position, each
+// bounce's scatter direction and roulette) takes the next dimension of the pixel's sample sequence, so a sampler
+// that spreads a pixel's samples evenly over each dimension pair reaches a given noise level with fewer samples than
+// independent random numbers do.
+//
+//   independent: utils::random_double, as before samplers existed
+//   stratified:  correlated multi-jittered patterns (Kensler 2013) of samples_per_pixel points, one per dimension
+//   sobol:       shuffled, Owen-scrambled Sobol points (Burley 2020), scrambled anew for every pixel and dimension
+//   blue_noise:  one scrambled Sobol sequence shared by all pixels, each pixel's copy shifted by a blue-noise mask,
+//                so neighbouring pixels make different errors and what noise is left has no low frequencies
+//
+// The camera binds a state to its thread while it traces a sample. Code that draws with nothing bound, such as the
+// scene setup, gets independent numbers from utils::random_double.
+namespace sampling
+{
+
+enum class sampler_kind : uint8_t
+{
+    independent,
+    stratified,
+    sobol,
+    blue_noise,
+};
+
+inline const char * name(sampler_kind kind)
+{
+    switch (kind)
+    {
+    case sampler_kind::independent:
+        return "independent";
+    case sampler_kind::stratified:
+        return "stratified";
+    case sampler_kind::sobol:
+        return "sobol";
+    case sampler_kind::blue_noise:
+        return "blue-noise";
+    }
+    return "independent";
+}
+
+// Sets `kind` from its name() and returns true, or returns false for an unknown name.
+inline bool parse(const std::string & text, sampler_kind & kind)
+{
+    for (auto k : {sampler_kind::independent, sampler_kind::stratified, sampler_kind::sobol, sampler_kind::blue_noise})
+    {
+        if (text == name(k))
+        {
+            kind = k;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Integer hash with full avalanche (lowbias32 by Chris Wellons).
+inline uint32_t hash(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+inline uint32_t hash_combine(uint32_t seed, uint32_t value)
+{
+    return hash(seed ^ (value + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+}
+
+// The position of one camera sample in its pixel's sequence.
+struct state
+{
+    sampler_kind kind      = sampler_kind::independent;
+    uint32_t     x         = 0, y = 0; // pixel
+    uint32_t     index     = 0;        // which sample of the pixel this is
+    uint32_t     dimension = 0;        // draws the sample has taken so far
+    uint32_t     count     = 1;        // samples per pixel, the size of a stratified pattern
+    uint32_t     seed      = 0;        // the base seed hashed with the pixel
+
+    state() = default;
+
+    state(sampler_kind kind, uint32_t x, uint32_t y, uint32_t count)
+        : kind(kind), x(x), y(y), count(count), seed(hash_combine(hash_combine(utils::base_seed(), x), y))
+    {
+    }
+
+    // Moves on to sample `sample_index` of the pixel.
+    void start(uint32_t sample_index)
+    {
+        index     = sample_index;
+        dimension = 0;
+    }
+};
+
+inline double to_unit(uint32_t bits)
+{
+    return bits * 0x1.0p-32;
+}
+
+inline uint32_t reverse_bits(uint32_t x)
+{
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+// Owen scrambling of a 32-bit fraction by hashing (Burley 2020): applied to the bit-reversed value, the Laine-Karras
+// permutation flips each bit depending only on the bits below it, which reversed are the more significant ones.
+inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed)
+{
+    x = reverse_bits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return reverse_bits(x);
+}
+
+// The first two dimensions of the Sobol sequence as 32-bit fractions. They form a (0,2)-sequence: every power-of-two
+// prefix is stratified over every elementary interval of the unit square.
+inline uint32_t sobol_0(uint32_t index)
+{
+    return reverse_bits(index);
+}
+
+// The second dimension xors one direction number per set index bit. That is linear in the bits, so it is tabulated
+// for each byte of the index: a lookup per byte instead of a branch per bit.
+constexpr std::array<std::array<uint32_t, 256>, 4> make_sobol_1_bytes()
+{
+    std::array<std::array<uint32_t, 256>, 4> table{};
+    uint32_t                                 direction[32] = {};
+    direction[0]                                           = 1u << 31;
+    for (int bit = 1; bit < 32; ++bit)
+        direction[bit] = direction[bit - 1] ^ (direction[bit - 1] >> 1);
+    for (int byte = 0; byte < 4; ++byte)
+        for (uint32_t value = 0; value < 256; ++value)
+            for (int bit = 0; bit < 8; ++bit)
+                if (value & (1u << bit))
+                    table[byte][value] ^= direction[8 * byte + bit];
+    return table;
+}
+
+inline constexpr auto sobol_1_bytes = make_sobol_1_bytes();
+
+inline uint32_t sobol_1(uint32_t index)
+{
+    return sobol_1_bytes[0][index & 0xff] ^ sobol_1_bytes[1][(index >> 8) & 0xff] ^
+           sobol_1_bytes[2][(index >> 16) & 0xff] ^ sobol_1_bytes[3][index >> 24];
+}
+
+// Point `index` of the Sobol (0,2)-sequence, shuffled and Owen-scrambled with `seed`. The shuffle decorrelates
+// dimension pairs that share the index; the scramble keeps the stratification while making each seed's points an
+// independent random set.
+inline void scrambled_sobol_2d(uint32_t index, uint32_t seed, double & u, double & v)
+{
+    index = nested_uniform_scramble(index, seed);
+    u     = to_unit(nested_uniform_scramble(sobol_0(index), hash_combine(seed, 0)));
+    v     = to_unit(nested_uniform_scramble(sobol_1(index), hash_combine(seed, 1)));
+}
+
+inline double scrambled_sobol_1d(uint32_t index, uint32_t seed)
+{
+    index = nested_uniform_scramble(index, seed);
+    return to_unit(nested_uniform_scramble(sobol_0(index), hash_combine(seed, 0)));
+}
+
+// A pseudo-random permutation of [0, length) indexed by `i`, chosen by `p` (Kensler 2013, listing 3).
+inline uint32_t permute(uint32_t i, uint32_t length, uint32_t p)
+{
+    uint32_t w = length - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do
+    {
+        i ^= p;
+        i *= 0xe170893du;
+        i ^= p >> 16;
+        i ^= (i & w) >> 4;
+        i ^= p >> 8;
+        i *= 0x0929eb3fu;
+        i ^= p >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | p >> 27;
+        i *= 0x6935fa69u;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303u;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3u;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3dfu;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= length);
+    return (i + p) % length;
+}
+
+// A random fraction in [0, 1) indexed by `i` and chosen by `p` (Kensler 2013, listing 4).
+inline double jitter(uint32_t i, uint32_t p)
+{
+    i ^= p;
+    i ^= i >> 17;
+    i ^= i >> 10;
+    i *= 0xb36534e5u;
+    i ^= i >> 12;
+    i ^= i >> 21;
+    i *= 0x93fc4795u;
+    i ^= 0xdf6e307fu;
+    i ^= i >> 17;
+    i *= 1 | p >> 18;
+    return to_unit(i);
+}
+
+// Point `s` of a correlated multi-jittered pattern of `n` points (Kensler 2013): the points are stratified over an
+// m x k grid and, within it, over both axes' n-ths at once.
+inline void multi_jittered_2d(uint32_t s, uint32_t n, uint32_t p, double & u, double & v)
+{
+    uint32_t m = std::max<uint32_t>(1, static_cast<uint32_t>(std::sqrt(double(n))));
+    uint32_t k = (n + m - 1) / m;
+    s          = permute(s, n, p * 0x51633e2du);
+
+    uint32_t sx = permute(s % m, m, p * 0x68bc21ebu);
+    uint32_t sy = permute(s / m, k, p * 0x02e5be93u);
+    double   jx = jitter(s, p * 0x967a889bu);
+    double   jy = jitter(s, p * 0x368cc8b7u);
+    u           = std::min((s % m + (sy + jx) / k) / m, 1 - 0x1.0p-53);
+    v           = std::min((s / m + (sx + jy) / m) / k, 1 - 0x1.0p-53);
+}
+
+inline double jittered_1d(uint32_t s, uint32_t n, uint32_t p)
+{
+    return (permute(s, n, p * 0x51633e2du) + jitter(s, p * 0x967a889bu)) / n;
+}
+
+// A 64x64 tileable blue-noise mask of the ranks 0..4095 (as fractions), built once on first use. Each rank goes to
+// the emptiest cell left, the one with the least Gaussian-weighted energy from the cells ranked before it, so every
+// prefix of the ranks is spread evenly over the tile, as in the void-and-cluster method (Ulichney 1993).
+class blue_noise_mask
+{
+public:
+    static constexpr int size = 64;
+
+    static const blue_noise_mask & get()
+    {
+        static const blue_noise_mask mask;
+        return mask;
+    }
+
+    double at(uint32_t x, uint32_t y) const
+    {
+        return values[(y % size) * size + x % size];
+    }
+
+private:
+    std::array<double, size * size> values;
+
+    blue_noise_mask()
+    {
+        static constexpr int    radius = 6;
+        static constexpr double sigma  = 1.5;
+
+        double kernel[2 * radius + 1][2 * radius + 1];
+        for (int dy = -radius; dy <= radius; ++dy)
+            for (int dx = -radius; dx <= radius; ++dx)
+                kernel[dy + radius][dx + radius] = std::exp(-(dx * dx + dy * dy) / (2 * sigma * sigma));
+
+        // A tiny fixed jitter breaks the ties of the empty start the same way on every run.
+        std::vector<double> energy(size * size);
+        std::vector<bool>   taken(size * size, false);
+        for (int cell = 0; cell < size * size; ++cell)
+            energy[cell] = to_unit(hash(static_cast<uint32_t>(cell))) * 1e-9;
+
+        for (int rank = 0; rank < size * size; ++rank)
+        {
+            int best = -1;
+            for (int cell = 0; cell < size * size; ++cell)
+                if (!taken[cell] && (best < 0 || energy[cell] < energy[best]))
+                    best = cell;
+
+            taken[best]  = true;
+            values[best] = (rank + 0.5) / (size * size);
+            int bx = best % size, by = best / size;
+            for (int dy = -radius; dy <= radius; ++dy)
+                for (int dx = -radius; dx <= radius; ++dx)
+                    energy[((by + dy + size) % size) * size + (bx + dx + size) % size] +=
+                        kernel[dy + radius][dx + radius];
+        }
+    }
+};
+
+// Adds a blue-noise offset to `u` modulo 1, read from the mask at a toroidal shift picked by the hash `shift`. Each
+// dimension reads at its own shift, so the offsets of different dimensions are unrelated.
+inline double rotate(double u, uint32_t x, uint32_t y, uint32_t shift)
+{
+    u += blue_noise_mask::get().at(x + (shift & 0xffff), y + (shift >> 16));
+    return u >= 1 ? u - 1 : u;
+}
+
+// The state draws take their numbers from. Null means independent numbers.
+inline state *& active()
+{
+    thread_local state * current = nullptr;
+    return current;
+}
+
+inline void bind(state * s)
+{
+    active() = s;
+}
+
+// The seed of the sample's current dimension: of this pixel alone, or of every pixel for the shared blue-noise
+// sequence.
+inline uint32_t dimension_seed(const state & s, bool per_pixel)
+{
+    return hash_combine(per_pixel ? s.seed : utils::base_seed(), s.dimension);
+}
+
+// The next two dimensions of sample `s`, as one stratified pair; the independent sampler draws them at random.
+inline void sequence_2d(state & s, double & u, double & v)
+{
+    switch (s.kind)
+    {
+    case sampler_kind::stratified:
+    {
+        // Samples past the pattern (adaptive sampling asks for more) go into fresh patterns.
+        uint32_t pattern = s.index / s.count;
+        multi_jittered_2d(s.index % s.count, s.count, hash_combine(dimension_seed(s, true), pattern), u, v);
+        break;
+    }
+    case sampler_kind::sobol:
+        scrambled_sobol_2d(s.index, dimension_seed(s, true), u, v);
+        break;
+    case sampler_kind::blue_noise:
+    {
+        uint32_t seed = dimension_seed(s, false);
+        scrambled_sobol_2d(s.index, seed, u, v);
+        u = rotate(u, s.x, s.y, hash(seed));
+        v = rotate(v, s.x, s.y, hash(seed + 1));
+        break;
+    }
+    case sampler_kind::independent:
+    default:
+        u = utils::random_double();
+        v = utils::random_double();
+        break;
+    }
+    s.dimension++;
+}
+
+// The next dimension of sample `s`; the independent sampler draws it at random.
+inline double sequence_1d(state & s)
+{
+    double u = 0;
+    switch (s.kind)
+    {
+    case sampler_kind::stratified:
+    {
+        uint32_t pattern = s.index / s.count;
+        u                = jittered_1d(s.index % s.count, s.count, hash_combine(dimension_seed(s, true), pattern));
+        break;
+    }
+    case sampler_kind::sobol:
+        u = scrambled_sobol_1d(s.index, dimension_seed(s, true));
+        break;
+    case sampler_kind::blue_noise:
+    {
+        uint32_t seed = dimension_seed(s, false);
+        u             = rotate(scrambled_sobol_1d(s.index, seed), s.x, s.y, hash(seed));
+        break;
+    }
+    case sampler_kind::independent:
+    default:
+        u = utils::random_double();
+        break;
+    }
+    s.dimension++;
+    return u;
+}
+
+// The next two dimensions of the bound sample. Kept small, so the independent case inlines to two plain draws.
+inline void next_2d(double & u, double & v)
+{
+    state * s = active();
+    if (s && s->kind != sampler_kind::independent)
+        return sequence_2d(*s, u, v);
+    u = utils::random_double();
+    v = utils::random_double();
+}
+
+// The next dimension of the bound sample.
+inline double next_1d()
+{
+    state * s = active();
+    if (s && s->kind != sampler_kind::independent)
+        return sequence_1d(*s);
+    return utils::random_double();
+}
+
+// A uniformly distributed direction, from the next two dimensions.
+inline vec3 random_unit_vector()
+{
+    double u, v;
+    next_2d(u, v);
+    return sphere_direction(u, v);
+}
+
+// A uniformly distributed point in the unit disk (z = 0), from the next two dimensions.
+inline vec3 random_in_unit_disk()
+{
+    double u, v;
+    next_2d(u, v);
+    return concentric_disk(u, v);
+}
+
+} // namespace sampling
+
+#endif
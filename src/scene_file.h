@@ -0,0 +1,664 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include "camera.h"
+#include "color.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "mapped_file.h"
+#include "material.h"
+#include "obj_file.h"
+#include "sphere.h"
+#include "sphere_soup.h"
+#include "transform.h"
+#include "triangle_mesh.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Scene files: the camera, materials and spheres of a scene, in two forms.
+//
+// The text form is for authoring. One statement per line, `#` starts a comment:
+//
+//     camera lookfrom 13 2 3                     any camera field, see camera_record
+//     material ground lambertian 0.5 0.5 0.5     lambertian R G B
+//     material gold metal 0.8 0.6 0.2 0.3        metal R G B FUZZ
+//     material glass dielectric 1.5              dielectric INDEX
+//     sphere 0 -1000 0 1000 ground               sphere X Y Z RADIUS MATERIAL
+//     mesh bunny.obj gold 0 0 0 10               mesh OBJ MATERIAL [X Y Z SCALE]
+//
+// Materials must be defined before the spheres and meshes that use them. Camera fields that are not given keep the
+// camera's defaults. A mesh is the triangles of an OBJ file (see obj_file.h), found relative to the scene file,
+// scaled by SCALE and then moved by X Y Z; a file named by several meshes is read once and shared by all of them.
+//
+// The binary form is for shipping large scenes. It is a header (with the camera), then every material, then every
+// sphere, each as a fixed-size little-endian record of doubles, so a file is memory-mapped and read in place: loading
+// checks the records but copies nothing and allocates nothing per object. Files end in .bin by convention; load()
+// tells the forms apart by the magic at the start, whatever the name. Meshes are only written in the text form.
+namespace scene_file
+{
+
+// The camera fields a scene sets. Render settings such as the thread count or adaptive sampling stay with the caller.
+struct camera_record
+{
+    double  aspect_ratio;
+    double  vfov;
+    double  defocus_angle;
+    double  focus_dist;
+    double  lookfrom[3];
+    double  lookat[3];
+    double  vup[3];
+    int32_t image_width;
+    int32_t samples_per_pixel;
+    int32_t max_depth;
+    int32_t reserved;
+};
+
+struct material_record
+{
+    uint32_t kind; // a material_kind
+    uint32_t reserved;
+    double   albedo[3];
+    double   fuzz;
+    double   ir;
+};
+
+struct sphere_record
+{
+    double   center[3];
+    double   radius;
+    uint32_t material; // index into the scene's materials
+    uint32_t reserved;
+};
+
+// A mesh of a text scene file, with the triangles its OBJ file was loaded into.
+struct mesh_record
+{
+    std::string                         path; // as written in the scene file
+    std::shared_ptr<const mesh_buffers> buffers;
+    uint32_t                            material;
+    double                              offset[3];
+    double                              scale;
+};
+
+struct binary_header
+{
+    char          magic[8]; // "RTSCENE" and a NUL
+    uint32_t      version;
+    uint32_t      byte_order; // 0x01020304 as written by the host that made the file
+    uint32_t      material_count;
+    uint32_t      reserved;
+    uint64_t      sphere_count;
+    camera_record camera;
+};
+
+// The records are read straight out of the file, so their layout is part of the format.
+static_assert(sizeof(camera_record) == 120 && sizeof(material_record) == 48 && sizeof(sphere_record) == 40 &&
+                  sizeof(binary_header) == 152,
+    "scene file records must not contain padding");
+
+constexpr char     binary_magic[8]    = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0'};
+constexpr uint32_t binary_version     = 1;
+constexpr uint32_t binary_byte_order  = 0x01020304;
+constexpr size_t   max_sphere_records = std::numeric_limits<size_t>::max() / sizeof(sphere_record);
+
+inline camera_record camera_settings(const camera & cam)
+{
+    camera_record r = {};
+    r.aspect_ratio  = cam.aspect_ratio;
+    r.vfov          = cam.vfov;
+    r.defocus_angle = cam.defocus_angle;
+    r.focus_dist    = cam.focus_dist;
+    for (int i = 0; i < 3; ++i)
+    {
+        r.lookfrom[i] = cam.lookfrom[i];
+        r.lookat[i]   = cam.lookat[i];
+        r.vup[i]      = cam.vup[i];
+    }
+    r.image_width       = cam.image_width;
+    r.samples_per_pixel = cam.samples_per_pixel;
+    r.max_depth         = cam.max_depth;
+    return r;
+}
+
+inline void apply_camera(const camera_record & r, camera & cam)
+{
+    cam.aspect_ratio      = r.aspect_ratio;
+    cam.vfov              = r.vfov;
+    cam.defocus_angle     = r.defocus_angle;
+    cam.focus_dist        = r.focus_dist;
+    cam.lookfrom          = point3(r.lookfrom[0], r.lookfrom[1], r.lookfrom[2]);
+    cam.lookat            = point3(r.lookat[0], r.lookat[1], r.lookat[2]);
+    cam.vup               = vec3(r.vup[0], r.vup[1], r.vup[2]);
+    cam.image_width       = r.image_width;
+    cam.samples_per_pixel = r.samples_per_pixel;
+    cam.max_depth         = r.max_depth;
+}
+
+// What is wrong with camera settings that no render could use, or nothing.
+inline std::string check_camera(const camera_record & r)
+{
+    if (r.image_width < 1 || r.samples_per_pixel < 1 || !(r.aspect_ratio > 0))
+        return "image_width, samples_per_pixel and aspect_ratio must be positive";
+    if (r.max_depth < 0)
+        return "max_depth must not be negative";
+    return "";
+}
+
+inline material_record material_settings(const material & m)
+{
+    material_record r = {};
+    r.kind            = static_cast<uint32_t>(m.kind);
+    r.albedo[0]       = m.albedo.x();
+    r.albedo[1]       = m.albedo.y();
+    r.albedo[2]       = m.albedo.z();
+    r.fuzz            = m.fuzz;
+    r.ir              = m.ir;
+    return r;
+}
+
+inline material to_material(const material_record & r)
+{
+    material m;
+    m.kind   = static_cast<material_kind>(r.kind);
+    m.albedo = color(r.albedo[0], r.albedo[1], r.albedo[2]);
+    m.fuzz   = r.fuzz;
+    m.ir     = r.ir;
+    return m;
+}
+
+// A loaded scene. The records either live in the scene itself (text files and scenes built in memory) or are read in
+// place from a mapped binary file.
+class scene
+{
+public:
+    camera_record            view = camera_settings(camera());
+    std::vector<mesh_record> meshes;
+
+    const material_record * materials() const
+    {
+        return material_data;
+    }
+
+    size_t material_count() const
+    {
+        return material_total;
+    }
+
+    const sphere_record * spheres() const
+    {
+        return sphere_data;
+    }
+
+    size_t sphere_count() const
+    {
+        return sphere_total;
+    }
+
+    uint32_t add(const material_record & m)
+    {
+        owned_materials.push_back(m);
+        refresh();
+        return static_cast<uint32_t>(owned_materials.size() - 1);
+    }
+
+    void add(const sphere_record & s)
+    {
+        owned_spheres.push_back(s);
+        refresh();
+    }
+
+    // Reads the records of a binary file in place. The file must stay open for as long as the scene is used.
+    void view_binary(mapped_file && file)
+    {
+        owned_materials.clear();
+        owned_spheres.clear();
+        source = std::move(file);
+
+        const uint8_t * base = source.data();
+        binary_header   header;
+        std::memcpy(&header, base, sizeof(header));
+        view           = header.camera;
+        material_data  = reinterpret_cast<const material_record *>(base + sizeof(header));
+        material_total = header.material_count;
+        sphere_data    = reinterpret_cast<const sphere_record *>(material_data + material_total);
+        sphere_total   = header.sphere_count;
+    }
+
+private:
+    std::vector<material_record> owned_materials;
+    std::vector<sphere_record>   owned_spheres;
+    mapped_file                  source;
+
+    const material_record * material_data  = nullptr;
+    size_t                  material_total = 0;
+    const sphere_record *   sphere_data    = nullptr;
+    size_t                  sphere_total   = 0;
+
+    void refresh()
+    {
+        material_data  = owned_materials.data();
+        material_total = owned_materials.size();
+        sphere_data    = owned_spheres.data();
+        sphere_total   = owned_spheres.size();
+    }
+};
+
+// Describes `world` and the camera as a scene. The world may only hold spheres.
+inline scene from_world(const hittable_list & world, const material_table & materials, const camera & cam)
+{
+    scene out;
+    out.view = camera_settings(cam);
+    for (size_t m = 0; m < materials.size(); ++m)
+        out.add(material_settings(materials[static_cast<material_table::id>(m)]));
+
+    for (const auto & object : world.objects)
+    {
+        auto s = dynamic_cast<const sphere *>(object.get());
+        if (!s || &s->material_source() != &materials)
+            throw std::runtime_error("scene files can only hold spheres with materials from the scene's table");
+        sphere_record r = {};
+        for (int i = 0; i < 3; ++i)
+            r.center[i] = s->center_point()[i];
+        r.radius   = s->signed_radius();
+        r.material = s->material_id();
+        out.add(r);
+    }
+    return out;
+}
+
+// Adds the scene's materials to `materials` and a sphere object for each of its spheres to `world`.
+inline void build_world(const scene & s, hittable_list & world, material_table & materials)
+{
+    auto first = static_cast<material_table::id>(materials.size());
+    for (size_t m = 0; m < s.material_count(); ++m)
+        materials.add(to_material(s.materials()[m]));
+
+    world.objects.reserve(world.objects.size() + s.sphere_count() + s.meshes.size());
+    for (size_t i = 0; i < s.sphere_count(); ++i)
+    {
+        const auto & r = s.spheres()[i];
+        world.make<sphere>(point3(r.center[0], r.center[1], r.center[2]), r.radius, materials, first + r.material);
+    }
+
+    // One triangle_mesh, and so one BVH, per file; every mesh of the scene places it with a material of its own.
+    std::unordered_map<const mesh_buffers *, std::shared_ptr<const triangle_mesh>> built;
+    for (const auto & r : s.meshes)
+    {
+        auto & mesh = built[r.buffers.get()];
+        if (!mesh)
+            mesh = std::make_shared<triangle_mesh>(r.buffers, materials, first + r.material);
+        auto placement = transform::translation(vec3(r.offset[0], r.offset[1], r.offset[2])) *
+                         transform::scaling(r.scale);
+        world.make<instance>(mesh, placement, materials, first + r.material);
+    }
+}
+
+// Adds the scene's spheres straight to `soup`, with no object per sphere, and builds it. The materials are added to
+// `materials`, which the soup tells apart by address, so the table must not change while this runs.
+inline void build_soup(const scene & s, sphere_soup & soup, material_table & materials)
+{
+    auto first = static_cast<material_table::id>(materials.size());
+    for (size_t m = 0; m < s.material_count(); ++m)
+        materials.add(to_material(s.materials()[m]));
+
+    soup.reserve(s.sphere_count());
+    for (size_t i = 0; i < s.sphere_count(); ++i)
+    {
+        const auto & r = s.spheres()[i];
+        soup.add(point3(r.center[0], r.center[1], r.center[2]), r.radius, materials[first + r.material]);
+    }
+    soup.build();
+}
+
+// Checks that every material has a known kind and every sphere refers to an existing material.
+inline bool check_records(const scene & s, const std::string & path)
+{
+    for (size_t m = 0; m < s.material_count(); ++m)
+    {
+        if (s.materials()[m].kind >= material_kind_count)
+        {
+            std::cerr << path << ": material " << m << " has unknown kind " << s.materials()[m].kind << std::endl;
+            return false;
+        }
+    }
+    for (size_t i = 0; i < s.sphere_count(); ++i)
+    {
+        if (s.spheres()[i].material >= s.material_count())
+        {
+            std::cerr << path << ": sphere " << i << " refers to missing material " << s.spheres()[i].material
+                      << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+inline bool load_binary(mapped_file && file, const std::string & path, scene & out)
+{
+    binary_header header;
+    if (file.size() < sizeof(header))
+    {
+        std::cerr << path << ": too short for a scene file header" << std::endl;
+        return false;
+    }
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (header.byte_order != binary_byte_order)
+    {
+        std::cerr << path << ": written with a different byte order" << std::endl;
+        return false;
+    }
+    if (header.version != binary_version)
+    {
+        std::cerr << path << ": scene file version " << header.version << ", expected " << binary_version
+                  << std::endl;
+        return false;
+    }
+
+    size_t materials_end = sizeof(header) + size_t(header.material_count) * sizeof(material_record);
+    if (header.sphere_count > max_sphere_records || file.size() < materials_end ||
+        file.size() - materials_end != header.sphere_count * sizeof(sphere_record))
+    {
+        std::cerr << path << ": size does not match its " << header.material_count << " materials and "
+                  << header.sphere_count << " spheres" << std::endl;
+        return false;
+    }
+
+    std::string error = check_camera(header.camera);
+    if (!error.empty())
+    {
+        std::cerr << path << ": camera " << error << std::endl;
+        return false;
+    }
+
+    out.view_binary(std::move(file));
+    return check_records(out, path);
+}
+
+// Reads `count` numbers from `in` into `values`, false if there are fewer.
+inline bool read_numbers(std::istream & in, double * values, int count)
+{
+    for (int i = 0; i < count; ++i)
+        if (!(in >> values[i]))
+            return false;
+    return true;
+}
+
+// Reads the rest of a `camera FIELD VALUES` statement into `view`. Returns what is wrong with it, or nothing.
+inline std::string parse_camera(std::istream & in, camera_record & view)
+{
+    std::string field;
+    in >> field;
+    bool ok = true;
+    if (field == "aspect_ratio")
+        ok = read_numbers(in, &view.aspect_ratio, 1);
+    else if (field == "vfov")
+        ok = read_numbers(in, &view.vfov, 1);
+    else if (field == "defocus_angle")
+        ok = read_numbers(in, &view.defocus_angle, 1);
+    else if (field == "focus_dist")
+        ok = read_numbers(in, &view.focus_dist, 1);
+    else if (field == "lookfrom")
+        ok = read_numbers(in, view.lookfrom, 3);
+    else if (field == "lookat")
+        ok = read_numbers(in, view.lookat, 3);
+    else if (field == "vup")
+        ok = read_numbers(in, view.vup, 3);
+    else if (field == "image_width")
+        ok = static_cast<bool>(in >> view.image_width);
+    else if (field == "samples_per_pixel")
+        ok = static_cast<bool>(in >> view.samples_per_pixel);
+    else if (field == "max_depth")
+        ok = static_cast<bool>(in >> view.max_depth);
+    else
+        return "unknown camera field '" + field + "'";
+    return ok ? "" : "missing or bad value for camera " + field;
+}
+
+// Reads the rest of a `material NAME KIND VALUES` statement. Returns what is wrong with it, or nothing.
+inline std::string parse_material(std::istream & in, std::string & name, material_record & r)
+{
+    std::string kind;
+    r    = {};
+    r.ir = 1; // what material itself defaults to
+    in >> name >> kind;
+    bool ok = true;
+    if (kind == "lambertian")
+    {
+        r.kind = static_cast<uint32_t>(material_kind::lambertian);
+        ok     = read_numbers(in, r.albedo, 3);
+    }
+    else if (kind == "metal")
+    {
+        r.kind = static_cast<uint32_t>(material_kind::metal);
+        ok     = read_numbers(in, r.albedo, 3) && read_numbers(in, &r.fuzz, 1);
+        r.fuzz = r.fuzz < 1 ? r.fuzz : 1;
+    }
+    else if (kind == "dielectric")
+    {
+        r.kind = static_cast<uint32_t>(material_kind::dielectric);
+        ok     = read_numbers(in, &r.ir, 1);
+    }
+    else
+        return "unknown material kind '" + kind + "'";
+    return ok ? "" : "missing or bad value for " + kind + " material " + name;
+}
+
+inline bool load_text(const mapped_file & file, const std::string & path, scene & out)
+{
+    std::istringstream text(std::string(reinterpret_cast<const char *>(file.data()), file.size()));
+    std::unordered_map<std::string, uint32_t>                            material_ids;
+    std::unordered_map<std::string, std::shared_ptr<const mesh_buffers>> mesh_files;
+    std::string                                                          line;
+
+    for (int number = 1; std::getline(text, line); ++number)
+    {
+        auto fail = [&](const std::string & message) {
+            std::cerr << path << ':' << number << ": " << message << std::endl;
+            return false;
+        };
+
+        line = line.substr(0, line.find('#'));
+        std::istringstream in(line);
+        std::string        statement;
+        if (!(in >> statement))
+            continue;
+
+        if (statement == "camera")
+        {
+            std::string error = parse_camera(in, out.view);
+            if (error.empty())
+                error = check_camera(out.view);
+            if (!error.empty())
+                return fail(error);
+        }
+        else if (statement == "material")
+        {
+            std::string     name;
+            material_record r;
+            std::string     error = parse_material(in, name, r);
+            if (!error.empty())
+                return fail(error);
+            if (!material_ids.emplace(name, static_cast<uint32_t>(out.material_count())).second)
+                return fail("material " + name + " is defined twice");
+            out.add(r);
+        }
+        else if (statement == "sphere")
+        {
+            sphere_record r = {};
+            std::string   name;
+            if (!read_numbers(in, r.center, 3) || !read_numbers(in, &r.radius, 1) || !(in >> name))
+                return fail("a sphere needs X Y Z RADIUS MATERIAL");
+            auto found = material_ids.find(name);
+            if (found == material_ids.end())
+                return fail("undefined material " + name);
+            r.material = found->second;
+            out.add(r);
+        }
+        else if (statement == "mesh")
+        {
+            mesh_record r = {};
+            std::string name;
+            r.scale = 1;
+            if (!(in >> r.path >> name))
+                return fail("a mesh needs OBJ MATERIAL [X Y Z SCALE]");
+            double placement[4];
+            if (read_numbers(in, placement, 1))
+            {
+                if (!read_numbers(in, placement + 1, 3) || placement[3] <= 0)
+                    return fail("a mesh is placed by X Y Z and a positive SCALE");
+                std::copy(placement, placement + 3, r.offset);
+                r.scale = placement[3];
+            }
+            in.clear();
+
+            auto found = material_ids.find(name);
+            if (found == material_ids.end())
+                return fail("undefined material " + name);
+            r.material = found->second;
+
+            auto & buffers = mesh_files[r.path];
+            if (!buffers)
+            {
+                std::string obj = r.path;
+                size_t      dir = path.find_last_of('/');
+                if (obj.compare(0, 1, "/") != 0 && dir != std::string::npos)
+                    obj = path.substr(0, dir + 1) + obj;
+                auto loaded = std::make_shared<mesh_buffers>();
+                if (!obj_file::load(obj, *loaded))
+                    return fail("could not load mesh " + r.path);
+                buffers = std::move(loaded);
+            }
+            r.buffers = buffers;
+            out.meshes.push_back(std::move(r));
+        }
+        else
+            return fail("unknown statement '" + statement + "'");
+
+        std::string extra;
+        if (in >> extra)
+            return fail("unexpected '" + extra + "' at the end of the line");
+    }
+    return true;
+}
+
+// Loads a scene file in either form. Returns false and prints the reason if it cannot be read or is malformed.
+inline bool load(const std::string & path, scene & out)
+{
+    mapped_file file;
+    if (!file.open(path))
+        return false;
+
+    out = scene();
+    if (file.size() >= sizeof(binary_magic) && std::memcmp(file.data(), binary_magic, sizeof(binary_magic)) == 0)
+        return load_binary(std::move(file), path, out);
+    return load_text(file, path, out);
+}
+
+inline bool ends_with(const std::string & text, const std::string & suffix)
+{
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+inline void write_text(const scene & s, std::ostream & out)
+{
+    const auto & v = s.view;
+    out.precision(std::numeric_limits<double>::max_digits10);
+    out << "# " << s.material_count() << " materials, " << s.sphere_count() << " spheres, " << s.meshes.size()
+        << " meshes\n";
+    out << "camera aspect_ratio " << v.aspect_ratio << '\n';
+    out << "camera image_width " << v.image_width << '\n';
+    out << "camera samples_per_pixel " << v.samples_per_pixel << '\n';
+    out << "camera max_depth " << v.max_depth << '\n';
+    out << "camera vfov " << v.vfov << '\n';
+    out << "camera lookfrom " << v.lookfrom[0] << ' ' << v.lookfrom[1] << ' ' << v.lookfrom[2] << '\n';
+    out << "camera lookat " << v.lookat[0] << ' ' << v.lookat[1] << ' ' << v.lookat[2] << '\n';
+    out << "camera vup " << v.vup[0] << ' ' << v.vup[1] << ' ' << v.vup[2] << '\n';
+    out << "camera defocus_angle " << v.defocus_angle << '\n';
+    out << "camera focus_dist " << v.focus_dist << '\n';
+
+    for (size_t m = 0; m < s.material_count(); ++m)
+    {
+        const auto & r = s.materials()[m];
+        out << "material m" << m << ' ';
+        switch (static_cast<material_kind>(r.kind))
+        {
+        case material_kind::lambertian:
+            out << "lambertian " << r.albedo[0] << ' ' << r.albedo[1] << ' ' << r.albedo[2] << '\n';
+            break;
+        case material_kind::metal:
+            out << "metal " << r.albedo[0] << ' ' << r.albedo[1] << ' ' << r.albedo[2] << ' ' << r.fuzz << '\n';
+            break;
+        case material_kind::dielectric:
+            out << "dielectric " << r.ir << '\n';
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < s.sphere_count(); ++i)
+    {
+        const auto & r = s.spheres()[i];
+        out << "sphere " << r.center[0] << ' ' << r.center[1] << ' ' << r.center[2] << ' ' << r.radius << " m"
+            << r.material << '\n';
+    }
+
+    for (const auto & r : s.meshes)
+        out << "mesh " << r.path << " m" << r.material << ' ' << r.offset[0] << ' ' << r.offset[1] << ' '
+            << r.offset[2] << ' ' << r.scale << '\n';
+}
+
+inline void write_binary(const scene & s, std::ostream & out)
+{
+    binary_header header = {};
+    std::memcpy(header.magic, binary_magic, sizeof(binary_magic));
+    header.version        = binary_version;
+    header.byte_order     = binary_byte_order;
+    header.material_count = static_cast<uint32_t>(s.material_count());
+    header.sphere_count   = s.sphere_count();
+    header.camera         = s.view;
+
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(s.materials()), s.material_count() * sizeof(material_record));
+    out.write(reinterpret_cast<const char *>(s.spheres()), s.sphere_count() * sizeof(sphere_record));
+}
+
+// Writes the scene in binary form if `path` ends in .bin, as text otherwise. Returns false and prints the reason if
+// the file cannot be written.
+inline bool write(const scene & s, const std::string & path)
+{
+    bool binary = ends_with(path, ".bin");
+    if (binary && !s.meshes.empty())
+    {
+        std::cerr << "Meshes can only be written to text scene files, not to " << path << std::endl;
+        return false;
+    }
+    std::ofstream out(path, binary ? std::ios::binary : std::ios::out);
+    if (!out)
+    {
+        std::cerr << "Could not open " << path << " for writing" << std::endl;
+        return false;
+    }
+    if (binary)
+        write_binary(s, out);
+    else
+        write_text(s, out);
+    out.close();
+    if (!out)
+        std::cerr << "Could not write " << path << std::endl;
+    return static_cast<bool>(out);
+}
+
+} // namespace scene_file
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include "camera.h"
+#include "color.h"
+#include "framebuffer.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "sphere.h"
+#include "utils.h"
+
+#include <cmath>
+#include <memory>
+
+// ========================================
+// THE BOOKS VERSION OF THE WORLD
+// ========================================
+
+// Fills `world` with the final scene of the book: a ground sphere, three large spheres and a grid of small random
+// spheres, with their materials added to `materials`. The default of 484 small sphere slots (a 22x22 grid) is the
+// book's layout. Larger counts shrink the grid cells and the spheres in them, so the scene keeps its footprint in the
+// camera view while the object count grows.
+void book_scene(hittable_list & world, material_table & materials, int small_spheres = 484)
+{
+    using namespace std;
+
+    int    n     = max(1, static_cast<int>(lround(sqrt(static_cast<double>(small_spheres)) / 2)));
+    double scale = 11.0 / n;
+    double r     = 0.2 * scale;
+
+    auto ground_material = materials.add(material::lambertian(color(0.5, 0.5, 0.5)));
+    world.make<sphere>(point3(0, -1000, 0), 1000, materials, ground_material);
+
+    for (int a = -n; a < n; a++)
+    {
+        for (int b = -n; b < n; b++)
+        {
+            auto   choose_mat = utils::random_double();
+            point3 center((a + 0.9 * utils::random_double()) * scale, r, (b + 0.9 * utils::random_double()) * scale);
+
+            if ((center - point3(4, r, 0)).length() > 0.9)
+            {
+                material_table::id sphere_material;
+
+                if (choose_mat < 0.8)
+                {
+                    // diffuse
+                    auto albedo     = color::random() * color::random();
+                    sphere_material = materials.add(material::lambertian(albedo));
+                    world.make<sphere>(center, r, materials, sphere_material);
+                }
+                else if (choose_mat < 0.95)
+                {
+                    // metal
+                    auto albedo     = color::random(0.5, 1);
+                    auto fuzz       = utils::random_double_range(0, 0.5);
+                    sphere_material = materials.add(material::metal(albedo, fuzz));
+                    world.make<sphere>(center, r, materials, sphere_material);
+                }
+                else
+                {
+                    // glass
+                    sphere_material = materials.add(material::dielectric(1.5));
+                    world.make<sphere>(center, r, materials, sphere_material);
+                }
+            }
+        }
+    }
+
+    auto material1 = materials.add(material::dielectric(1.5));
+    world.make<sphere>(point3(0, 1, 0), 1.0, materials, material1);
+
+    auto material2 = materials.add(material::lambertian(color(0.4, 0.2, 0.1)));
+    world.make<sphere>(point3(-4, 1, 0), 1.0, materials, material2);
+
+    auto material3 = materials.add(material::metal(color(0.7, 0.6, 0.5), 0.0));
+    world.make<sphere>(point3(4, 1, 0), 1.0, materials, material3);
+}
+
+// Points `cam` at book_scene the way the book's final render does.
+void book_view(camera & cam)
+{
+    cam.vfov          = 20;
+    cam.lookfrom      = point3(13, 2, 3);
+    cam.lookat        = point3(0, 0, 0);
+    cam.vup           = vec3(0, 1, 0);
+    cam.defocus_angle = 0.6;
+    cam.focus_dist    = 10.0;
+}
+
+// A quiet camera on the book's view for the benchmarks, `width` pixels wide at `samples` samples per pixel.
+camera book_camera(int width, int samples, unsigned threads)
+{
+    camera cam;
+    cam.image_width       = width;
+    cam.samples_per_pixel = samples;
+    cam.max_depth         = 8;
+    cam.thread_count      = threads;
+    cam.show_progress     = false;
+    book_view(cam);
+    return cam;
+}
+
+// Root mean square difference between the linear pixel values of two renders of the same size.
+double rmse(const framebuffer & image, const framebuffer & reference)
+{
+    double sum = 0;
+    for (int j = 0; j < image.height; ++j)
+    {
+        for (int i = 0; i < image.width; ++i)
+        {
+            color d = image.average(i, j) - reference.average(i, j);
+            sum += d.x() * d.x() + d.y() * d.y() + d.z() * d.z();
+        }
+    }
+    return std::sqrt(sum / (3.0 * image.width * image.height));
+}
+
+// A refraction stress test framed like the book scene: a water ground sphere under a grid of glass spheres, every
+// fourth of them hollow (a glass shell around a negative-radius sphere), and three large glass spheres. Almost every
+// path bounces until roulette or the depth limit ends it.
+void dielectric_scene(hittable_list & world, material_table & materials)
+{
+    using namespace std;
+
+    auto water = materials.add(material::dielectric(1.33));
+    world.make<sphere>(point3(0, -1000, 0), 1000, materials, water);
+
+    for (int a = -5; a <= 5; a++)
+    {
+        for (int b = -5; b <= 5; b++)
+        {
+            point3 center(a + 0.9 * utils::random_double(), 0.3, b + 0.9 * utils::random_double());
+            auto   glass = materials.add(material::dielectric(utils::random_double_range(1.3, 2.4)));
+            world.make<sphere>(center, 0.3, materials, glass);
+            if ((a + b) % 4 == 0)
+                world.make<sphere>(center, -0.25, materials, glass);
+        }
+    }
+
+    auto glass = materials.add(material::dielectric(1.5));
+    world.make<sphere>(point3(0, 1, 0), 1.0, materials, glass);
+    world.make<sphere>(point3(-4, 1, 0), 1.0, materials, glass);
+    world.make<sphere>(point3(-4, 1, 0), -0.9, materials, glass);
+    world.make<sphere>(point3(4, 1, 0), 1.0, materials, glass);
+}
+
+// One diffuse sphere in front of the sky, for measuring the fixed per-ray and per-sample costs of the renderer.
+void single_sphere_scene(hittable_list & world, material_table & materials)
+{
+    auto gray = materials.add(material::lambertian(color(0.5, 0.5, 0.5)));
+    world.make<sphere>(point3(0, 0, 0), 1.0, materials, gray);
+}
+
+#endif
@@ -0,0 +1,269 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+// Single-precision lanes for the kernels that run SIMD_LANES values per instruction: 8 with AVX2, 4 with SSE2, and
+// one at a time otherwise. Build with -DRT_NO_SIMD to force the scalar fallback. Every width does the same float
+// arithmetic in the same order, so a kernel written against simd::pack gives the same results at every width up to
+// rounding.
+#if !defined(RT_NO_SIMD) && defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_LANES 8
+#elif !defined(RT_NO_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#define SIMD_LANES 4
+#else
+#define SIMD_LANES 1
+#endif
+
+namespace simd
+{
+
+#if SIMD_LANES == 8
+// AVX2: eight floats per instruction.
+struct pack
+{
+    __m256 v;
+};
+
+inline pack load(const float * p)
+{
+    return {_mm256_loadu_ps(p)};
+}
+
+inline void store(float * p, pack a)
+{
+    _mm256_storeu_ps(p, a.v);
+}
+
+inline pack splat(float x)
+{
+    return {_mm256_set1_ps(x)};
+}
+
+inline pack operator+(pack a, pack b)
+{
+    return {_mm256_add_ps(a.v, b.v)};
+}
+
+inline pack operator-(pack a, pack b)
+{
+    return {_mm256_sub_ps(a.v, b.v)};
+}
+
+inline pack operator*(pack a, pack b)
+{
+    return {_mm256_mul_ps(a.v, b.v)};
+}
+
+inline pack operator/(pack a, pack b)
+{
+    return {_mm256_div_ps(a.v, b.v)};
+}
+
+inline pack max(pack a, pack b)
+{
+    return {_mm256_max_ps(a.v, b.v)};
+}
+
+inline pack sqrt(pack a)
+{
+    return {_mm256_sqrt_ps(a.v)};
+}
+
+inline pack abs(pack a)
+{
+    return {_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v)};
+}
+
+// One bit per lane where a < b, a <= b or a != b; false wherever either is NaN.
+inline int less(pack a, pack b)
+{
+    return _mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ));
+}
+
+inline int less_equal(pack a, pack b)
+{
+    return _mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ));
+}
+
+inline int not_equal(pack a, pack b)
+{
+    return _mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_NEQ_OQ));
+}
+
+// x rounded to the nearest integer, and 2^n for integers n in [-126, 127].
+inline pack round_nearest(pack x, pack & pow2)
+{
+    __m256i n = _mm256_cvtps_epi32(x.v);
+    pow2.v    = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(n, _mm256_set1_epi32(127)), 23));
+    return {_mm256_cvtepi32_ps(n)};
+}
+#elif SIMD_LANES == 4
+// SSE2: four floats per instruction.
+struct pack
+{
+    __m128 v;
+};
+
+inline pack load(const float * p)
+{
+    return {_mm_loadu_ps(p)};
+}
+
+inline void store(float * p, pack a)
+{
+    _mm_storeu_ps(p, a.v);
+}
+
+inline pack splat(float x)
+{
+    return {_mm_set1_ps(x)};
+}
+
+inline pack operator+(pack a, pack b)
+{
+    return {_mm_add_ps(a.v, b.v)};
+}
+
+inline pack operator-(pack a, pack b)
+{
+    return {_mm_sub_ps(a.v, b.v)};
+}
+
+inline pack operator*(pack a, pack b)
+{
+    return {_mm_mul_ps(a.v, b.v)};
+}
+
+inline pack operator/(pack a, pack b)
+{
+    return {_mm_div_ps(a.v, b.v)};
+}
+
+inline pack max(pack a, pack b)
+{
+    return {_mm_max_ps(a.v, b.v)};
+}
+
+inline pack sqrt(pack a)
+{
+    return {_mm_sqrt_ps(a.v)};
+}
+
+inline pack abs(pack a)
+{
+    return {_mm_andnot_ps(_mm_set1_ps(-0.0f), a.v)};
+}
+
+// One bit per lane where a < b, a <= b or a != b; false wherever either is NaN.
+inline int less(pack a, pack b)
+{
+    return _mm_movemask_ps(_mm_cmplt_ps(a.v, b.v));
+}
+
+inline int less_equal(pack a, pack b)
+{
+    return _mm_movemask_ps(_mm_cmple_ps(a.v, b.v));
+}
+
+inline int not_equal(pack a, pack b)
+{
+    return _mm_movemask_ps(_mm_cmpneq_ps(a.v, b.v)) & ~_mm_movemask_ps(_mm_cmpunord_ps(a.v, b.v));
+}
+
+// x rounded to the nearest integer, and 2^n for integers n in [-126, 127].
+inline pack round_nearest(pack x, pack & pow2)
+{
+    __m128i n = _mm_cvtps_epi32(x.v);
+    pow2.v    = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23));
+    return {_mm_cvtepi32_ps(n)};
+}
+#else
+// Scalar fallback: one float at a time.
+struct pack
+{
+    float v;
+};
+
+inline pack load(const float * p)
+{
+    return {*p};
+}
+
+inline void store(float * p, pack a)
+{
+    *p = a.v;
+}
+
+inline pack splat(float x)
+{
+    return {x};
+}
+
+inline pack operator+(pack a, pack b)
+{
+    return {a.v + b.v};
+}
+
+inline pack operator-(pack a, pack b)
+{
+    return {a.v - b.v};
+}
+
+inline pack operator*(pack a, pack b)
+{
+    return {a.v * b.v};
+}
+
+inline pack operator/(pack a, pack b)
+{
+    return {a.v / b.v};
+}
+
+inline pack max(pack a, pack b)
+{
+    return {a.v > b.v ? a.v : b.v};
+}
+
+inline pack sqrt(pack a)
+{
+    return {std::sqrt(a.v)};
+}
+
+inline pack abs(pack a)
+{
+    return {std::fabs(a.v)};
+}
+
+inline int less(pack a, pack b)
+{
+    return a.v < b.v;
+}
+
+inline int less_equal(pack a, pack b)
+{
+    return a.v <= b.v;
+}
+
+inline int not_equal(pack a, pack b)
+{
+    return a.v < b.v || b.v < a.v;
+}
+
+// x rounded to the nearest integer, and 2^n for integers n in [-126, 127].
+inline pack round_nearest(pack x, pack & pow2)
+{
+    int32_t  n    = static_cast<int32_t>(std::nearbyint(x.v));
+    uint32_t bits = static_cast<uint32_t>(n + 127) << 23;
+    std::memcpy(&pow2.v, &bits, sizeof(bits));
+    return {static_cast<float>(n)};
+}
+#endif
+
+} // namespace simd
+
+#endif
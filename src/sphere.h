@@ -3,21 +3,30 @@
 
 #include "hittable.h"
 #include "material.h"
+#include "render_stats.h"
 #include "vec3.h"
 
 #include <cmath>
-#include <memory>
 
 class sphere : public hittable
 {
 public:
-    sphere(point3 _center, double _radius, std::shared_ptr<material> _material)
-        : center(_center), radius(_radius), mat(_material)
+    sphere(point3 _center, real _radius, const material_table & _materials, material_table::id _material)
+        : center(_center), radius(_radius), materials(&_materials), mat(_material)
     {
+        // a negative radius flips the normals to make hollow spheres, but the sphere still covers |radius|
+        auto rvec = vec3(std::fabs(radius), std::fabs(radius), std::fabs(radius));
+        bbox      = aabb(center - rvec, center + rvec);
     }
 
     bool hit(const ray & r, interval ray_t, hit_record & rec) const override
     {
+        if constexpr (render_stats::enabled)
+        {
+            render_stats::local().hit_calls++;
+            render_stats::local().sphere_tests++;
+        }
+
         vec3 oc     = r.origin() - center;
         auto a      = r.direction().length_squared();
         auto half_b = dot(oc, r.direction());
@@ -45,18 +54,50 @@ public:
 
         rec.t   = root;
         rec.p   = r.at(rec.t);
-        rec.mat = mat;
+        rec.mat = &(*materials)[mat];
 
         vec3 outward_normal = (rec.p - center) / radius;
         rec.set_face_normal(r, outward_normal);
 
+        if constexpr (render_stats::enabled)
+            render_stats::local().sphere_hits++;
         return true;
     }
 
+    aabb bounding_box() const override
+    {
+        return bbox;
+    }
+
+    point3 center_point() const
+    {
+        return center;
+    }
+
+    // Negative for a hollow sphere.
+    real signed_radius() const
+    {
+        return radius;
+    }
+
+    const material_table & material_source() const
+    {
+        return *materials;
+    }
+
+    material_table::id material_id() const
+    {
+        return mat;
+    }
+
 private:
-    point3                    center;
-    double                    radius;
-    std::shared_ptr<material> mat;
+    friend class sphere_soup;
+
+    point3                 center;
+    real                   radius;
+    const material_table * materials; // owned by the scene
+    material_table::id     mat;
+    aabb                   bbox;
 };
 
 #endif
\ No newline at end of file
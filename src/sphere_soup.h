@@ -0,0 +1,397 @@
+#ifndef SPHERE_SOUP_H
+#define SPHERE_SOUP_H
+
+#include "aabb.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "linear_bvh.h"
+#include "material.h"
+#include "render_stats.h"
+#include "sphere.h"
+
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// The intersection kernel width is picked at compile time from the target's instruction set: 4 doubles per
+// instruction with AVX, 2 with SSE2, and a scalar loop otherwise. Build with -DRT_NO_SIMD to force the scalar loop.
+// The SIMD kernels are written for doubles, so single precision builds (RT_FLOAT) use the scalar loop too.
+#if defined(RT_FLOAT)
+#define SPHERE_SOUP_LANES 1
+#elif !defined(RT_NO_SIMD) && defined(__AVX__)
+#include <immintrin.h>
+#define SPHERE_SOUP_LANES 4
+#elif !defined(RT_NO_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#define SPHERE_SOUP_LANES 2
+#else
+#define SPHERE_SOUP_LANES 1
+#endif
+
+// A set of spheres stored as structure-of-arrays: centers, radii and material indices each live in their own
+// contiguous array, and the spheres are intersected SPHERE_SOUP_LANES at a time.
+//
+// The spheres sit in the leaves of an internal linear_bvh_tree and are stored in leaf order, so every leaf is one
+// contiguous run of the arrays that the SIMD kernel loads directly.
+//
+// Every lane does exactly the arithmetic of sphere::hit, in the same order, and the nearest root is picked with the
+// same strict interval::surrounds tests, so a soup reports bit-identical hits to the equivalent sphere objects. This
+// holds as long as the compiler does not contract the scalar path into FMAs (the default unless -mfma is enabled).
+class sphere_soup : public hittable
+{
+public:
+    static constexpr int lanes         = SPHERE_SOUP_LANES;
+    static constexpr int max_leaf_size = 2 * SPHERE_SOUP_LANES < 4 ? 4 : 2 * SPHERE_SOUP_LANES;
+
+    sphere_soup() {}
+
+    // Copies every sphere out of `list`. The list may only hold spheres.
+    sphere_soup(const hittable_list & list)
+    {
+        for (const auto & object : list.objects)
+        {
+            auto s = dynamic_cast<const sphere *>(object.get());
+            if (!s)
+                throw std::runtime_error("sphere_soup can only be built from spheres");
+            add(s->center, s->radius, (*s->materials)[s->mat]);
+        }
+        build();
+    }
+
+    // Adds a sphere. The soup keeps its own copy of each distinct material. Materials are told apart by address, so
+    // pass the scene's own material objects (such as entries of its material_table) rather than temporaries.
+    void add(const point3 & center, real radius, const material & mat)
+    {
+        if (built)
+            strip_padding();
+
+        auto found = material_ids.find(&mat);
+        if (found == material_ids.end())
+        {
+            found = material_ids.emplace(&mat, static_cast<uint32_t>(materials.size())).first;
+            materials.push_back(mat);
+        }
+
+        center_x.push_back(center.x());
+        center_y.push_back(center.y());
+        center_z.push_back(center.z());
+        radii.push_back(radius);
+        material_index.push_back(found->second);
+    }
+
+    // Replaces the soup's copy of `source`, a material given to add(), with `m`. Returns false if no sphere has it.
+    bool update_material(const material & source, const material & m)
+    {
+        auto found = material_ids.find(&source);
+        if (found == material_ids.end())
+            return false;
+        materials[found->second] = m;
+        return true;
+    }
+
+    // Makes room for `count` spheres in total, so adding that many does not regrow the arrays.
+    void reserve(size_t count)
+    {
+        count += lanes - 1; // the padding build() appends
+        center_x.reserve(count);
+        center_y.reserve(count);
+        center_z.reserve(count);
+        radii.reserve(count);
+        material_index.reserve(count);
+    }
+
+    // Builds the BVH over the spheres added so far and reorders the arrays into leaf order.
+    void build()
+    {
+        if (built)
+            strip_padding();
+        size_t count = radii.size();
+
+        std::vector<aabb> boxes;
+        boxes.reserve(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto rvec = vec3(std::fabs(radii[i]), std::fabs(radii[i]), std::fabs(radii[i]));
+            auto c    = point3(center_x[i], center_y[i], center_z[i]);
+            boxes.push_back(aabb(c - rvec, c + rvec));
+        }
+
+        auto order = tree.build(boxes, max_leaf_size, lanes);
+        permute(center_x, order);
+        permute(center_y, order);
+        permute(center_z, order);
+        permute(radii, order);
+        permute(material_index, order);
+
+        // Pad past the end so a kernel load starting at the last leaf never reads outside the arrays.
+        for (int i = 0; i < lanes - 1; ++i)
+        {
+            center_x.push_back(0);
+            center_y.push_back(0);
+            center_z.push_back(0);
+            radii.push_back(0);
+            material_index.push_back(0);
+        }
+        sphere_count = count;
+        built        = true;
+    }
+
+    bool hit(const ray & r, interval ray_t, hit_record & rec) const override
+    {
+        if constexpr (render_stats::enabled)
+            render_stats::local().hit_calls++;
+
+        return tree.traverse(r, ray_t, [&](uint32_t first, uint32_t count, interval & leaf_t) {
+            return hit_range(r, leaf_t, rec, first, first + count);
+        });
+    }
+
+    // Counts one hittable::hit call per ray in the render statistics.
+    void hit_stream(ray_stream & rays, real t_min, hit_record * recs, uint8_t * hits) const override
+    {
+        if constexpr (render_stats::enabled)
+            render_stats::local().hit_calls += rays.size();
+
+        std::fill(hits, hits + rays.size(), 0);
+        tree.traverse_stream(rays, t_min, [&](size_t k, uint32_t first, uint32_t count, interval & leaf_t) {
+            if (hit_range(rays.get(k), leaf_t, recs[k], first, first + count))
+                hits[k] = 1;
+        });
+    }
+
+    aabb bounding_box() const override
+    {
+        return tree.bounds();
+    }
+
+    size_t size() const
+    {
+        return sphere_count;
+    }
+
+    size_t node_count() const
+    {
+        return tree.nodes.size();
+    }
+
+    // Bytes used by the BVH nodes and the sphere arrays, not counting the materials.
+    size_t memory_bytes() const
+    {
+        return tree.nodes.size() * sizeof(linear_bvh_node) + radii.size() * (4 * sizeof(real) + sizeof(uint32_t));
+    }
+
+private:
+    std::vector<real>     center_x, center_y, center_z, radii;
+    std::vector<uint32_t> material_index;
+    size_t                sphere_count = 0;
+    bool                  built        = false;
+    linear_bvh_tree       tree;
+
+    std::vector<material>                          materials;    // each distinct material once
+    std::unordered_map<const material *, uint32_t> material_ids; // material to its index in `materials`
+
+    // Tests the spheres [first, end) against the ray, keeping the nearest root inside ray_t.
+    bool hit_range(const ray & r, interval & ray_t, hit_record & rec, uint32_t first, uint32_t end) const
+    {
+        uint32_t best = end;
+        real     a    = r.direction().length_squared();
+        point3   orig = r.origin();
+        vec3     dir  = r.direction();
+
+        if constexpr (render_stats::enabled)
+            render_stats::local().sphere_tests += end - first;
+
+        for (uint32_t i = first; i < end; i += lanes)
+        {
+            real     root = 0;
+            uint32_t lane = 0;
+            if (nearest_in_lanes(orig, dir, a, ray_t, i, end - i, root, lane))
+            {
+                best      = i + lane;
+                ray_t.max = root;
+            }
+        }
+
+        if (best == end)
+            return false;
+
+        // Fill in the record exactly as sphere::hit does.
+        point3 center(center_x[best], center_y[best], center_z[best]);
+        rec.t   = ray_t.max;
+        rec.p   = r.at(rec.t);
+        rec.mat = &materials[material_index[best]];
+
+        vec3 outward_normal = (rec.p - center) / radii[best];
+        rec.set_face_normal(r, outward_normal);
+
+        return true;
+    }
+
+#if SPHERE_SOUP_LANES == 4
+    // AVX: four spheres per instruction.
+    bool nearest_in_lanes(const point3 & orig, const vec3 & dir, double a, const interval & ray_t, uint32_t i,
+        uint32_t remaining, double & root_out, uint32_t & lane_out) const
+    {
+        const __m256d sign = _mm256_set1_pd(-0.0);
+
+        __m256d ocx = _mm256_sub_pd(_mm256_set1_pd(orig.x()), _mm256_loadu_pd(&center_x[i]));
+        __m256d ocy = _mm256_sub_pd(_mm256_set1_pd(orig.y()), _mm256_loadu_pd(&center_y[i]));
+        __m256d ocz = _mm256_sub_pd(_mm256_set1_pd(orig.z()), _mm256_loadu_pd(&center_z[i]));
+        __m256d rad = _mm256_loadu_pd(&radii[i]);
+
+        __m256d dx = _mm256_set1_pd(dir.x()), dy = _mm256_set1_pd(dir.y()), dz = _mm256_set1_pd(dir.z());
+        __m256d va = _mm256_set1_pd(a);
+
+        __m256d half_b = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, dx), _mm256_mul_pd(ocy, dy)),
+            _mm256_mul_pd(ocz, dz));
+        __m256d c      = _mm256_sub_pd(
+            _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, ocx), _mm256_mul_pd(ocy, ocy)), _mm256_mul_pd(ocz, ocz)),
+            _mm256_mul_pd(rad, rad));
+        __m256d D      = _mm256_sub_pd(_mm256_mul_pd(half_b, half_b), _mm256_mul_pd(va, c));
+
+        // A negative discriminant gives a NaN root, which never passes the surrounds test below.
+        __m256d sqrtd = _mm256_sqrt_pd(D);
+        __m256d neg_b = _mm256_xor_pd(half_b, sign);
+        __m256d root1 = _mm256_div_pd(_mm256_sub_pd(neg_b, sqrtd), va);
+        __m256d root2 = _mm256_div_pd(_mm256_add_pd(neg_b, sqrtd), va);
+
+        // interval::surrounds on each root, then the same root-1-else-root-2 choice as sphere::hit.
+        __m256d t_min    = _mm256_set1_pd(ray_t.min);
+        __m256d t_max    = _mm256_set1_pd(ray_t.max);
+        __m256d ok1      = _mm256_and_pd(
+            _mm256_cmp_pd(t_min, root1, _CMP_LT_OQ), _mm256_cmp_pd(root1, t_max, _CMP_LT_OQ));
+        __m256d ok2      = _mm256_and_pd(
+            _mm256_cmp_pd(t_min, root2, _CMP_LT_OQ), _mm256_cmp_pd(root2, t_max, _CMP_LT_OQ));
+        __m256d in_range = _mm256_cmp_pd(_mm256_set_pd(3, 2, 1, 0), _mm256_set1_pd(remaining), _CMP_LT_OQ);
+        __m256d root     = _mm256_blendv_pd(root2, root1, ok1);
+        int     mask     = _mm256_movemask_pd(_mm256_and_pd(_mm256_or_pd(ok1, ok2), in_range));
+
+        if (mask == 0)
+            return false;
+
+        alignas(32) double roots[4];
+        _mm256_store_pd(roots, root);
+        return pick_nearest(roots, mask, root_out, lane_out);
+    }
+#elif SPHERE_SOUP_LANES == 2
+    // SSE2: two spheres per instruction.
+    bool nearest_in_lanes(const point3 & orig, const vec3 & dir, double a, const interval & ray_t, uint32_t i,
+        uint32_t remaining, double & root_out, uint32_t & lane_out) const
+    {
+        const __m128d sign = _mm_set1_pd(-0.0);
+
+        __m128d ocx = _mm_sub_pd(_mm_set1_pd(orig.x()), _mm_loadu_pd(&center_x[i]));
+        __m128d ocy = _mm_sub_pd(_mm_set1_pd(orig.y()), _mm_loadu_pd(&center_y[i]));
+        __m128d ocz = _mm_sub_pd(_mm_set1_pd(orig.z()), _mm_loadu_pd(&center_z[i]));
+        __m128d rad = _mm_loadu_pd(&radii[i]);
+
+        __m128d dx = _mm_set1_pd(dir.x()), dy = _mm_set1_pd(dir.y()), dz = _mm_set1_pd(dir.z());
+        __m128d va = _mm_set1_pd(a);
+
+        __m128d half_b = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ocx, dx), _mm_mul_pd(ocy, dy)), _mm_mul_pd(ocz, dz));
+        __m128d c      = _mm_sub_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(ocx, ocx), _mm_mul_pd(ocy, ocy)),
+                                   _mm_mul_pd(ocz, ocz)),
+            _mm_mul_pd(rad, rad));
+        __m128d D      = _mm_sub_pd(_mm_mul_pd(half_b, half_b), _mm_mul_pd(va, c));
+
+        // A negative discriminant gives a NaN root, which never passes the surrounds test below.
+        __m128d sqrtd = _mm_sqrt_pd(D);
+        __m128d neg_b = _mm_xor_pd(half_b, sign);
+        __m128d root1 = _mm_div_pd(_mm_sub_pd(neg_b, sqrtd), va);
+        __m128d root2 = _mm_div_pd(_mm_add_pd(neg_b, sqrtd), va);
+
+        // interval::surrounds on each root, then the same root-1-else-root-2 choice as sphere::hit.
+        __m128d t_min    = _mm_set1_pd(ray_t.min);
+        __m128d t_max    = _mm_set1_pd(ray_t.max);
+        __m128d ok1      = _mm_and_pd(_mm_cmplt_pd(t_min, root1), _mm_cmplt_pd(root1, t_max));
+        __m128d ok2      = _mm_and_pd(_mm_cmplt_pd(t_min, root2), _mm_cmplt_pd(root2, t_max));
+        __m128d in_range = _mm_cmplt_pd(_mm_set_pd(1, 0), _mm_set1_pd(remaining));
+        __m128d root     = _mm_or_pd(_mm_and_pd(ok1, root1), _mm_andnot_pd(ok1, root2));
+        int     mask     = _mm_movemask_pd(_mm_and_pd(_mm_or_pd(ok1, ok2), in_range));
+
+        if (mask == 0)
+            return false;
+
+        alignas(16) double roots[2];
+        _mm_store_pd(roots, root);
+        return pick_nearest(roots, mask, root_out, lane_out);
+    }
+#else
+    // Scalar fallback: one sphere at a time, written exactly like sphere::hit.
+    bool nearest_in_lanes(const point3 & orig, const vec3 & dir, real a, const interval & ray_t, uint32_t i,
+        uint32_t /* remaining */, real & root_out, uint32_t & lane_out) const
+    {
+        vec3 oc     = orig - point3(center_x[i], center_y[i], center_z[i]);
+        auto half_b = dot(oc, dir);
+        auto c      = oc.length_squared() - radii[i] * radii[i];
+        auto D      = half_b * half_b - a * c;
+
+        if (D < 0)
+            return false;
+
+        auto sqrtd = std::sqrt(D);
+        auto root  = (-half_b - sqrtd) / a;
+        if (!ray_t.surrounds(root))
+        {
+            root = (-half_b + sqrtd) / a;
+            if (!ray_t.surrounds(root))
+                return false;
+        }
+
+        root_out = root;
+        lane_out = 0;
+        if constexpr (render_stats::enabled)
+            render_stats::local().sphere_hits++;
+        return true;
+    }
+#endif
+
+    // Nearest root among the lanes set in `mask`. Ties go to the lowest lane, matching the strict `<` that a
+    // sequential walk over the same spheres would apply.
+    static bool pick_nearest(const real * roots, int mask, real & root_out, uint32_t & lane_out)
+    {
+        if constexpr (render_stats::enabled)
+            render_stats::local().sphere_hits += std::bitset<8>(mask).count();
+
+        bool found = false;
+        for (uint32_t lane = 0; lane < static_cast<uint32_t>(lanes); ++lane)
+        {
+            if ((mask >> lane & 1) && (!found || roots[lane] < root_out))
+            {
+                root_out = roots[lane];
+                lane_out = lane;
+                found    = true;
+            }
+        }
+        return found;
+    }
+
+    // Drops the kernel padding so more spheres can be appended.
+    void strip_padding()
+    {
+        center_x.resize(sphere_count);
+        center_y.resize(sphere_count);
+        center_z.resize(sphere_count);
+        radii.resize(sphere_count);
+        material_index.resize(sphere_count);
+        built = false;
+    }
+
+    template <typename T>
+    static void permute(std::vector<T> & values, const std::vector<uint32_t> & order)
+    {
+        std::vector<T> sorted;
+        sorted.reserve(order.size());
+        for (uint32_t index : order)
+            sorted.push_back(values[index]);
+        values = std::move(sorted);
+    }
+};
+
+#endif
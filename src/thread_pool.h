@@ -0,0 +1,159 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed-size work-stealing thread pool.
+// Every worker owns a deque of tasks: it pops new work from the back of its own deque and, once that runs dry,
+// steals from the front of the other workers' deques. Submitted tasks are dealt out round-robin across the deques.
+class thread_pool
+{
+public:
+    explicit thread_pool(unsigned int thread_count)
+    {
+        if (thread_count == 0)
+            thread_count = default_thread_count();
+
+        for (unsigned int i = 0; i < thread_count; ++i)
+            queues.push_back(std::make_unique<worker_queue>());
+
+        for (unsigned int i = 0; i < thread_count; ++i)
+            workers.emplace_back([this, i] { worker_loop(i); });
+    }
+
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            stopping = true;
+        }
+        wake_cv.notify_all();
+        for (auto & worker : workers)
+            worker.join();
+    }
+
+    thread_pool(const thread_pool &)             = delete;
+    thread_pool & operator=(const thread_pool &) = delete;
+
+    // Number of hardware threads, or 1 when the platform cannot tell us.
+    static unsigned int default_thread_count()
+    {
+        unsigned int n = std::thread::hardware_concurrency();
+        return n == 0 ? 1 : n;
+    }
+
+    unsigned int size() const
+    {
+        return static_cast<unsigned int>(workers.size());
+    }
+
+    void submit(std::function<void()> task)
+    {
+        auto & queue = *queues[next_queue++ % queues.size()];
+        pending++;
+        {
+            // Count the task before it becomes visible so a fast thief can never drive `queued` below zero.
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            queued++;
+        }
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+        }
+        wake_cv.notify_one();
+    }
+
+    // Blocks until every submitted task has finished running.
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        done_cv.wait(lock, [this] { return pending == 0; });
+    }
+
+private:
+    struct worker_queue
+    {
+        std::mutex                        mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<worker_queue>> queues;
+    std::vector<std::thread>                   workers;
+
+    std::mutex              wake_mutex;
+    std::condition_variable wake_cv; // signalled when a task is queued or the pool is stopping
+    std::condition_variable done_cv; // signalled when the last pending task finishes
+    size_t                  queued   = 0;     // tasks sitting in a deque, guarded by wake_mutex
+    bool                    stopping = false; // guarded by wake_mutex
+
+    std::atomic<size_t>       pending{0}; // tasks submitted but not yet finished
+    std::atomic<unsigned int> next_queue{0};
+
+    void worker_loop(unsigned int index)
+    {
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(wake_mutex);
+                wake_cv.wait(lock, [this] { return queued > 0 || stopping; });
+                if (queued == 0)
+                    return; // stopping, and nothing left to do
+            }
+
+            std::function<void()> task;
+            if (!try_pop(index, task))
+                continue; // another worker got there first
+
+            {
+                std::lock_guard<std::mutex> lock(wake_mutex);
+                queued--;
+            }
+
+            task();
+
+            if (--pending == 0)
+            {
+                std::lock_guard<std::mutex> lock(wake_mutex);
+                done_cv.notify_all();
+            }
+        }
+    }
+
+    // Takes the newest task from our own deque, falling back to the oldest task of any other worker.
+    bool try_pop(unsigned int index, std::function<void()> & task)
+    {
+        {
+            auto &                      own = *queues[index];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty())
+            {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+
+        for (size_t offset = 1; offset < queues.size(); ++offset)
+        {
+            auto &                      victim = *queues[(index + offset) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty())
+            {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+
+        return false;
+    }
+};
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "aabb.h"
+#include "utils.h"
+#include "vec3.h"
+
+#include <cmath>
+
+// A placement of an object in the world: a uniform scale, then a rotation, then a translation, so a point p of the
+// object lands at offset + factor * rotate(p). Instanced scenes keep one of these per copy of an object, so it is
+// packed into 32 bytes of floats: the rotation as a unit quaternion, the translation and the scale. Both directions
+// are worked out from the same stored values, so a point taken to object space and back comes home up to rounding.
+class transform
+{
+public:
+    transform() {}
+
+    static transform translation(const vec3 & by)
+    {
+        transform t;
+        t.set_offset(by);
+        return t;
+    }
+
+    // A rotation by `degrees` about `axis`, counterclockwise looking down the axis towards the origin.
+    static transform rotation(const vec3 & axis, real degrees)
+    {
+        vec3      u    = unit_vector(axis);
+        double    half = utils::degrees_to_radians(degrees) / 2;
+        double    s    = std::sin(half);
+        transform t;
+        t.q[0] = static_cast<float>(u.x() * s);
+        t.q[1] = static_cast<float>(u.y() * s);
+        t.q[2] = static_cast<float>(u.z() * s);
+        t.q[3] = static_cast<float>(std::cos(half));
+        t.normalize();
+        return t;
+    }
+
+    // A uniform scale by a positive `factor`.
+    static transform scaling(real factor)
+    {
+        transform t;
+        t.factor = static_cast<float>(factor);
+        return t;
+    }
+
+    // The transform that applies `b` first and then `a`.
+    friend transform operator*(const transform & a, const transform & b)
+    {
+        transform t;
+        t.q[0] = a.q[3] * b.q[0] + a.q[0] * b.q[3] + a.q[1] * b.q[2] - a.q[2] * b.q[1];
+        t.q[1] = a.q[3] * b.q[1] - a.q[0] * b.q[2] + a.q[1] * b.q[3] + a.q[2] * b.q[0];
+        t.q[2] = a.q[3] * b.q[2] + a.q[0] * b.q[1] - a.q[1] * b.q[0] + a.q[2] * b.q[3];
+        t.q[3] = a.q[3] * b.q[3] - a.q[0] * b.q[0] - a.q[1] * b.q[1] - a.q[2] * b.q[2];
+        t.normalize();
+        t.factor = a.factor * b.factor;
+        t.set_offset(a.to_world(b.offset_vector()));
+        return t;
+    }
+
+    point3 to_world(const point3 & p) const
+    {
+        return offset_vector() + factor * rotate(p, 1);
+    }
+
+    vec3 to_world_vector(const vec3 & v) const
+    {
+        return factor * rotate(v, 1);
+    }
+
+    // Normals only turn: the scale is uniform, so a unit normal stays one.
+    vec3 to_world_normal(const vec3 & n) const
+    {
+        return rotate(n, 1);
+    }
+
+    point3 to_object(const point3 & p) const
+    {
+        return rotate(p - offset_vector(), -1) / factor;
+    }
+
+    vec3 to_object_vector(const vec3 & v) const
+    {
+        return rotate(v, -1) / factor;
+    }
+
+    // A box holding every point of `box` once placed: the placed center, widened by the extents turned through the
+    // absolute values of the rotation matrix.
+    aabb to_world(const aabb & box) const
+    {
+        if (box.x.min > box.x.max || box.y.min > box.y.max || box.z.min > box.z.max)
+            return aabb();
+
+        vec3 center = to_world(box.centroid());
+        vec3 half   = 0.5 * vec3(box.x.size(), box.y.size(), box.z.size());
+        vec3 extent;
+        for (int a = 0; a < 3; ++a)
+        {
+            vec3 column = rotate(vec3(a == 0, a == 1, a == 2), 1);
+            extent += half[a] * vec3(std::fabs(column.x()), std::fabs(column.y()), std::fabs(column.z()));
+        }
+
+        // A little slack for the rounding of the placement and of the corners themselves.
+        extent = factor * extent * (1 + 1e-5) + vec3(1e-6, 1e-6, 1e-6) * (1 + center.length());
+        return aabb(center - extent, center + extent);
+    }
+
+    real scale() const
+    {
+        return factor;
+    }
+
+private:
+    float q[4]      = {0, 0, 0, 1}; // the rotation as a unit quaternion (x, y, z, w)
+    float offset[3] = {0, 0, 0};
+    float factor    = 1;
+
+    vec3 offset_vector() const
+    {
+        return vec3(offset[0], offset[1], offset[2]);
+    }
+
+    void set_offset(const vec3 & v)
+    {
+        offset[0] = static_cast<float>(v.x());
+        offset[1] = static_cast<float>(v.y());
+        offset[2] = static_cast<float>(v.z());
+    }
+
+    void normalize()
+    {
+        float length = std::sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+        for (auto & c : q)
+            c /= length;
+    }
+
+    // Turns `v` by the rotation, or by its inverse with `sign` -1: v + 2w (u x v) + 2 u x (u x v), where u is the
+    // vector part of the quaternion, negated for the inverse.
+    vec3 rotate(const vec3 & v, int sign) const
+    {
+        vec3 u(sign * q[0], sign * q[1], sign * q[2]);
+        vec3 uv = cross(u, v);
+        return v + 2 * (real(q[3]) * uv + cross(u, uv));
+    }
+};
+
+static_assert(sizeof(transform) == 32, "transform must stay 32 bytes");
+
+#endif
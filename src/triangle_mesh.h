@@ -0,0 +1,308 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "aabb.h"
+#include "hittable.h"
+#include "linear_bvh.h"
+#include "material.h"
+#include "render_stats.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// The intersection kernel tests TRIANGLE_MESH_LANES triangles at once in single precision (see simd.h).
+#define TRIANGLE_MESH_LANES SIMD_LANES
+
+// The vertices of a triangle mesh, as loaded from a file. Positions and normals are structure-of-arrays floats, and
+// triangles refer to them by index, so a vertex shared by several triangles is stored once. Normals have indices of
+// their own, as in an OBJ file; a triangle without them (no_normal) is shaded flat. Any number of triangle_mesh
+// objects can share one set of buffers.
+struct mesh_buffers
+{
+    static constexpr uint32_t no_normal = std::numeric_limits<uint32_t>::max();
+
+    std::vector<float>    x, y, z;        // positions
+    std::vector<float>    nx, ny, nz;     // normals, not necessarily of unit length
+    std::vector<uint32_t> indices;        // three positions per triangle, counterclockwise seen from the front
+    std::vector<uint32_t> normal_indices; // three normals per triangle, or empty if the mesh has none
+
+    size_t vertex_count() const
+    {
+        return x.size();
+    }
+
+    size_t triangle_count() const
+    {
+        return indices.size() / 3;
+    }
+
+    bool has_normals() const
+    {
+        return !normal_indices.empty();
+    }
+
+    point3 position(uint32_t v) const
+    {
+        return point3(x[v], y[v], z[v]);
+    }
+
+    aabb triangle_box(size_t t) const
+    {
+        point3 a = position(indices[3 * t]), b = position(indices[3 * t + 1]), c = position(indices[3 * t + 2]);
+        return aabb(aabb(a, b), aabb(c, c));
+    }
+
+    size_t memory_bytes() const
+    {
+        return (x.size() + y.size() + z.size() + nx.size() + ny.size() + nz.size()) * sizeof(float) +
+               (indices.size() + normal_indices.size()) * sizeof(uint32_t);
+    }
+};
+
+// A triangle mesh with a BVH of its own. The mesh refers to shared mesh_buffers for its vertices, and keeps what the
+// intersection kernel reads in leaf order next to its tree: each triangle's first vertex and its two edges from that
+// vertex, nine floats in structure-of-arrays form, so every leaf is one contiguous run that the kernel loads
+// TRIANGLE_MESH_LANES triangles at a time, with no gathers through the index buffer. The buffers are only read again
+// for the one triangle a ray hits, to interpolate its normals.
+//
+// Rays are tested with the Möller-Trumbore algorithm (Möller and Trumbore, "Fast, Minimum Storage Ray/Triangle
+// Intersection", 1997) from both sides. It is not watertight: a ray through a shared edge or vertex can, rarely, slip
+// between the triangles on either side.
+class triangle_mesh : public hittable
+{
+public:
+    static constexpr int lanes         = TRIANGLE_MESH_LANES;
+    static constexpr int max_leaf_size = 2 * TRIANGLE_MESH_LANES < 4 ? 4 : 2 * TRIANGLE_MESH_LANES;
+
+    triangle_mesh(
+        std::shared_ptr<const mesh_buffers> _buffers, const material_table & _materials, material_table::id _material)
+        : buffers(std::move(_buffers)), materials(&_materials), mat(_material)
+    {
+        const mesh_buffers & mesh  = *buffers;
+        size_t               count = mesh.triangle_count();
+
+        auto order = tree.build(count, [&](size_t t) { return mesh.triangle_box(t); }, max_leaf_size, lanes);
+
+        // Pad past the end so a kernel load starting at the last leaf never reads outside the arrays.
+        for (auto * column : {&v0x, &v0y, &v0z, &e1x, &e1y, &e1z, &e2x, &e2y, &e2z})
+            column->reserve(count + lanes - 1);
+        triangle.reserve(count);
+        for (uint32_t t : order)
+        {
+            const uint32_t * corner = &mesh.indices[3 * size_t(t)];
+            uint32_t         a = corner[0], b = corner[1], c = corner[2];
+            v0x.push_back(mesh.x[a]);
+            v0y.push_back(mesh.y[a]);
+            v0z.push_back(mesh.z[a]);
+            e1x.push_back(mesh.x[b] - mesh.x[a]);
+            e1y.push_back(mesh.y[b] - mesh.y[a]);
+            e1z.push_back(mesh.z[b] - mesh.z[a]);
+            e2x.push_back(mesh.x[c] - mesh.x[a]);
+            e2y.push_back(mesh.y[c] - mesh.y[a]);
+            e2z.push_back(mesh.z[c] - mesh.z[a]);
+            triangle.push_back(t);
+        }
+        for (int i = 0; i < lanes - 1; ++i)
+        {
+            for (auto * column : {&v0x, &v0y, &v0z, &e1x, &e1y, &e1z, &e2x, &e2y, &e2z})
+                column->push_back(0);
+        }
+    }
+
+    bool hit(const ray & r, interval ray_t, hit_record & rec) const override
+    {
+        if constexpr (render_stats::enabled)
+            render_stats::local().hit_calls++;
+
+        return tree.traverse(r, ray_t, [&](uint32_t first, uint32_t count, interval & leaf_t) {
+            return hit_range(r, leaf_t, rec, first, first + count);
+        });
+    }
+
+    // Counts one hittable::hit call per ray in the render statistics.
+    void hit_stream(ray_stream & rays, real t_min, hit_record * recs, uint8_t * hits) const override
+    {
+        if constexpr (render_stats::enabled)
+            render_stats::local().hit_calls += rays.size();
+
+        std::fill(hits, hits + rays.size(), 0);
+        tree.traverse_stream(rays, t_min, [&](size_t k, uint32_t first, uint32_t count, interval & leaf_t) {
+            if (hit_range(rays.get(k), leaf_t, recs[k], first, first + count))
+                hits[k] = 1;
+        });
+    }
+
+    aabb bounding_box() const override
+    {
+        return tree.bounds();
+    }
+
+    size_t size() const
+    {
+        return triangle.size();
+    }
+
+    size_t node_count() const
+    {
+        return tree.nodes.size();
+    }
+
+    const mesh_buffers & vertex_buffers() const
+    {
+        return *buffers;
+    }
+
+    // Bytes used by the BVH nodes and the kernel's arrays, not counting the shared buffers.
+    size_t memory_bytes() const
+    {
+        return tree.nodes.size() * sizeof(linear_bvh_node) + v0x.size() * 9 * sizeof(float) +
+               triangle.size() * sizeof(uint32_t);
+    }
+
+private:
+    std::shared_ptr<const mesh_buffers> buffers;
+    const material_table *              materials; // owned by the scene
+    material_table::id                  mat;
+
+    std::vector<float>    v0x, v0y, v0z, e1x, e1y, e1z, e2x, e2y, e2z; // leaf order, padded for the kernel
+    std::vector<uint32_t> triangle;                                     // leaf order to the buffers' triangle
+    linear_bvh_tree       tree;
+
+    // The ray in the kernel's single precision.
+    struct float_ray
+    {
+        float ox, oy, oz, dx, dy, dz;
+    };
+
+    // Tests the triangles [first, end) against the ray, keeping the nearest hit inside ray_t.
+    bool hit_range(const ray & r, interval & ray_t, hit_record & rec, uint32_t first, uint32_t end) const
+    {
+        float_ray fr = {float(r.origin().x()), float(r.origin().y()), float(r.origin().z()),
+            float(r.direction().x()), float(r.direction().y()), float(r.direction().z())};
+
+        if constexpr (render_stats::enabled)
+            render_stats::local().triangle_tests += end - first;
+
+        uint32_t best   = end;
+        float    best_u = 0, best_v = 0;
+        for (uint32_t i = first; i < end; i += lanes)
+        {
+            float t, u, v;
+            int   lane;
+            // The kernel compares against the interval rounded to float, so check it again in full precision.
+            if (nearest_in_lanes(fr, ray_t, i, end - i, t, u, v, lane) && ray_t.surrounds(t))
+            {
+                best      = i + lane;
+                best_u    = u;
+                best_v    = v;
+                ray_t.max = t;
+            }
+        }
+
+        if (best == end)
+            return false;
+
+        rec.t   = ray_t.max;
+        rec.p   = r.at(rec.t);
+        rec.mat = &(*materials)[mat];
+
+        // The face is the geometric one; an interpolated normal only bends the shading, turned to the same side.
+        vec3 geometric = cross(vec3(e1x[best], e1y[best], e1z[best]), vec3(e2x[best], e2y[best], e2z[best]));
+        rec.front_face = dot(r.direction(), geometric) < 0;
+        vec3 normal    = shading_normal(triangle[best], best_u, best_v, geometric);
+        rec.normal     = rec.front_face ? normal : -normal;
+        return true;
+    }
+
+    // Unit normal at barycentrics (u, v) of buffer triangle `t`, from its vertex normals where it has them.
+    vec3 shading_normal(uint32_t t, float u, float v, const vec3 & geometric) const
+    {
+        const mesh_buffers & mesh = *buffers;
+        if (mesh.has_normals())
+        {
+            const uint32_t * n = &mesh.normal_indices[3 * size_t(t)];
+            if (n[0] != mesh_buffers::no_normal)
+            {
+                real w[3]   = {1 - real(u) - real(v), real(u), real(v)};
+                vec3 normal = vec3(0, 0, 0);
+                for (int k = 0; k < 3; ++k)
+                {
+                    vec3 corner(mesh.nx[n[k]], mesh.ny[n[k]], mesh.nz[n[k]]);
+                    normal += w[k] * unit_vector(corner);
+                }
+                // Normals that face away from the triangle are a broken export; fall back to the flat normal.
+                if (normal.length_squared() > 0 && dot(normal, geometric) > 0)
+                    return unit_vector(normal);
+            }
+        }
+        return unit_vector(geometric);
+    }
+
+    // Möller-Trumbore over `lanes` triangles from index i, of which `remaining` are real. On a hit inside ray_t,
+    // returns the nearest distance, its barycentrics and its lane. Ties go to the lowest lane.
+    bool nearest_in_lanes(const float_ray & fr, const interval & ray_t, uint32_t i, uint32_t remaining, float & t_out,
+        float & u_out, float & v_out, int & lane_out) const
+    {
+        using namespace simd;
+
+        pack dx = splat(fr.dx), dy = splat(fr.dy), dz = splat(fr.dz);
+        pack ax = load(&e1x[i]), ay = load(&e1y[i]), az = load(&e1z[i]);
+        pack bx = load(&e2x[i]), by = load(&e2y[i]), bz = load(&e2z[i]);
+
+        pack px  = dy * bz - dz * by;
+        pack py  = dz * bx - dx * bz;
+        pack pz  = dx * by - dy * bx;
+        pack det = ax * px + ay * py + az * pz;
+        pack inv = splat(1) / det;
+
+        pack tx = splat(fr.ox) - load(&v0x[i]);
+        pack ty = splat(fr.oy) - load(&v0y[i]);
+        pack tz = splat(fr.oz) - load(&v0z[i]);
+        pack u  = (tx * px + ty * py + tz * pz) * inv;
+
+        pack qx = ty * az - tz * ay;
+        pack qy = tz * ax - tx * az;
+        pack qz = tx * ay - ty * ax;
+        pack v  = (dx * qx + dy * qy + dz * qz) * inv;
+        pack t  = (bx * qx + by * qy + bz * qz) * inv;
+
+        // A ray in the plane of a triangle has det 0, which makes every comparison below false or fails u + v <= 1.
+        pack zero = splat(0);
+        int  mask = not_equal(det, zero) & less_equal(zero, u) & less_equal(zero, v) & less_equal(u + v, splat(1)) &
+                   less(splat(float(ray_t.min)), t) & less(t, splat(float(ray_t.max)));
+        mask &= (1 << std::min<uint32_t>(remaining, lanes)) - 1;
+        if (mask == 0)
+            return false;
+
+        if constexpr (render_stats::enabled)
+            render_stats::local().triangle_hits += std::bitset<8>(mask).count();
+
+        float ts[TRIANGLE_MESH_LANES], us[TRIANGLE_MESH_LANES], vs[TRIANGLE_MESH_LANES];
+        store(ts, t);
+        store(us, u);
+        store(vs, v);
+
+        bool found = false;
+        for (int lane = 0; lane < TRIANGLE_MESH_LANES; ++lane)
+        {
+            if ((mask >> lane & 1) && (!found || ts[lane] < t_out))
+            {
+                t_out    = ts[lane];
+                u_out    = us[lane];
+                v_out    = vs[lane];
+                lane_out = lane;
+                found    = true;
+            }
+        }
+        return found;
+    }
+};
+
+#endif
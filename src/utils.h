@@ -3,25 +3,154 @@
 
 #include "constants.h"
 
+#include <cstdint>
 #include <cstdlib>
+#include <ctime>
 #include <iostream>
 #include <random>
 
 namespace utils
 {
 
+// PCG32 (XSH-RR variant) by Melissa O'Neill: 64 bits of state, 32 bits of output, and 2^63 selectable streams.
+class pcg32
+{
+public:
+    using result_type = uint32_t;
+
+    pcg32() : pcg32(0, 0) {}
+
+    pcg32(uint64_t seed_value, uint64_t stream)
+    {
+        seed(seed_value, stream);
+    }
+
+    void seed(uint64_t seed_value, uint64_t stream)
+    {
+        state = 0;
+        inc   = (stream << 1) | 1;
+        (*this)();
+        state += seed_value;
+        (*this)();
+    }
+
+    result_type operator()()
+    {
+        uint64_t old   = state;
+        state          = old * 6364136223846793005ULL + inc;
+        uint32_t xored = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+        uint32_t rot   = static_cast<uint32_t>(old >> 59);
+        return (xored >> rot) | (xored << ((32 - rot) & 31));
+    }
+
+private:
+    uint64_t state, inc;
+};
+
+// xoshiro256++ by Blackman and Vigna: 256 bits of state and 64 bits of output.
+// It has no native streams, so a stream is selected by folding it into the splitmix64 seeding.
+class xoshiro256pp
+{
+public:
+    using result_type = uint64_t;
+
+    xoshiro256pp() : xoshiro256pp(0, 0) {}
+
+    xoshiro256pp(uint64_t seed_value, uint64_t stream)
+    {
+        seed(seed_value, stream);
+    }
+
+    void seed(uint64_t seed_value, uint64_t stream)
+    {
+        uint64_t x = seed_value ^ (stream * 0xd1342543de82ef95ULL);
+        for (auto & word : s)
+            word = splitmix64(x);
+    }
+
+    result_type operator()()
+    {
+        uint64_t result = rotl(s[0] + s[3], 23) + s[0];
+        uint64_t t      = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return result;
+    }
+
+private:
+    uint64_t s[4];
+
+    static uint64_t rotl(uint64_t x, int k)
+    {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    static uint64_t splitmix64(uint64_t & x)
+    {
+        uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+        z          = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z          = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+};
+
+// The generator behind random_double. Build with -DRT_RNG_XOSHIRO to swap in xoshiro256++.
+#ifdef RT_RNG_XOSHIRO
+using rng = xoshiro256pp;
+#else
+using rng = pcg32;
+#endif
+
+// Maps raw generator output onto [0,1), keeping as many bits as the generator gives us (up to a double mantissa).
+inline double to_unit_double(uint32_t bits)
+{
+    return bits * 0x1.0p-32;
+}
+
+inline double to_unit_double(uint64_t bits)
+{
+    return (bits >> 11) * 0x1.0p-53;
+}
+
+// The seed that every random stream in the program is derived from.
+inline unsigned int & base_seed()
+{
+    static unsigned int seed = 1;
+    return seed;
+}
+
+// Each thread owns its own generator, so render workers never share RNG state.
+inline rng & generator()
+{
+    thread_local rng gen(base_seed(), 0);
+    return gen;
+}
+
+// seed the random number generator with a specific provided seed
+void randomize(unsigned int seed)
+{
+    base_seed() = seed;
+    generator().seed(seed, 0);
+}
+
 // seed the random number generator, call this once.
 void randomize()
 {
     unsigned int seed = static_cast<unsigned int>(time(NULL));
     std::clog << "Seed to Use: " << seed << std::endl;
-    srand(seed);
+    randomize(seed);
 }
 
-// seed the random number generator with a specific provided seed
-void randomize(unsigned int seed)
+// Restarts the calling thread's generator on its own stream for `stream` (eg. a pixel index).
+// The numbers drawn afterwards depend only on the base seed and the stream, not on which thread draws them.
+// Stream 0 is the one randomize() starts, which the scene setup draws from.
+inline void reseed(uint64_t stream)
 {
-    srand(seed);
+    generator().seed(base_seed(), stream + 1);
 }
 
 inline double degrees_to_radians(double degrees)
@@ -32,7 +161,7 @@ inline double degrees_to_radians(double degrees)
 // Returns a random real in [0,1).
 inline double random_double()
 {
-    return rand() / (RAND_MAX + 1.0);
+    return to_unit_double(generator()());
 }
 
 // Returns a random real in [min,max).
@@ -41,13 +170,5 @@ inline double random_double_range(double min, double max)
     return min + (max - min) * random_double();
 }
 
-// Returns a random real in [0,1).
-// inline double random_double()
-// {
-//     static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-//     static std::mt19937                           generator;
-//     return distribution(generator);
-// }
-
 } // namespace utils
 #endif
\ No newline at end of file
@@ -3,78 +3,262 @@
 
 #include "utils.h"
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 
+// The layout of vec3 is picked at compile time. By default it is three packed reals. Build with -DRT_SIMD_VEC3 to pad
+// it to four lanes aligned to one register, so the arithmetic operators, dot and cross each compile to a handful of
+// vector instructions: SSE for float, AVX2 for double (its lane shuffles need AVX2). Without that instruction set the
+// option has no effect. The padding lane is never read, and every lane does the scalar operators' arithmetic in the
+// same order, so both layouts compute bit-identical results.
+#if defined(RT_SIMD_VEC3) && defined(RT_FLOAT) && defined(__SSE__)
+#include <immintrin.h>
+#define VEC3_SIMD 1
+#elif defined(RT_SIMD_VEC3) && !defined(RT_FLOAT) && defined(__AVX2__)
+#include <immintrin.h>
+#define VEC3_SIMD 1
+#else
+#define VEC3_SIMD 0
+#endif
+
+#if VEC3_SIMD
+// The four-lane register operations the padded vec3 is built on.
+namespace vec3_lanes
+{
+
+#ifdef RT_FLOAT
+using reg = __m128;
+
+inline reg load(const real * p)
+{
+    return _mm_load_ps(p);
+}
+
+inline void store(real * p, reg r)
+{
+    _mm_store_ps(p, r);
+}
+
+inline reg broadcast(real t)
+{
+    return _mm_set1_ps(t);
+}
+
+inline reg add(reg a, reg b)
+{
+    return _mm_add_ps(a, b);
+}
+
+inline reg sub(reg a, reg b)
+{
+    return _mm_sub_ps(a, b);
+}
+
+inline reg mul(reg a, reg b)
+{
+    return _mm_mul_ps(a, b);
+}
+
+// Flips the sign bits, which unlike 0 - x also turns +0 into -0.
+inline reg negate(reg a)
+{
+    return _mm_xor_ps(a, _mm_set1_ps(-0.0f));
+}
+
+// (y, z, x, w) and (z, x, y, w)
+inline reg yzx(reg a)
+{
+    return _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+inline reg zxy(reg a)
+{
+    return _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 1, 0, 2));
+}
+
+// (x + y) + z, the order of the scalar dot product.
+inline real sum3(reg a)
+{
+    __m128 xy = _mm_add_ss(a, _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 2, 1, 1)));
+    return _mm_cvtss_f32(_mm_add_ss(xy, _mm_movehl_ps(a, a)));
+}
+#else
+using reg = __m256d;
+
+inline reg load(const real * p)
+{
+    return _mm256_load_pd(p);
+}
+
+inline void store(real * p, reg r)
+{
+    _mm256_store_pd(p, r);
+}
+
+inline reg broadcast(real t)
+{
+    return _mm256_set1_pd(t);
+}
+
+inline reg add(reg a, reg b)
+{
+    return _mm256_add_pd(a, b);
+}
+
+inline reg sub(reg a, reg b)
+{
+    return _mm256_sub_pd(a, b);
+}
+
+inline reg mul(reg a, reg b)
+{
+    return _mm256_mul_pd(a, b);
+}
+
+// Flips the sign bits, which unlike 0 - x also turns +0 into -0.
+inline reg negate(reg a)
+{
+    return _mm256_xor_pd(a, _mm256_set1_pd(-0.0));
+}
+
+// (y, z, x, w) and (z, x, y, w)
+inline reg yzx(reg a)
+{
+    return _mm256_permute4x64_pd(a, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+inline reg zxy(reg a)
+{
+    return _mm256_permute4x64_pd(a, _MM_SHUFFLE(3, 1, 0, 2));
+}
+
+// (x + y) + z, the order of the scalar dot product.
+inline real sum3(reg a)
+{
+    __m128d xy  = _mm256_castpd256_pd128(a);
+    __m128d sum = _mm_add_sd(xy, _mm_unpackhi_pd(xy, xy));
+    return _mm_cvtsd_f64(_mm_add_sd(sum, _mm256_extractf128_pd(a, 1)));
+}
+#endif
+
+} // namespace vec3_lanes
+#endif
+
 class vec3
 {
   public:
-    double e[3];
+#if VEC3_SIMD
+    alignas(sizeof(vec3_lanes::reg)) real e[4];
+
+    vec3() : e{0, 0, 0, 0} {}
+    vec3(real e0, real e1, real e2) : e{e0, e1, e2, 0} {}
+    explicit vec3(vec3_lanes::reg r)
+    {
+        vec3_lanes::store(e, r);
+    }
+
+    // Copies go through one register, so a copy that is read back by a vector load can be forwarded from the store.
+    vec3(const vec3 & v)
+    {
+        vec3_lanes::store(e, v.lanes());
+    }
+
+    vec3 & operator=(const vec3 & v)
+    {
+        vec3_lanes::store(e, v.lanes());
+        return *this;
+    }
+
+    vec3_lanes::reg lanes() const
+    {
+        return vec3_lanes::load(e);
+    }
+#else
+    real e[3];
 
     vec3() : e{0, 0, 0} {}
-    vec3(double e0, double e1, double e2) : e{e0, e1, e2} {}
+    vec3(real e0, real e1, real e2) : e{e0, e1, e2} {}
+#endif
 
-    double x() const
+    real x() const
     {
         return e[0];
     }
-    double y() const
+    real y() const
     {
         return e[1];
     }
-    double z() const
+    real z() const
     {
         return e[2];
     }
 
     vec3 operator-() const
     {
+#if VEC3_SIMD
+        return vec3(vec3_lanes::negate(lanes()));
+#else
         return vec3(-e[0], -e[1], -e[2]);
+#endif
     }
-    double operator[](int i) const
+    real operator[](int i) const
     {
         return e[i];
     }
-    double & operator[](int i)
+    real & operator[](int i)
     {
         return e[i];
     }
 
     vec3 & operator+=(const vec3 & v)
     {
+#if VEC3_SIMD
+        vec3_lanes::store(e, vec3_lanes::add(lanes(), v.lanes()));
+#else
         e[0] += v.e[0];
         e[1] += v.e[1];
         e[2] += v.e[2];
+#endif
         return *this;
     }
 
-    vec3 & operator*=(double t)
+    vec3 & operator*=(real t)
     {
+#if VEC3_SIMD
+        vec3_lanes::store(e, vec3_lanes::mul(lanes(), vec3_lanes::broadcast(t)));
+#else
         e[0] *= t;
         e[1] *= t;
         e[2] *= t;
+#endif
         return *this;
     }
 
-    vec3 & operator/=(double t)
+    vec3 & operator/=(real t)
     {
         return *this *= 1 / t;
     }
 
-    double length() const
+    real length() const
     {
         return std::sqrt(length_squared());
     }
 
-    double length_squared() const
+    real length_squared() const
     {
+#if VEC3_SIMD
+        return vec3_lanes::sum3(vec3_lanes::mul(lanes(), lanes()));
+#else
         return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
+#endif
     }
 
     bool near_zero() const
     {
-        auto s = 1e-8;
-        return (fabs(e[0]) < s) && (fabs(e[1]) < s) && (fabs(e[2]) < s);
+        // Single precision cancels to values around 1e-7 rather than to zero, so it needs a wider threshold.
+        const real s = sizeof(real) < sizeof(double) ? real(1e-4) : real(1e-8);
+        return (std::fabs(e[0]) < s) && (std::fabs(e[1]) < s) && (std::fabs(e[2]) < s);
     }
 
     static vec3 random()
@@ -82,7 +266,7 @@ class vec3
         return vec3(utils::random_double(), utils::random_double(), utils::random_double());
     }
 
-    static vec3 random(double min, double max)
+    static vec3 random(real min, real max)
     {
         return vec3(utils::random_double_range(min, max), utils::random_double_range(min, max),
             utils::random_double_range(min, max));
@@ -99,6 +283,48 @@ inline std::ostream & operator<<(std::ostream & out, const vec3 & v)
     return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
 }
 
+#if VEC3_SIMD
+inline vec3 operator+(const vec3 & u, const vec3 & v)
+{
+    return vec3(vec3_lanes::add(u.lanes(), v.lanes()));
+}
+
+inline vec3 operator-(const vec3 & u, const vec3 & v)
+{
+    return vec3(vec3_lanes::sub(u.lanes(), v.lanes()));
+}
+
+inline vec3 operator*(const vec3 & u, const vec3 & v)
+{
+    return vec3(vec3_lanes::mul(u.lanes(), v.lanes()));
+}
+
+inline vec3 operator*(real t, const vec3 & v)
+{
+    return vec3(vec3_lanes::mul(vec3_lanes::broadcast(t), v.lanes()));
+}
+
+inline vec3 operator*(const vec3 & v, real t)
+{
+    return t * v;
+}
+
+inline vec3 operator/(vec3 v, real t)
+{
+    return (1 / t) * v;
+}
+
+inline real dot(const vec3 & u, const vec3 & v)
+{
+    return vec3_lanes::sum3(vec3_lanes::mul(u.lanes(), v.lanes()));
+}
+
+inline vec3 cross(const vec3 & u, const vec3 & v)
+{
+    using namespace vec3_lanes;
+    return vec3(sub(mul(yzx(u.lanes()), zxy(v.lanes())), mul(zxy(u.lanes()), yzx(v.lanes()))));
+}
+#else
 inline vec3 operator+(const vec3 & u, const vec3 & v)
 {
     return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
@@ -114,22 +340,22 @@ inline vec3 operator*(const vec3 & u, const vec3 & v)
     return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
 }
 
-inline vec3 operator*(double t, const vec3 & v)
+inline vec3 operator*(real t, const vec3 & v)
 {
     return vec3(t * v.e[0], t * v.e[1], t * v.e[2]);
 }
 
-inline vec3 operator*(const vec3 & v, double t)
+inline vec3 operator*(const vec3 & v, real t)
 {
     return t * v;
 }
 
-inline vec3 operator/(vec3 v, double t)
+inline vec3 operator/(vec3 v, real t)
 {
     return (1 / t) * v;
 }
 
-inline double dot(const vec3 & u, const vec3 & v)
+inline real dot(const vec3 & u, const vec3 & v)
 {
     return u.e[0] * v.e[0] + u.e[1] * v.e[1] + u.e[2] * v.e[2];
 }
@@ -139,25 +365,58 @@ inline vec3 cross(const vec3 & u, const vec3 & v)
     return vec3(
         u.e[1] * v.e[2] - u.e[2] * v.e[1], u.e[2] * v.e[0] - u.e[0] * v.e[2], u.e[0] * v.e[1] - u.e[1] * v.e[0]);
 }
+#endif
 
 inline vec3 unit_vector(vec3 v)
 {
     return v / v.length();
 }
 
-inline vec3 random_in_unit_sphere()
+// Maps a uniform point of the unit square to a uniform direction: z is uniform on [-1, 1] (Archimedes' hat-box
+// theorem) and the angle around the z axis is uniform.
+inline vec3 sphere_direction(double u, double v)
+{
+    real z   = real(1 - 2 * u);
+    real r   = std::sqrt(std::max(real(0), 1 - z * z));
+    real phi = real(2 * pi * v);
+    return vec3(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+// Maps a uniform point of the unit square to a uniform point of the unit disk (z = 0) with Shirley and Chiu's
+// concentric mapping, which takes squares around the center to rings and so keeps stratified points stratified.
+inline vec3 concentric_disk(double u, double v)
 {
-    while (true)
+    real a = real(2 * u - 1);
+    real b = real(2 * v - 1);
+    if (a == 0 && b == 0)
+        return vec3(0, 0, 0);
+
+    real r, phi;
+    if (std::fabs(a) > std::fabs(b))
     {
-        auto p = vec3::random(-1, 1);
-        if (p.length_squared() < 1)
-            return p;
+        r   = a;
+        phi = (pi / 4) * (b / a);
     }
+    else
+    {
+        r   = b;
+        phi = (pi / 2) - (pi / 4) * (a / b);
+    }
+    return vec3(r * std::cos(phi), r * std::sin(phi), 0);
 }
 
 inline vec3 random_unit_vector()
 {
-    return unit_vector(random_in_unit_sphere());
+    double u = utils::random_double();
+    double v = utils::random_double();
+    return sphere_direction(u, v);
+}
+
+// A uniform direction scaled by the cube root of a uniform draw, which spreads points evenly by volume.
+inline vec3 random_in_unit_sphere()
+{
+    vec3 direction = random_unit_vector();
+    return real(std::cbrt(utils::random_double())) * direction;
 }
 
 inline vec3 random_on_hemisphere(const vec3 & normal)
@@ -179,22 +438,19 @@ vec3 reflect(const vec3 & v, const vec3 & n)
     return v - 2 * dot(v, n) * n;
 }
 
-inline vec3 refract(const vec3 & uv, const vec3 & n, double etai_over_etat)
+inline vec3 refract(const vec3 & uv, const vec3 & n, real etai_over_etat)
 {
-    auto cos_theta      = fmin(dot(-uv, n), 1.0);
+    auto cos_theta      = std::fmin(dot(-uv, n), real(1));
     vec3 r_out_perp     = etai_over_etat * (uv + cos_theta * n);
-    vec3 r_out_parallel = -sqrt(fabs(1.0 - r_out_perp.length_squared())) * n;
+    vec3 r_out_parallel = -std::sqrt(std::fabs(1 - r_out_perp.length_squared())) * n;
     return r_out_perp + r_out_parallel;
 }
 
 inline vec3 random_in_unit_disk()
 {
-    while (true)
-    {
-        auto p = vec3(utils::random_double_range(-1, 1), utils::random_double_range(-1, 1), 0);
-        if (p.length_squared() < 1)
-            return p;
-    }
+    double u = utils::random_double();
+    double v = utils::random_double();
+    return concentric_disk(u, v);
 }
 
 #endif
\ No newline at end of file